@@ -197,6 +197,7 @@ handle_admin (void *vcon)
 thread_mutex_lock(&info.admin_mutex);
   close_connection (con);
 thread_mutex_unlock(&info.admin_mutex);
+  update_debug_level ();
 
   thread_exit(0);
   return NULL;
@@ -304,6 +305,7 @@ handle_admin_with_readline (void *vcon)
 thread_mutex_lock(&info.admin_mutex);
   close_connection (con);
 thread_mutex_unlock(&info.admin_mutex);
+  update_debug_level ();
 
   thread_exit(0);
 
@@ -342,6 +344,7 @@ handle_remote_admin(connection_t *con)
 thread_mutex_lock(&info.admin_mutex);
   close_connection (con);
 thread_mutex_unlock(&info.admin_mutex);
+  update_debug_level ();
 
 }
 
@@ -414,6 +417,7 @@ add_ntripcaster_console()
   if (info.console_mode == CONSOLE_ADMIN_TAIL) {
     write_log(LOG_DEFAULT, "Tailing file to NtripCaster operator console");
     adm->tailing = 1;
+    update_debug_level ();
   }
 
   con->id = new_id();
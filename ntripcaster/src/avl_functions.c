@@ -202,6 +202,21 @@ int compare_sourcetable_entrys (const void *first, const void *second, void *par
   return ntripcaster_strcmp (ste1->id, ste2->id);
 }
 
+int compare_sourcetable_filters (const void *first, const void *second, void *param)
+{
+  sourcetable_filter_t *f1 = (sourcetable_filter_t *) first,
+                       *f2 = (sourcetable_filter_t *) second;
+
+  if (!first || !second || !f1->filter || !f2->filter) {
+    xa_debug (2, "WARNING: compare_sourcetable_filters called with NULL pointers!");
+    return 0;
+  }
+  if (f1->matchonly != f2->matchonly)
+    return f1->matchonly - f2->matchonly;
+
+  return strcmp (f1->filter, f2->filter);
+}
+
 int compare_sessions (const void *first, const void *second, void *param)
 {
   rtsp_session_t *s1, *s2;
@@ -271,6 +286,48 @@ int compare_nontrip_sources (const void *first, const void *second, void *param)
     return res;
 }
 
+int compare_mount_settings (const void *first, const void *second, void *param)
+{
+  mountsettings_t *m1 = (mountsettings_t *)first;
+  mountsettings_t *m2 = (mountsettings_t *)second;
+
+  if (!first || !second)
+  {
+    write_log (LOG_DEFAULT, "WARNING: compare_mount_settings called with null pointers");
+    return 0;
+  }
+
+  return ntripcaster_strcmp (m1->mount, m2->mount);
+}
+
+int compare_mount_connections (const void *first, const void *second, void *param)
+{
+  connection_t *c1 = (connection_t *)first;
+  connection_t *c2 = (connection_t *)second;
+
+  if (!first || !second)
+  {
+    write_log (LOG_DEFAULT, "WARNING: compare_mount_connections called with null pointers");
+    return 0;
+  }
+
+  return ntripcaster_strcmp (c1->food.source->audiocast.mount, c2->food.source->audiocast.mount);
+}
+
+int compare_host_mounts (const void *first, const void *second, void *param)
+{
+  connection_t *c1 = (connection_t *)first;
+  connection_t *c2 = (connection_t *)second;
+
+  if (!first || !second)
+  {
+    write_log (LOG_DEFAULT, "WARNING: compare_host_mounts called with null pointers");
+    return 0;
+  }
+
+  return ntripcaster_strcmp (c1->food.source->hostkey, c2->food.source->hostkey);
+}
+
 int compare_strings (const void *first, const void *second, void *param)
 {
   char *a1 = (char *)first, *a2 = (char *)second;
@@ -57,10 +57,14 @@ int compare_mem (const void *first, const void *second, void *param);
 int compare_item (const void *first, const void *second, void *param);
 int compare_sockets (const void *first, const void *second, void *param);
 int compare_sourcetable_entrys (const void *first, const void *second, void *param);
+int compare_sourcetable_filters (const void *first, const void *second, void *param);
 int compare_sessions (const void *first, const void *second, void *param);
 int compare_header_elements (const void *first, const void *second, void *param);
 int compare_messages (const void *first, const void *second, void *param);
 int compare_nontrip_sources (const void *first, const void *second, void *param); // nontrip. ajd
+int compare_mount_settings (const void *first, const void *second, void *param);
+int compare_mount_connections (const void *first, const void *second, void *param);
+int compare_host_mounts (const void *first, const void *second, void *param);
 
 void free_connection(void *data, void *param);
 void zero_trav(avl_traverser *trav);
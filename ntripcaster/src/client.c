@@ -103,8 +103,11 @@
 #include "sourcetable.h"
 #include "match.h"
 #include "pool.h"
+#include "rtcm3.h"
+#include "replay.h"
 #include "logtime.h"
 #include "sourcetable.h"
+#include "nearest.h"
 
 #include <signal.h>
 
@@ -134,6 +137,15 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
   const char *var;
   char time[50];
   alias_t *wasalias = 0;
+  rtcm3_filter_t *filter = NULL;
+  ntrip_request_t vreq;
+  char replay_mount[BUFSIZE];
+  time_t replay_time = 0;
+  int replay, replay_speed = 1;
+  unsigned long max_listeners;
+  replay_t rp;
+  nearest_t *near = NULL;
+  int greeted = 0;
 
   xa_debug(3, "http client login...");
 
@@ -195,6 +207,17 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     return;
   }
 
+  if (!strncasecmp((req->path)+1,"?near",5)) {
+    if(con->udpbuffers && !info.sourcetable_via_udp)
+    {
+      kick_not_connected (con, "No sourcetable via UDP allowed");
+      return;
+    }
+    send_sourcetable_near(con, (req->path)+1+5);
+    kick_not_connected (con, "Transfer nearest sourcetable");
+    return;
+  }
+
 
   if (!strncasecmp((req->path)+1,"?auth",5) ||!strncasecmp((req->path)+1,"?strict",7)) {
     ntrip_write_message(con, HTTP_NOT_IMPLEMENTED,
@@ -203,7 +226,20 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     return;
   }
 
-  if (!authenticate_user_request (con, req, client_e)) {
+  /* /MOUNT@START replays the recording of /MOUNT, it needs the same rights */
+  memset (&rp, 0, sizeof (rp));
+  replay = replay_parse_path (req->path, replay_mount, &replay_time, &replay_speed);
+  if (replay < 0) {
+    ntrip_write_message(con, HTTP_GET_STREAM_WRONG_MOUNT, get_formatted_time(HEADER_TIME, time));
+    kick_not_connected (con, "Invalid replay request");
+    return;
+  } else if (replay) {
+    vreq = *req;
+    strncpy (vreq.path, replay_mount, BUFSIZE);
+    vreq.path[BUFSIZE-1] = 0;
+  }
+
+  if (!authenticate_user_request (con, replay ? &vreq : req, client_e)) {
     ntrip_write_message(con, HTTP_GET_NOT_AUTHORIZED, get_formatted_time(HEADER_TIME, time), req->path, "text/html");
     kick_not_connected (con, "Not authorized");
     return;
@@ -245,16 +281,55 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     return;
   }
 
+  /* A "nearest" mount is served by the connected base closest to the
+   * client. Ntrip 2.0 clients can send their position with the request,
+   * the others get the response and have to send a GGA sentence then. */
+  if (!replay && source_nearest (req->path)) {
+    put_client (con);
+    near = con->food.client->near = nearest_create ();
+
+    var = get_con_variable (con, "Ntrip-GGA");
+    if (var == NULL || !nmea_parse_gga (var, &near->lat, &near->lon)) {
+      greet_client (con, NULL);
+      greeted = 1;
+      if (!nearest_wait (con, near, NEAREST_WAIT * 1000)) {
+        kick_not_connected (con, "No position from client");
+        return;
+      }
+    }
+    near->moved = 0;
+    near->generation = info.sourcetable.generation;
+  }
+
   xa_debug (1, "Looking for mount [%s:%d%s]", req->host, req->port, req->path);
 
+  /* finding the recording reads the disk, not with the locks held */
+  if (replay)
+    replay_start (&rp, replay_mount, replay_time, replay_speed);
+
   thread_mutex_lock (&info.double_mutex);
   thread_mutex_lock (&info.source_mutex);
 
-  source = find_mount_with_req (req, &wasalias);
+  /* A replay is served by the replay thread, a virtual mount gets the
+   * filtered data of another one */
+  if (replay)
+    source = rp.segment != NULL ? replay_get_source () : NULL;
+  else if ((filter = source_mount_filter (req->path, vreq.path)) != NULL) {
+    xa_debug (1, "DEBUG: Virtual mount [%s] uses [%s]", req->path, vreq.path);
+    strncpy (vreq.host, req->host, BUFSIZE);
+    vreq.host[BUFSIZE-1] = 0;
+    vreq.port = req->port;
+    source = find_mount_with_req (&vreq, &wasalias);
+  } else if (near != NULL)
+    source = nearest_base_wl (con, near->lat, near->lon, NULL, NULL);
+  else
+    source = find_mount_with_req (req, &wasalias);
 
   if (wasalias && !authenticate_user_request (con, wasalias->real, client_e)) {
     thread_mutex_unlock (&info.source_mutex);
     thread_mutex_unlock (&info.double_mutex);
+    rtcm3_filter_free (filter);
+    replay_stop (&rp);
 
     ntrip_write_message(con, HTTP_GET_NOT_AUTHORIZED, get_formatted_time(HEADER_TIME, time), req->path, "text/html");
     kick_not_connected (con, "Not authorized");
@@ -266,8 +341,12 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
 
     thread_mutex_unlock (&info.source_mutex);
     thread_mutex_unlock (&info.double_mutex);
+    rtcm3_filter_free (filter);
+    replay_stop (&rp);
 
-    if (con->com_protocol == ntrip2_0_e)
+    if (greeted)
+      xa_debug (1, "DEBUG: No base near [%f %f] for client %d", near->lat, near->lon, con->id);
+    else if (con->com_protocol == ntrip2_0_e)
       ntrip_write_message(con, HTTP_GET_STREAM_WRONG_MOUNT, get_formatted_time(HEADER_TIME, time));
     else
       send_sourcetable(con);
@@ -276,14 +355,19 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     //xa_debug (1, "DEBUG: http_client_login(): end");
     return;
   } else {
-    if ((info.num_clients >= info.max_clients) || (source->food.source->num_clients >= info.max_clients_per_source)) {
+    /* all replays share the replay thread's source and have their own limit */
+    max_listeners = replay ? (unsigned long) info.max_replays : info.max_clients_per_source;
+
+    if ((info.num_clients >= info.max_clients) || (source->food.source->num_clients >= max_listeners)) {
       thread_mutex_unlock (&info.source_mutex);
       thread_mutex_unlock (&info.double_mutex);
+      rtcm3_filter_free (filter);
+      replay_stop (&rp);
 
       if (info.num_clients >= info.max_clients)
         xa_debug (2, "DEBUG: inc > imc: %lu %lu", info.num_clients, info.max_clients);
-      else if (source->food.source->num_clients >= info.max_clients_per_source)
-        xa_debug (2, "DEBUG: snc > smc: %lu %lu", source->food.source->num_clients, info.max_clients_per_source);
+      else if (source->food.source->num_clients >= max_listeners)
+        xa_debug (2, "DEBUG: snc > smc: %lu %lu", source->food.source->num_clients, max_listeners);
       else
         xa_debug (1, "ERROR: Erroneous number of clients, what the hell is going on?");
 
@@ -293,6 +377,8 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     } else if (!check_ip_restrictions(con)) {
       thread_mutex_unlock (&info.source_mutex);
       thread_mutex_unlock (&info.double_mutex);
+      rtcm3_filter_free (filter);
+      replay_stop (&rp);
 
       ntrip_write_message(con, HTTP_SERVICE_UNAVAILABLE, get_formatted_time(HEADER_TIME, time));
       kick_not_connected (con, "Server Full (too many accesses from IP)");
@@ -302,14 +388,22 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
     if (!add_group_connection(con)) {
       thread_mutex_unlock (&info.source_mutex);
       thread_mutex_unlock (&info.double_mutex);
+      rtcm3_filter_free (filter);
+      replay_stop (&rp);
       ntrip_write_message(con, HTTP_SERVICE_UNAVAILABLE, get_formatted_time(HEADER_TIME, time));
       kick_not_connected (con, "No more connections allowed for group");
       return;
     }
 
-    put_client(con);
+    if (near == NULL)
+      put_client(con);
     con->food.client->type = http_client_e;
     con->food.client->source = source->food.source;
+    con->food.client->filter = filter;
+    if (replay) {
+      con->food.client->replay = rp;
+      con->food.client->pos = rp.ring.head;
+    }
     var = get_con_variable(con, "Referer");
     if (var && strncmp(var, "RELAY", 5) == 0) con->food.client->type = pulling_client_e;
 
@@ -320,7 +414,8 @@ void http_client_login(connection_t *con, ntrip_request_t *req) {
 //    source->food.source->stats.client_connections++;
 
 
-    greet_client(con, source->food.source);
+    if (!greeted)
+      greet_client(con, source->food.source);
     util_increase_total_clients();
     pool_add (con);
 
@@ -345,13 +440,21 @@ client_t *create_client() {
 void put_client(connection_t *con) {
   client_t *cli = create_client();
   con->food.client = cli;
-  cli->errors = 0;
   cli->type = unknown_client_e;
   cli->write_bytes = 0;
   cli->virgin = -1;
   cli->source = NULL;
-  cli->cid = -1;
-  cli->offset = 0;
+  cli->next_new = NULL;
+  cli->prime = NULL;
+  cli->prime_len = 0;
+  cli->prime_off = 0;
+  cli->filter = NULL;
+  cli->skips = 0;
+  cli->home = NULL;
+  cli->near = NULL;
+  memset(&cli->replay, 0, sizeof(replay_t));
+  cli->pos = 0;
+  cli->blocked = 0;
   cli->alive = CLIENT_ALIVE;
   con->type = client_e;
 }
@@ -406,6 +509,10 @@ greet_client(connection_t *con, source_t *source)
   if (con->sock > 0 && sock_set_blocking(con->sock, SOCK_BLOCKNOT) < 0)
     write_log(LOG_DEFAULT, "WARNING: sock_set_blocking in greet_client failed");
 
+  /* Every write carries all pending data, don't let Nagle delay it */
+  if (con->sock > 0)
+    sock_set_no_delay(con->sock);
+
   if(con->udpbuffers)
   {
     con->rtp->datagram->pt = 96;
@@ -441,10 +548,11 @@ describe_client (const com_request_t *req, const connection_t *clicon)
   client = clicon->food.client;
 
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_START, "Misc client info:");
-  admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Transfer error balance: %d", client_errors (client));
-  admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Transfer chunk id and offset: %d : %d", client->cid, client->offset);
+  admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Transfer lag: %d bytes", client_errors (client));
+  admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Transfer position: %llu", client->pos);
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Bytes transfered: %lu", client->write_bytes);
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Virgin: %s", client->virgin ? "yes" : "no");
+  admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Skipped ahead: %lu times", client->skips);
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Client type: %s", client_type (clicon));
   if (client->source && client->source->audiocast.mount)
     admin_write_line (req, ADMIN_SHOW_DESCRIBE_CLIENT_MISC, "Mountpoint: %s", client->source->audiocast.mount);
@@ -458,11 +566,15 @@ client_type (const connection_t *clicon) {
   return client_types[clicon->food.client->type+1];
 }
 
+/* Number of bytes the client is behind its source */
 int
 client_errors (const client_t *client)
 {
-  if (!client || !client->source)
+  if (!client || !client->source || client->virgin != 0)
+    return 0;
+
+  if (client->pos >= client_ring (client->source, client)->head)
     return 0;
 
-  return (CHUNKLEN - (client->cid - client->source->cid)) % CHUNKLEN;
+  return (int)(client_ring (client->source, client)->head - client->pos);
 }
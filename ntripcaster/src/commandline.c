@@ -186,6 +186,7 @@ parse_args(int argc, char **argv)
         case 'V':
           info.logfiledebuglevel = 8;
           info.consoledebuglevel = 8;
+          update_debug_level ();
           break;
         default:
           usage();
@@ -94,6 +94,7 @@
 #include "admin.h"
 #include "sourcetable.h"
 #include "match.h"
+#include "latency.h"
 #include "connection.h"
 #include "item.h"
 #include "authenticate/basic.h"
@@ -101,6 +102,7 @@
 #include "authenticate/group.h"
 #include "authenticate/mount.h"
 #include "pool.h"
+#include "event.h"
 #include "interpreter.h"
 #include "http.h"
 #include "vars.h"
@@ -189,6 +191,8 @@ comp_element commands[] =
     "auth <groups|users|mounts>\r\n\tList all authentication entries for users, groups or mounts.\r\n"},
   { "scheme", com_scheme, "Change output format.", 0, 1, "scheme <default|html|tagged>\r\n\tChange the output format for all admin commands.\r\n"},
   { "server_info", com_runtime, "Display runtime information.", 0, 0, "server_info\r\n\tDisplay information about server only available at runtime.\r\n"},
+  { "latency", com_latency, "Show how long data waits in the caster.", 0, 1,
+    "latency [pattern]\r\n\tShow the 50th, 99th and 99.9th percentile of the time from reading data from a source to sending it to a client, for sources matching pattern or all sources.\r\n"},
   { (char *) NULL, (ntripcaster_int_function *)NULL, (char *)NULL, 0 , 1}
 };
 
@@ -327,6 +331,16 @@ set_element configfile_settings[] =
   { "encrypt_passwords", string_e, "Encrypt base parameter for password encryption", NULL },
 #endif /* USE_CRYPT */
   { "sourcetable_via_udp", integer_e, "Send Sourcetable via UDP (1) or default not (0)", NULL },
+  { "mount_buffer_size", integer_e, "Bytes of client backlog per mountpoint", NULL },
+  { "lag_policy", string_e, "Clients falling out of the backlog: kick, frame or epoch", NULL },
+  { "recorddir", string_e, "Directory for recorded streams", NULL },
+  { "record_segment_size", integer_e, "Bytes of one recorded segment file", NULL },
+  { "record_max_age", integer_e, "Hours recorded streams are kept (0 for ever)", NULL },
+  { "record_max_size", integer_e, "Megabytes all recorded streams may take (0 for no limit)", NULL },
+  { "max_replays", integer_e, "Highest number of clients replaying recorded streams", NULL },
+  { "source_threads", integer_e, "Threads serving all sources and their clients (read at startup)", NULL },
+  { "stall_timeout", integer_e, "Milliseconds without data before a source stalls, until its cadence is known (0 to wait for it)", NULL },
+  { "stall_epochs", integer_e, "Missed epochs before a source stalls (0 to use stall_timeout only)", NULL },
   { (char *) NULL, 0, (char *) NULL, NULL }
 };
 
@@ -431,6 +445,16 @@ setup_config_file_settings()
   configfile_settings[x++].setting = &info.encrypt_passwords;
 #endif /* USE_CRYPT */
   configfile_settings[x++].setting = &info.sourcetable_via_udp;
+  configfile_settings[x++].setting = &info.mount_buffer_size;
+  configfile_settings[x++].setting = &info.lag_policy;
+  configfile_settings[x++].setting = &info.recorddir;
+  configfile_settings[x++].setting = &info.record_segment_size;
+  configfile_settings[x++].setting = &info.record_max_age;
+  configfile_settings[x++].setting = &info.record_max_size;
+  configfile_settings[x++].setting = &info.max_replays;
+  configfile_settings[x++].setting = &info.source_threads;
+  configfile_settings[x++].setting = &info.stall_timeout;
+  configfile_settings[x++].setting = &info.stall_epochs;
 }
 
 set_element *
@@ -467,10 +491,11 @@ parse_default_config_file()
   return 1;
 }
 
-/* Parse the configfile pointed to by file.
+/* Parse the configfile pointed to by file, and the files it includes,
+   collecting the mountpoint settings in mountsettings.
    If it doesn't exist, no matter, just go on */
-int
-parse_config_file(char *file)
+static int
+parse_config_lines(char *file, avl_tree *mountsettings)
 {
   set_element *se;
   char word[BUFSIZE], line[BUFSIZE];
@@ -622,9 +647,14 @@ parse_config_file(char *file)
       add_nontrip_source(line);
       continue;
     }
+    else if (ntripcaster_strncmp(word, "mountpoint", 10) == 0)
+    {
+      add_mount_settings(mountsettings, line);
+      continue;
+    }
     else if (ntripcaster_strncmp(word, "include", 7) == 0)
     {
-      parse_config_file(line);
+      parse_config_lines(line, mountsettings);
       continue;
     }
     else if (ntripcaster_strncmp(word, "allow", 5) == 0)
@@ -661,6 +691,32 @@ parse_config_file(char *file)
   return 0;
 }
 
+/* Parse the configfile pointed to by file.
+   If it doesn't exist, no matter, just go on */
+int
+parse_config_file(char *file)
+{
+  avl_tree *mountsettings;
+
+  if (!file)
+    return 0;
+
+  /* The mountpoint settings of this file replace the current ones as a
+     whole, so settings removed from the file are dropped */
+  mountsettings = avl_create(compare_mount_settings, &info);
+
+  if (parse_config_lines(file, mountsettings) != 0)
+  {
+    avl_destroy(mountsettings, NULL);
+    return 1;
+  }
+
+  source_set_mount_settings(mountsettings);
+  update_debug_level ();
+  info.config_generation++;
+  return 0;
+}
+
 /* Top level remote admin console command parser */
 void
 handle_admin_command (connection_t *con, char *command, int command_len)
@@ -944,6 +1000,7 @@ com_tail (com_request_t *req)
 {
   admin_write_line (req, ADMIN_SHOW_TAILING_ON, "Now tailing logfile");
   req->con->food.admin->tailing = 1;
+  update_debug_level ();
   return 1;
 }
 
@@ -952,6 +1009,7 @@ com_untail (com_request_t *req)
 {
   admin_write_line (req, ADMIN_SHOW_TAILING_OFF, "No longer tailing logfile");
   req->con->food.admin->tailing = 0;
+  update_debug_level ();
   return 1;
 }
 
@@ -1274,6 +1332,40 @@ com_uptime (com_request_t *req)
   return 1;
 }
 
+int
+com_latency (com_request_t *req)
+{
+  char *arg = com_arg (req);
+  connection_t *sourcecon;
+  avl_traverser trav = {0};
+  unsigned long long count[LATENCY_BUCKETS], sum, total;
+  int listed = 0;
+
+  admin_write_line (req, ADMIN_SHOW_LATENCY_START, "Time from reading to sending data, in milliseconds:");
+
+  thread_mutex_lock (&info.source_mutex);
+
+  while ((sourcecon = avl_traverse (info.sources, &trav)))
+  {
+    if (arg && arg[0] && !hostmatch (sourcecon, arg))
+      continue;
+
+    total = latency_snapshot (&sourcecon->food.source->latency, count, &sum);
+    admin_write_line (req, ADMIN_SHOW_LATENCY_ENTRY, "[Mountpoint: %s] [Samples: %llu] [Mean: %.3f] [p50: %.3f] [p99: %.3f] [p99.9: %.3f]",
+                      nullcheck_string (sourcecon->food.source->audiocast.mount), total,
+                      total ? sum / 1000.0 / total : 0.0,
+                      latency_percentile (count, total, 0.5) / 1000.0,
+                      latency_percentile (count, total, 0.99) / 1000.0,
+                      latency_percentile (count, total, 0.999) / 1000.0);
+    listed++;
+  }
+
+  thread_mutex_unlock (&info.source_mutex);
+
+  admin_write_line (req, ADMIN_SHOW_LATENCY_END, "End of latency listing (%d listed)", listed);
+  return 1;
+}
+
 int
 com_tell (com_request_t *req)
 {
@@ -1494,6 +1586,20 @@ com_stats_prom (com_request_t *req)
     admin_write_raw (req, "# TYPE caster_sources_clients_connections_total counter\n");
     admin_write_raw (req, "# HELP caster_sources_duration_seconds The activity time of the mountpoint.\n");
     admin_write_raw (req, "# TYPE caster_sources_duration_seconds gauge\n");
+    admin_write_raw (req, "# HELP caster_sources_rtcm3_frames_total The number of valid RTCM3 frames of the connected source.\n");
+    admin_write_raw (req, "# TYPE caster_sources_rtcm3_frames_total counter\n");
+    admin_write_raw (req, "# HELP caster_sources_rtcm3_crc_errors_total The number of RTCM3 frames with a wrong CRC of the connected source.\n");
+    admin_write_raw (req, "# TYPE caster_sources_rtcm3_crc_errors_total counter\n");
+    admin_write_raw (req, "# HELP caster_sources_rtcm3_resyncs_total The number of broken RTCM3 frames of the connected source.\n");
+    admin_write_raw (req, "# TYPE caster_sources_rtcm3_resyncs_total counter\n");
+    admin_write_raw (req, "# HELP caster_sources_rtcm3_discarded_bytes_total The number of bytes outside valid RTCM3 frames of the connected source.\n");
+    admin_write_raw (req, "# TYPE caster_sources_rtcm3_discarded_bytes_total counter\n");
+    admin_write_raw (req, "# HELP caster_sources_stalls_total The number of times the connected source stopped sending for longer than its cadence allows.\n");
+    admin_write_raw (req, "# TYPE caster_sources_stalls_total counter\n");
+    admin_write_raw (req, "# HELP caster_sources_stalled Whether the connected source is stalled.\n");
+    admin_write_raw (req, "# TYPE caster_sources_stalled gauge\n");
+    admin_write_raw (req, "# HELP caster_sources_cadence_seconds The learned time between epochs of the connected source.\n");
+    admin_write_raw (req, "# TYPE caster_sources_cadence_seconds gauge\n");
 
     while ((e = avl_traverse (info.sourcesstats, &trav)))
     {
@@ -1501,9 +1607,9 @@ com_stats_prom (com_request_t *req)
       if (*mp == '/')
         ++mp;
       admin_write_raw (req, "caster_sources_received_bytes_total{mp=\"%s\"} %lu\n", mp, e->stats.read_kilos*1024);
-      admin_write_raw (req, "caster_sources_sent_bytes_total{mp=\"%s\"} %lu\n", mp, e->stats.write_kilos*1024);
+      admin_write_raw (req, "caster_sources_sent_bytes_total{mp=\"%s\"} %llu\n", mp, e->stats.write_kilos*1024ULL + traffic_get (e->replay_write_bytes));
       admin_write_raw (req, "caster_sources_connections_total{mp=\"%s\"} %lu\n", mp, e->stats.source_connections);
-      admin_write_raw (req, "caster_sources_clients_connections_total{mp=\"%s\"} %lu\n", mp, e->stats.client_connections);
+      admin_write_raw (req, "caster_sources_clients_connections_total{mp=\"%s\"} %llu\n", mp, e->stats.client_connections + traffic_get (e->replay_clients));
     }
     zero_trav (&trav);
 
@@ -1514,7 +1620,44 @@ com_stats_prom (com_request_t *req)
         ++mp;
       admin_write_raw (req, "caster_sources_clients_num{mp=\"%s\"} %lu\n", mp, source->food.source->num_clients);
       admin_write_raw (req, "caster_sources_duration_seconds{mp=\"%s\"} %lu\n", mp, get_time () - source->connect_time);
+      admin_write_raw (req, "caster_sources_stalls_total{mp=\"%s\"} %lu\n", mp, source->food.source->stalls);
+      admin_write_raw (req, "caster_sources_stalled{mp=\"%s\"} %d\n", mp, source->food.source->stalled ? 1 : 0);
+      if (source->food.source->cadence > 0)
+        admin_write_raw (req, "caster_sources_cadence_seconds{mp=\"%s\"} %.3f\n", mp, source->food.source->cadence / 1000.0);
+      if (source->food.source->rtcm3)
+      {
+        const rtcm3_t *rtcm3 = source->food.source->rtcm3;
+        admin_write_raw (req, "caster_sources_rtcm3_frames_total{mp=\"%s\"} %lu\n", mp, rtcm3->num_frames);
+        admin_write_raw (req, "caster_sources_rtcm3_crc_errors_total{mp=\"%s\"} %lu\n", mp, rtcm3->crc_errors);
+        admin_write_raw (req, "caster_sources_rtcm3_resyncs_total{mp=\"%s\"} %lu\n", mp, rtcm3->resyncs);
+        admin_write_raw (req, "caster_sources_rtcm3_discarded_bytes_total{mp=\"%s\"} %llu\n", mp, rtcm3->discarded);
+      }
+    }
+    zero_trav (&trav);
+
+    admin_write_raw (req, "# HELP caster_sources_send_latency_seconds The time from reading data from the connected source to sending it to a client.\n");
+    admin_write_raw (req, "# TYPE caster_sources_send_latency_seconds histogram\n");
+
+    thread_mutex_lock (&info.source_mutex);
+    while ((source = avl_traverse (info.sources, &trav)))
+    {
+      const char * mp = nullcheck_string (source->food.source->audiocast.mount);
+      unsigned long long count[LATENCY_BUCKETS], sum, total, cum = 0;
+      int b;
+
+      if (*mp == '/')
+        ++mp;
+      total = latency_snapshot (&source->food.source->latency, count, &sum);
+      for (b = 0; b < LATENCY_BUCKETS - 1; b++)
+      {
+        cum += count[b];
+        admin_write_raw (req, "caster_sources_send_latency_seconds_bucket{mp=\"%s\",le=\"%g\"} %llu\n", mp, latency_bounds[b] / 1000000.0, cum);
+      }
+      admin_write_raw (req, "caster_sources_send_latency_seconds_bucket{mp=\"%s\",le=\"+Inf\"} %llu\n", mp, total);
+      admin_write_raw (req, "caster_sources_send_latency_seconds_sum{mp=\"%s\"} %.6f\n", mp, sum / 1000000.0);
+      admin_write_raw (req, "caster_sources_send_latency_seconds_count{mp=\"%s\"} %llu\n", mp, total);
     }
+    thread_mutex_unlock (&info.source_mutex);
   }
   #ifdef _DEFAULT_SOURCE
   {
@@ -1680,6 +1823,7 @@ move_to (void *clientarg, void *sourcetargetarg)
   connection_t *sourcetarget = (connection_t *)sourcetargetarg;
 
   avl_delete (client->food.client->source->clients, client);
+  event_del (client->food.client->source->events, client->sock);
   del_client (client, client->food.client->source);
   client->food.client->virgin = 1;
   client->food.client->alive = CLIENT_ALIVE;
@@ -2189,8 +2333,12 @@ com_modify (com_request_t *req)
       sourcecon->food.source->audiocast.name = nstrdup (arg);
       break;
     case 'm':
+      thread_mutex_lock (&info.source_mutex);
+      mount_index_remove (sourcecon);
       nfree (sourcecon->food.source->audiocast.mount);
       sourcecon->food.source->audiocast.mount = nstrdup (arg);
+      mount_index_add (sourcecon);
+      thread_mutex_unlock (&info.source_mutex);
       break;
     default:
       admin_write (req, ADMIN_SHOW_MODIFY_INVALID_SYNTAX, MODIFY_USAGE);
@@ -2266,6 +2414,7 @@ com_debug (com_request_t *req)
   }
 
   req->con->food.admin->debuglevel = atoi (arg);
+  update_debug_level ();
 
   admin_write_line (req, ADMIN_SHOW_DEBUG_CHANGED_TO, "Your debugging level is now [%d]", req->con->food.admin->debuglevel);
   return 0;
@@ -2541,7 +2690,9 @@ com_runtime (com_request_t *req)
   admin_write_line (req, ADMIN_SHOW_RUNTIME_SLEEP_METHOD, "Using usleep() as sleep method - THIS MAY BE UNSAFE");
 #endif
 #endif
-  admin_write_line (req, ADMIN_SHOW_RUNTIME_BACKLOG, "Using %d chunks of %d bytes for client backlog", CHUNKLEN, SOURCE_READSIZE);
+  admin_write_line (req, ADMIN_SHOW_RUNTIME_BACKLOG, "Using %d bytes of client backlog per mountpoint", info.mount_buffer_size);
+  admin_write_line (req, ADMIN_SHOW_RUNTIME_BACKLOG, "Clients falling out of the backlog: %s", info.lag_policy);
+  admin_write_line (req, ADMIN_SHOW_RUNTIME_BACKLOG, "Sources stall after %d missed epochs, or %d milliseconds without data", info.stall_epochs, info.stall_timeout);
 
   switch (info.resolv_type)
   {
@@ -2684,6 +2835,7 @@ change_variable (com_request_t *req, set_element *s, char *argument, char *arg)
   {
     int oldval = *(int *)(s->setting);
     *(int *)(s->setting) = atoi (arg);
+    update_debug_level ();
     admin_write_line (req, ADMIN_SHOW_SETTINGS_CHANGED_INT, "%s changed from %d to %d", argument, oldval, *(int *)(s->setting));
   } else if (s->type == real_e)
   {
@@ -70,7 +70,7 @@ int
   com_modify(), com_locks(),
   com_debug (), com_mem (),
   com_describe (), com_acl (), com_auth (), com_scheme (),
-  com_runtime ();
+  com_runtime (), com_latency ();
 
 void handle_admin_command(connection_t *con, char *command, int command_len);
 void show_settings(com_request_t *req);
@@ -359,6 +359,11 @@ char *settings_generator (char *text, int state);
 #define ADMIN_SHOW_MEM_MCHECK_FREE 559
 #define ADMIN_SHOW_MEM_MCHECK_KEEPCOST 560
 
+/* com_latency () */
+#define ADMIN_SHOW_LATENCY_START 570
+#define ADMIN_SHOW_LATENCY_ENTRY 571
+#define ADMIN_SHOW_LATENCY_END 572
+
 /* com_sourcetable (). */
 #define ADMIN_SHOW_SOURCETABLE 600
 #define ADMIN_SHOW_SOURCETABLE_LINE 601
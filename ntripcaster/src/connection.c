@@ -135,7 +135,7 @@ void *handle_connection(void *arg) {
     sock_set_blocking(con->sock, SOCK_BLOCKNOT);
 
     /* Fill line[] with the user header, ends with \n\n */
-    if ((res = sock_read_lines_with_timeout(con->sock, line, BUFSIZE)) <= BUFSIZE) {
+    if ((res = sock_read_lines_with_timeout_con(con, line, BUFSIZE)) <= BUFSIZE) {
       write_log(LOG_DEFAULT, "handle_connnection(): Socket error on connection %d", con->id);
       kick_not_connected(con, "Socket error");
       thread_exit(0);
@@ -208,6 +208,7 @@ create_connection()
   con->session_id = -1;
   con->rtp = NULL;
   con->http_chunk = NULL;
+  con->readbuf = NULL;
 
 #ifdef HAVE_TLS
   con->tls_socket = 0;
@@ -538,6 +539,7 @@ void *handle_nontrip_connection(void *arg) { // nontrip. ajd
 
   add_source();
   avl_insert(info.sources, con);
+  mount_index_add(con);
 
   thread_mutex_unlock(&info.source_mutex);
 
@@ -545,7 +547,6 @@ void *handle_nontrip_connection(void *arg) { // nontrip. ajd
 
   write_log (LOG_DEFAULT, "Accepted encoder (NoNTRIP) on mountpoint %s and port %d from %s. %d sources connected", source->audiocast.mount, con->nontripsrc->port, con_host(con), info.num_sources);
 
-  thread_rename("NoNTRIP Source Thread");
   source_func(con);
 
   thread_exit(0);
@@ -0,0 +1,295 @@
+/* crc24q.c
+ * - CRC24Q functions
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC24Q_CLMUL
+#include <immintrin.h>
+#endif
+
+#include "crc24q.h"
+
+/*
+ * The CRC24Q of RTCM3 (polynomial 0x1864CFB, no reflection, initial value
+ * 0) in three variants: byte by byte as the reference, slicing-by-4 which
+ * takes 4 bytes per step, and folding with carry-less multiplication
+ * (PCLMULQDQ) 64 bytes per step, which is used for longer buffers when
+ * the CPU has it. The sliced and folded variants keep the CRC in the
+ * upper 24 of 32 bits, as a CRC with the polynomial times x^8, so data is
+ * taken in whole 32 bit words. See src/crc24qbench.c for the check of the
+ * variants against each other and their speed.
+ */
+
+#define CRC24Q_POLY32 0x1864CFB00ULL /* x^32 + ... , the polynomial times x^8 */
+#define CRC24Q_FOLD_MIN 64             /* shorter buffers are sliced */
+
+/* CRC24Q of a single byte */
+static const unsigned long crc24q_table[256] = {
+  0x000000, 0x864CFB, 0x8AD50D, 0x0C99F6, 0x93E6E1, 0x15AA1A, 0x1933EC, 0x9F7F17,
+  0xA18139, 0x27CDC2, 0x2B5434, 0xAD18CF, 0x3267D8, 0xB42B23, 0xB8B2D5, 0x3EFE2E,
+  0xC54E89, 0x430272, 0x4F9B84, 0xC9D77F, 0x56A868, 0xD0E493, 0xDC7D65, 0x5A319E,
+  0x64CFB0, 0xE2834B, 0xEE1ABD, 0x685646, 0xF72951, 0x7165AA, 0x7DFC5C, 0xFBB0A7,
+  0x0CD1E9, 0x8A9D12, 0x8604E4, 0x00481F, 0x9F3708, 0x197BF3, 0x15E205, 0x93AEFE,
+  0xAD50D0, 0x2B1C2B, 0x2785DD, 0xA1C926, 0x3EB631, 0xB8FACA, 0xB4633C, 0x322FC7,
+  0xC99F60, 0x4FD39B, 0x434A6D, 0xC50696, 0x5A7981, 0xDC357A, 0xD0AC8C, 0x56E077,
+  0x681E59, 0xEE52A2, 0xE2CB54, 0x6487AF, 0xFBF8B8, 0x7DB443, 0x712DB5, 0xF7614E,
+  0x19A3D2, 0x9FEF29, 0x9376DF, 0x153A24, 0x8A4533, 0x0C09C8, 0x00903E, 0x86DCC5,
+  0xB822EB, 0x3E6E10, 0x32F7E6, 0xB4BB1D, 0x2BC40A, 0xAD88F1, 0xA11107, 0x275DFC,
+  0xDCED5B, 0x5AA1A0, 0x563856, 0xD074AD, 0x4F0BBA, 0xC94741, 0xC5DEB7, 0x43924C,
+  0x7D6C62, 0xFB2099, 0xF7B96F, 0x71F594, 0xEE8A83, 0x68C678, 0x645F8E, 0xE21375,
+  0x15723B, 0x933EC0, 0x9FA736, 0x19EBCD, 0x8694DA, 0x00D821, 0x0C41D7, 0x8A0D2C,
+  0xB4F302, 0x32BFF9, 0x3E260F, 0xB86AF4, 0x2715E3, 0xA15918, 0xADC0EE, 0x2B8C15,
+  0xD03CB2, 0x567049, 0x5AE9BF, 0xDCA544, 0x43DA53, 0xC596A8, 0xC90F5E, 0x4F43A5,
+  0x71BD8B, 0xF7F170, 0xFB6886, 0x7D247D, 0xE25B6A, 0x641791, 0x688E67, 0xEEC29C,
+  0x3347A4, 0xB50B5F, 0xB992A9, 0x3FDE52, 0xA0A145, 0x26EDBE, 0x2A7448, 0xAC38B3,
+  0x92C69D, 0x148A66, 0x181390, 0x9E5F6B, 0x01207C, 0x876C87, 0x8BF571, 0x0DB98A,
+  0xF6092D, 0x7045D6, 0x7CDC20, 0xFA90DB, 0x65EFCC, 0xE3A337, 0xEF3AC1, 0x69763A,
+  0x578814, 0xD1C4EF, 0xDD5D19, 0x5B11E2, 0xC46EF5, 0x42220E, 0x4EBBF8, 0xC8F703,
+  0x3F964D, 0xB9DAB6, 0xB54340, 0x330FBB, 0xAC70AC, 0x2A3C57, 0x26A5A1, 0xA0E95A,
+  0x9E1774, 0x185B8F, 0x14C279, 0x928E82, 0x0DF195, 0x8BBD6E, 0x872498, 0x016863,
+  0xFAD8C4, 0x7C943F, 0x700DC9, 0xF64132, 0x693E25, 0xEF72DE, 0xE3EB28, 0x65A7D3,
+  0x5B59FD, 0xDD1506, 0xD18CF0, 0x57C00B, 0xC8BF1C, 0x4EF3E7, 0x426A11, 0xC426EA,
+  0x2AE476, 0xACA88D, 0xA0317B, 0x267D80, 0xB90297, 0x3F4E6C, 0x33D79A, 0xB59B61,
+  0x8B654F, 0x0D29B4, 0x01B042, 0x87FCB9, 0x1883AE, 0x9ECF55, 0x9256A3, 0x141A58,
+  0xEFAAFF, 0x69E604, 0x657FF2, 0xE33309, 0x7C4C1E, 0xFA00E5, 0xF69913, 0x70D5E8,
+  0x4E2BC6, 0xC8673D, 0xC4FECB, 0x42B230, 0xDDCD27, 0x5B81DC, 0x57182A, 0xD154D1,
+  0x26359F, 0xA07964, 0xACE092, 0x2AAC69, 0xB5D37E, 0x339F85, 0x3F0673, 0xB94A88,
+  0x87B4A6, 0x01F85D, 0x0D61AB, 0x8B2D50, 0x145247, 0x921EBC, 0x9E874A, 0x18CBB1,
+  0xE37B16, 0x6537ED, 0x69AE1B, 0xEFE2E0, 0x709DF7, 0xF6D10C, 0xFA48FA, 0x7C0401,
+  0x42FA2F, 0xC4B6D4, 0xC82F22, 0x4E63D9, 0xD11CCE, 0x575035, 0x5BC9C3, 0xDD8538
+};
+
+static unsigned long crc24q_slice[4][256];
+
+#ifdef CRC24Q_CLMUL
+static int crc24q_clmul = 0;
+static unsigned long long crc24q_k128, crc24q_k192, crc24q_k512, crc24q_k576;
+
+/* x^n mod the polynomial times x^8 */
+static unsigned long long
+crc24q_xpow (int n)
+{
+  unsigned long long r = 1;
+
+  while (n-- > 0)
+  {
+    r <<= 1;
+    if (r & (1ULL << 32))
+      r ^= CRC24Q_POLY32;
+  }
+
+  return r;
+}
+#endif
+
+/* Build the tables, call once before the first CRC */
+void
+crc24q_init ()
+{
+  int i, k;
+
+  for (i = 0; i < 256; i++)
+    crc24q_slice[0][i] = crc24q_table[i] << 8;
+
+  for (k = 1; k < 4; k++)
+    for (i = 0; i < 256; i++)
+      crc24q_slice[k][i] = ((crc24q_slice[k - 1][i] << 8) & 0xFFFFFFFF) ^ crc24q_slice[0][crc24q_slice[k - 1][i] >> 24];
+
+#ifdef CRC24Q_CLMUL
+  crc24q_k128 = crc24q_xpow (128);
+  crc24q_k192 = crc24q_xpow (192);
+  crc24q_k512 = crc24q_xpow (512);
+  crc24q_k576 = crc24q_xpow (576);
+
+  __builtin_cpu_init ();
+  crc24q_clmul = __builtin_cpu_supports ("pclmul") && __builtin_cpu_supports ("ssse3");
+#endif
+}
+
+/* Continue a CRC24Q over len bytes, one byte at a time */
+unsigned long
+crc24q_bytewise (unsigned long crc, const unsigned char *buf, unsigned long len)
+{
+  while (len-- > 0)
+    crc = ((crc << 8) & 0xFFFFFF) ^ crc24q_table[(crc >> 16) ^ *buf++];
+
+  return crc;
+}
+
+/* Continue a CRC24Q over len bytes, 4 bytes at a time */
+unsigned long
+crc24q_sliced (unsigned long crc, const unsigned char *buf, unsigned long len)
+{
+  unsigned long x;
+
+  crc <<= 8;
+
+  while (len >= 4)
+  {
+    x = crc ^ (((unsigned long)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+    crc = crc24q_slice[3][x >> 24] ^ crc24q_slice[2][(x >> 16) & 0xFF]
+        ^ crc24q_slice[1][(x >> 8) & 0xFF] ^ crc24q_slice[0][x & 0xFF];
+    buf += 4;
+    len -= 4;
+  }
+
+  while (len-- > 0)
+    crc = ((crc << 8) & 0xFFFFFFFF) ^ crc24q_slice[0][(crc >> 24) ^ *buf++];
+
+  return crc >> 8;
+}
+
+#ifdef CRC24Q_CLMUL
+/* Blocks of 16 bytes are taken as 128 bit polynomials, first byte
+ * highest. Folding replaces block * x^n by the product of its halves with
+ * x^(n+64) mod P and x^n mod P, which leaves at most 96 bits to add to
+ * the block n bits further. Four blocks are folded side by side to hide
+ * the latency of the multiplication, then they are folded into one whose
+ * CRC is taken with the tables. */
+__attribute__ ((target ("pclmul,ssse3")))
+static inline __m128i
+crc24q_fold (__m128i x, __m128i k, __m128i data)
+{
+  return _mm_xor_si128 (_mm_xor_si128 (_mm_clmulepi64_si128 (x, k, 0x11),
+                                       _mm_clmulepi64_si128 (x, k, 0x00)), data);
+}
+
+__attribute__ ((target ("pclmul,ssse3")))
+static unsigned long
+crc24q_clmul_blocks (unsigned long crc, const unsigned char *buf, unsigned long len)
+{
+  const __m128i swap = _mm_set_epi8 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  const __m128i k128 = _mm_set_epi64x (crc24q_k192, crc24q_k128);
+  const __m128i k512 = _mm_set_epi64x (crc24q_k576, crc24q_k512);
+  __m128i x0, x1, x2, x3;
+  unsigned char out[16];
+
+#define CRC24Q_LOAD(p) _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(p)), swap)
+
+  /* the CRC so far goes into the first 32 bits */
+  x0 = _mm_xor_si128 (CRC24Q_LOAD (buf), _mm_set_epi32 ((int)(crc << 8), 0, 0, 0));
+  buf += 16;
+  len -= 16;
+
+  if (len >= 48)
+  {
+    x1 = CRC24Q_LOAD (buf);
+    x2 = CRC24Q_LOAD (buf + 16);
+    x3 = CRC24Q_LOAD (buf + 32);
+    buf += 48;
+    len -= 48;
+
+    while (len >= 64)
+    {
+      x0 = crc24q_fold (x0, k512, CRC24Q_LOAD (buf));
+      x1 = crc24q_fold (x1, k512, CRC24Q_LOAD (buf + 16));
+      x2 = crc24q_fold (x2, k512, CRC24Q_LOAD (buf + 32));
+      x3 = crc24q_fold (x3, k512, CRC24Q_LOAD (buf + 48));
+      buf += 64;
+      len -= 64;
+    }
+
+    x0 = crc24q_fold (x0, k128, x1);
+    x0 = crc24q_fold (x0, k128, x2);
+    x0 = crc24q_fold (x0, k128, x3);
+  }
+
+  while (len >= 16)
+  {
+    x0 = crc24q_fold (x0, k128, CRC24Q_LOAD (buf));
+    buf += 16;
+    len -= 16;
+  }
+
+#undef CRC24Q_LOAD
+
+  _mm_storeu_si128 ((__m128i *)out, _mm_shuffle_epi8 (x0, swap));
+
+  return crc24q_sliced (0, out, 16);
+}
+#endif
+
+/* Continue a CRC24Q over len bytes, folding whole blocks of 16 bytes.
+ * Falls back to crc24q_sliced() without PCLMULQDQ. */
+unsigned long
+crc24q_folded (unsigned long crc, const unsigned char *buf, unsigned long len)
+{
+#ifdef CRC24Q_CLMUL
+  unsigned long n = len & ~15UL;
+
+  if (crc24q_clmul && n > 0)
+  {
+    crc = crc24q_clmul_blocks (crc, buf, n);
+    buf += n;
+    len -= n;
+  }
+#endif
+
+  return crc24q_sliced (crc, buf, len);
+}
+
+/* Whether crc24q_folded() has the CPU support to fold */
+int
+crc24q_have_folded ()
+{
+#ifdef CRC24Q_CLMUL
+  return crc24q_clmul;
+#else
+  return 0;
+#endif
+}
+
+/* Continue a CRC24Q over len bytes. A frame including its CRC gives 0. */
+unsigned long
+crc24q (unsigned long crc, const unsigned char *buf, unsigned long len)
+{
+  if (len >= CRC24Q_FOLD_MIN)
+    return crc24q_folded (crc, buf, len);
+
+  return crc24q_sliced (crc, buf, len);
+}
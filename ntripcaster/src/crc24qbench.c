@@ -0,0 +1,188 @@
+/* crc24qbench.c
+ * - CRC24Q check and benchmark of the variants in crc24q.c
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc24q.h"
+
+/*
+ * Checks that all CRC24Q variants agree with the byte by byte reference
+ * for random data, lengths and alignments, and that RTCM3 frames with
+ * their CRC come out 0. Then times them for RTCM3 frame sizes.
+ * Build with "make crc24qbench" and run ./crc24qbench, it exits with 1
+ * if a variant is wrong.
+ */
+
+#define BENCH_BYTES (64 * 1024 * 1024) /* per variant and frame size */
+
+typedef unsigned long (*crc_function) (unsigned long crc, const unsigned char *buf, unsigned long len);
+
+static volatile unsigned long sink; /* keeps the timed results alive */
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+check (const unsigned char *data, unsigned long size)
+{
+  static const crc_function f[3] = { crc24q_sliced, crc24q_folded, crc24q };
+  static const char *name[3] = { "sliced", "folded", "crc24q" };
+  unsigned char frame[1029];
+  unsigned long i, off, len, crc, ref;
+  int k, bad = 0;
+
+  for (i = 0; i < 100000; i++)
+  {
+    len = rand () % 2100;
+    off = rand () % (size - len);
+    crc = rand () & 0xFFFFFF;
+    ref = crc24q_bytewise (crc, data + off, len);
+
+    for (k = 0; k < 3; k++)
+      if (f[k] (crc, data + off, len) != ref)
+      {
+        if (bad++ < 10)
+          printf ("MISMATCH %s: len %lu off %lu crc %06lx: %06lx, bytewise %06lx\n",
+                  name[k], len, off, crc, f[k] (crc, data + off, len), ref);
+      }
+  }
+
+  /* frames of every length, split at a random point like the parser does */
+  for (len = 0; len <= 1023; len++)
+  {
+    frame[0] = 0xD3;
+    frame[1] = len >> 8;
+    frame[2] = len & 0xFF;
+    memcpy (frame + 3, data + len, len);
+    crc = crc24q_bytewise (0, frame, len + 3);
+    frame[len + 3] = crc >> 16;
+    frame[len + 4] = crc >> 8;
+    frame[len + 5] = crc;
+
+    off = rand () % (len + 7);
+    for (k = 0; k < 3; k++)
+      if (f[k] (f[k] (0, frame, off), frame + off, len + 6 - off) != 0)
+      {
+        if (bad++ < 10)
+          printf ("FRAME %s: length %lu split at %lu does not give 0\n", name[k], len, off);
+      }
+  }
+
+  return bad;
+}
+
+static void
+bench (const unsigned char *data, unsigned long size)
+{
+  static const crc_function f[4] = { crc24q_bytewise, crc24q_sliced, crc24q_folded, crc24q };
+  static const unsigned long frame[5] = { 26, 64, 200, 512, 1029 };
+  unsigned long i, n, off, crc;
+  double t;
+  int j, k;
+
+  printf ("frame bytes  bytewise    sliced    folded    crc24q   (MB/s)\n");
+
+  for (j = 0; j < 5; j++)
+  {
+    printf ("%11lu", frame[j]);
+    for (k = 0; k < 4; k++)
+    {
+      n = BENCH_BYTES / frame[j];
+      if (k == 0)
+        n /= 4;
+      crc = 0;
+      t = now ();
+      for (i = 0, off = 0; i < n; i++)
+      {
+        crc ^= f[k] (0, data + off, frame[j]);
+        off += frame[j];
+        if (off + frame[j] > size)
+          off = i & 63;
+      }
+      t = now () - t;
+      sink = crc;
+      printf (" %9.0f", n * frame[j] / t / 1e6);
+    }
+    printf ("\n");
+  }
+}
+
+int
+main ()
+{
+  unsigned long size = 1024 * 1024, i;
+  unsigned char *data = (unsigned char *)malloc (size);
+  int bad;
+
+  if (data == NULL)
+    return 1;
+
+  crc24q_init ();
+  srand (1);
+  for (i = 0; i < size; i++)
+    data[i] = rand () & 0xFF;
+
+  printf ("PCLMULQDQ folding: %s\n", crc24q_have_folded () ? "yes" : "no");
+
+  bad = check (data, size);
+  printf ("check: %s\n", bad ? "FAILED" : "ok");
+  if (bad)
+    return 1;
+
+  bench (data, size);
+
+  free (data);
+  return 0;
+}
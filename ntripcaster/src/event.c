@@ -0,0 +1,419 @@
+/* event.c
+ * - Socket readiness notification functions
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#elif defined(HAVE_POLL_H)
+#include <poll.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "log.h"
+#include "memory.h"
+#include "event.h"
+
+/*
+ * An event set tells the owning thread which of its sockets became
+ * readable or writable. Notification is edge triggered: an event is
+ * reported once, and the owner has to read or write until the call
+ * would block before the descriptor is reported again. With epoll this
+ * is what the kernel does, the poll() and select() fallbacks emulate it
+ * by disarming a reported event until event_rearm () is called.
+ * Other threads can interrupt event_wait () with event_wake ().
+ */
+
+/* Create a new, empty event set.
+ * Returns NULL on failure.
+ * Assert Class: 1
+ */
+event_set_t *
+event_set_create ()
+{
+  event_set_t *set = (event_set_t *)nmalloc (sizeof (event_set_t));
+
+  memset (set, 0, sizeof (event_set_t));
+  set->fd = -1;
+
+  if (pipe (set->wake) < 0)
+  {
+    xa_debug (1, "ERROR: event_set_create(): pipe() failed, errno %d", errno);
+    nfree (set);
+    return NULL;
+  }
+
+  fcntl (set->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl (set->wake[1], F_SETFL, O_NONBLOCK);
+
+#ifdef HAVE_SYS_EPOLL_H
+  set->fd = epoll_create (EVENT_MAX);
+
+  if (set->fd < 0)
+  {
+    xa_debug (1, "ERROR: event_set_create(): epoll_create() failed, errno %d", errno);
+    close (set->wake[0]);
+    close (set->wake[1]);
+    nfree (set);
+    return NULL;
+  }
+
+  {
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl (set->fd, EPOLL_CTL_ADD, set->wake[0], &ev);
+  }
+#endif
+
+  return set;
+}
+
+void
+event_set_destroy (event_set_t *set)
+{
+  if (!set)
+    return;
+
+  if (set->fd >= 0)
+    close (set->fd);
+
+  close (set->wake[0]);
+  close (set->wake[1]);
+
+  if (set->fds)
+  {
+    nfree (set->fds);
+    nfree (set->armed);
+    nfree (set->data);
+  }
+
+  nfree (set);
+}
+
+#ifndef HAVE_SYS_EPOLL_H
+static void *
+event_grow (void *old, int num, int size)
+{
+  void *new = nmalloc (size);
+
+  if (old)
+  {
+    memcpy (new, old, num);
+    nfree (old);
+  }
+
+  return new;
+}
+
+static int
+event_find (event_set_t *set, int fd)
+{
+  int i;
+
+  for (i = 0; i < set->num; i++)
+    if (set->fds[i] == fd)
+      return i;
+
+  return -1;
+}
+#endif
+
+/* Watch fd for the given events, data is handed back by event_wait ().
+ * Returns OK or ICE_ERROR_INVALID_SYNTAX for a bad descriptor.
+ * Assert Class: 2
+ */
+int
+event_add (event_set_t *set, int fd, int events, void *data)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+#else
+  int i;
+#endif
+
+  if (!set || fd < 0)
+    return ICE_ERROR_INVALID_SYNTAX;
+
+#ifdef HAVE_SYS_EPOLL_H
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLET;
+  if (events & EVENT_READ)
+    ev.events |= EPOLLIN | EPOLLRDHUP;
+  if (events & EVENT_WRITE)
+    ev.events |= EPOLLOUT;
+  ev.data.ptr = data;
+
+  if (epoll_ctl (set->fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    xa_debug (1, "WARNING: event_add(): epoll_ctl() failed for %d, errno %d", fd, errno);
+    return ICE_ERROR_INVALID_SYNTAX;
+  }
+#else
+  if ((i = event_find (set, fd)) < 0)
+  {
+    if (set->num == set->size)
+    {
+      set->size = set->size ? set->size * 2 : 16;
+      set->fds = (int *)event_grow (set->fds, set->num * sizeof (int), set->size * sizeof (int));
+      set->armed = (int *)event_grow (set->armed, set->num * sizeof (int), set->size * sizeof (int));
+      set->data = (void **)event_grow (set->data, set->num * sizeof (void *), set->size * sizeof (void *));
+    }
+    i = set->num++;
+  }
+
+  set->fds[i] = fd;
+  set->armed[i] = events;
+  set->data[i] = data;
+#endif
+
+  return OK;
+}
+
+/* Stop watching fd. Must be called before the descriptor is closed.
+ * Assert Class: 2
+ */
+int
+event_del (event_set_t *set, int fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+#else
+  int i;
+#endif
+
+  if (!set || fd < 0)
+    return ICE_ERROR_INVALID_SYNTAX;
+
+#ifdef HAVE_SYS_EPOLL_H
+  memset (&ev, 0, sizeof (ev));
+  epoll_ctl (set->fd, EPOLL_CTL_DEL, fd, &ev);
+#else
+  if ((i = event_find (set, fd)) < 0)
+    return ICE_ERROR_NOT_FOUND;
+
+  set->num--;
+  set->fds[i] = set->fds[set->num];
+  set->armed[i] = set->armed[set->num];
+  set->data[i] = set->data[set->num];
+#endif
+
+  return OK;
+}
+
+/* Tell the set that reading or writing on fd would block now.
+ * Nothing to do for the kernel driven edge triggered epoll.
+ * Assert Class: 1
+ */
+void
+event_rearm (event_set_t *set, int fd, int events)
+{
+#ifndef HAVE_SYS_EPOLL_H
+  int i;
+
+  if (set && (i = event_find (set, fd)) >= 0)
+    set->armed[i] |= events;
+#endif
+}
+
+/* Wait at most timeout milliseconds (-1 is forever) for events.
+ * Returns the number of events stored in ev, 0 on timeout or
+ * when woken up by event_wake (), and -1 on error.
+ * Assert Class: 2
+ */
+int
+event_wait (event_set_t *set, event_t *ev, int max, int timeout)
+{
+  int i, n = 0, res;
+  char buf[64];
+
+  if (!set || !ev || max <= 0)
+    return -1;
+
+#ifdef HAVE_SYS_EPOLL_H
+  {
+    struct epoll_event evs[EVENT_MAX];
+
+    if (max > EVENT_MAX)
+      max = EVENT_MAX;
+
+    res = epoll_wait (set->fd, evs, max, timeout);
+
+    for (i = 0; i < res; i++)
+    {
+      if (evs[i].data.ptr == NULL)
+      {
+        while (read (set->wake[0], buf, sizeof (buf)) > 0);
+        continue;
+      }
+
+      ev[n].events = 0;
+      if (evs[i].events & (EPOLLIN | EPOLLRDHUP))
+        ev[n].events |= EVENT_READ;
+      if (evs[i].events & EPOLLOUT)
+        ev[n].events |= EVENT_WRITE;
+      if (evs[i].events & (EPOLLERR | EPOLLHUP))
+        ev[n].events |= EVENT_ERROR | EVENT_READ | EVENT_WRITE;
+      ev[n].data = evs[i].data.ptr;
+      n++;
+    }
+  }
+#elif defined(HAVE_POLL)
+  {
+    struct pollfd *pfds = (struct pollfd *)nmalloc ((set->num + 1) * sizeof (struct pollfd));
+
+    for (i = 0; i < set->num; i++)
+    {
+      pfds[i].fd = set->fds[i];
+      pfds[i].events = ((set->armed[i] & EVENT_READ) ? POLLIN : 0) | ((set->armed[i] & EVENT_WRITE) ? POLLOUT : 0);
+      pfds[i].revents = 0;
+    }
+    pfds[set->num].fd = set->wake[0];
+    pfds[set->num].events = POLLIN;
+    pfds[set->num].revents = 0;
+
+    res = poll (pfds, set->num + 1, timeout);
+
+    if (res > 0 && pfds[set->num].revents)
+      while (read (set->wake[0], buf, sizeof (buf)) > 0);
+
+    for (i = 0; res > 0 && i < set->num && n < max; i++)
+    {
+      if (!pfds[i].revents)
+        continue;
+
+      ev[n].events = 0;
+      if (pfds[i].revents & POLLIN)
+        ev[n].events |= EVENT_READ;
+      if (pfds[i].revents & POLLOUT)
+        ev[n].events |= EVENT_WRITE;
+      if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+        ev[n].events |= EVENT_ERROR | EVENT_READ | EVENT_WRITE;
+      ev[n].data = set->data[i];
+      set->armed[i] &= ~ev[n].events;
+      n++;
+    }
+
+    nfree (pfds);
+  }
+#else
+  {
+    fd_set rfds, wfds;
+    struct timeval tv;
+    int maxfd = set->wake[0];
+
+    FD_ZERO (&rfds);
+    FD_ZERO (&wfds);
+    FD_SET (set->wake[0], &rfds);
+
+    for (i = 0; i < set->num; i++)
+    {
+      if (set->armed[i] & EVENT_READ)
+        FD_SET (set->fds[i], &rfds);
+      if (set->armed[i] & EVENT_WRITE)
+        FD_SET (set->fds[i], &wfds);
+      if (set->fds[i] > maxfd)
+        maxfd = set->fds[i];
+    }
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    res = select (maxfd + 1, &rfds, &wfds, NULL, timeout < 0 ? NULL : &tv);
+
+    if (res > 0 && FD_ISSET (set->wake[0], &rfds))
+      while (read (set->wake[0], buf, sizeof (buf)) > 0);
+
+    for (i = 0; res > 0 && i < set->num && n < max; i++)
+    {
+      ev[n].events = 0;
+      if (FD_ISSET (set->fds[i], &rfds))
+        ev[n].events |= EVENT_READ;
+      if (FD_ISSET (set->fds[i], &wfds))
+        ev[n].events |= EVENT_WRITE;
+      if (!ev[n].events)
+        continue;
+      ev[n].data = set->data[i];
+      set->armed[i] &= ~ev[n].events;
+      n++;
+    }
+  }
+#endif
+
+  if (res < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  return n;
+}
+
+/* Make event_wait () return, may be called from any thread.
+ * Assert Class: 0
+ */
+void
+event_wake (event_set_t *set)
+{
+  char c = 0;
+
+  if (set && write (set->wake[1], &c, 1) < 0)
+    xa_debug (4, "DEBUG: event_wake(): wakeup already pending");
+}
@@ -0,0 +1,59 @@
+/* event.h
+ * - Socket readiness notification function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_EVENT_H
+#define __NTRIPCASTER_EVENT_H
+
+#include "ntripcastertypes.h"
+
+#define EVENT_READ 1
+#define EVENT_WRITE 2
+#define EVENT_ERROR 4
+
+/* Number of events fetched by one event_wait () call */
+#define EVENT_MAX 64
+
+event_set_t *event_set_create ();
+void event_set_destroy (event_set_t *set);
+int event_add (event_set_t *set, int fd, int events, void *data);
+int event_del (event_set_t *set, int fd);
+void event_rearm (event_set_t *set, int fd, int events);
+int event_wait (event_set_t *set, event_t *ev, int max, int timeout);
+void event_wake (event_set_t *set);
+
+#endif
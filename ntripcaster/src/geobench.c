@@ -0,0 +1,235 @@
+/* geobench.c
+ * - nearest mountpoint benchmark, k-d tree against the filter path
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include <winsock.h>
+#endif
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "utility.h"
+#include "sourcetable.h"
+#include "match.h"
+#include "geoindex.h"
+
+/*
+ * Compares answering "which mountpoints are near this position" with a
+ * ?filter box query, which parses the filter and matches every entry,
+ * and with a linear scan for the nearest entry, against geoindex_nearest
+ * on a synthetic sourcetable of GEOBENCH_ENTRIES STR lines. The nearest
+ * entries from the k-d tree are checked against the linear scan.
+ * Build with "make geobench" and run ./geobench, it exits with 1 if the
+ * k-d tree gets a position wrong.
+ */
+
+#define GEOBENCH_ENTRIES 10000
+#define GEOBENCH_K 10
+
+/* main.c is not linked in */
+server_info_t info;
+struct in_addr localaddr;
+
+void
+clean_resync (server_info_t *i)
+{
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double
+random_between (double low, double high)
+{
+  return low + rand () * ((high - low) / RAND_MAX);
+}
+
+static double
+chord2 (const double *p, const double *q)
+{
+  return (p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]);
+}
+
+/* Chord distance of an entry from p */
+static double
+entry_chord2 (const sourcetable_entry_t *entry, const double *p)
+{
+  double q[3];
+
+  geoindex_point (get_real_value_by_index (entry->fields, 9),
+                  get_real_value_by_index (entry->fields, 10), q);
+  return chord2 (p, q);
+}
+
+/* Index of the entry nearest to p, by a linear scan */
+static int
+linear_nearest (sourcetable_entry_t **entries, int n, const double *p)
+{
+  double d, best = 1e9;
+  int i, found = -1;
+
+  for (i = 0; i < n; i++)
+  {
+    if ((d = entry_chord2 (entries[i], p)) < best)
+    {
+      best = d;
+      found = i;
+    }
+  }
+
+  return found;
+}
+
+int
+main ()
+{
+  sourcetable_entry_t **entries;
+  geoindex_node_t *nodes;
+  geoindex_t gi = { 0, NULL };
+  void *found[GEOBENCH_K];
+  double km[GEOBENCH_K], p[3], lat, lon, t;
+  char line[BUFSIZE], query[BUFSIZE];
+  long hits = 0;
+  int i, r, n, bad = 0;
+
+  entries = (sourcetable_entry_t **)malloc (GEOBENCH_ENTRIES * sizeof (sourcetable_entry_t *));
+  nodes = (geoindex_node_t *)malloc (GEOBENCH_ENTRIES * sizeof (geoindex_node_t));
+  if (entries == NULL || nodes == NULL)
+    return 1;
+
+  /* bases spread over Europe, positions with two decimals as usual */
+  srand (1);
+  for (i = 0; i < GEOBENCH_ENTRIES; i++)
+  {
+    snprintf (line, sizeof (line), "STR;M%05d;Site%d;RTCM 3.3;1004(1),1005(10);2;GPS+GLO;NET;DEU;%.2f;%.2f;0;0;Rx;none;B;N;9600;none",
+              i, i, random_between (35.0, 70.0), random_between (-10.0, 30.0));
+    entries[i] = create_sourcetable_entry ();
+    entries[i]->type = str_e;
+    entries[i]->line = strdup (line);
+    entries[i]->linelen = strlen (line);
+    entries[i]->fields = create_entry_fields (str_e, line);
+    entries[i]->show = 1;
+    geoindex_point (get_real_value_by_index (entries[i]->fields, 9),
+                    get_real_value_by_index (entries[i]->fields, 10), nodes[i].p);
+    nodes[i].data = entries[i];
+  }
+
+  t = now ();
+  geoindex_build (&gi, nodes, GEOBENCH_ENTRIES);
+  printf ("%d entries, build of the k-d tree: %.2f ms\n", GEOBENCH_ENTRIES, (now () - t) * 1e3);
+
+  /* the nearest entry must be as near as the one a linear scan finds,
+     entries can share a position */
+  for (r = 0; r < 1000; r++)
+  {
+    lat = random_between (30.0, 75.0);
+    lon = random_between (-15.0, 35.0);
+    geoindex_point (lat, lon, p);
+    n = geoindex_nearest (&gi, lat, lon, GEOBENCH_K, found, km);
+    if (n != GEOBENCH_K || entry_chord2 ((sourcetable_entry_t *)found[0], p)
+        != entry_chord2 (entries[linear_nearest (entries, GEOBENCH_ENTRIES, p)], p))
+    {
+      if (bad++ < 10)
+        printf ("MISMATCH at %f %f\n", lat, lon);
+    }
+    for (i = 1; i < n; i++)
+      if (km[i] < km[i - 1] && bad++ < 10)
+        printf ("ORDER at %f %f\n", lat, lon);
+  }
+  printf ("check: %s\n", bad ? "FAILED" : "ok");
+  if (bad)
+    return 1;
+
+  /* ?filter with a 1 degree box around the position, as clients do now */
+  t = now ();
+  for (r = 0; r < 200; r++)
+  {
+    list_t *expressions;
+
+    lat = 40.0 + r % 20;
+    lon = 5.0 + r % 17;
+    snprintf (query, sizeof (query), ";;;;;;;;;>%.1f&<%.1f;>%.1f&<%.1f", lat - 0.5, lat + 0.5, lon - 0.5, lon + 0.5);
+    expressions = get_filter_expression_list (query, 0);
+    for (i = 0; i < GEOBENCH_ENTRIES; i++)
+      hits += match_sourcetable_entry (expressions, entries[i]);
+    list_dispose_with_data (expressions, dispose_parse_tree);
+  }
+  printf ("?filter box query:        %8.1f us/query\n", (now () - t) * 1e6 / 200);
+
+  t = now ();
+  for (r = 0; r < 200; r++)
+  {
+    geoindex_point (36.0 + (r % 30) * 0.3, -9.0 + (r % 37) * 0.3, p);
+    hits += linear_nearest (entries, GEOBENCH_ENTRIES, p);
+  }
+  printf ("linear nearest scan:      %8.1f us/query\n", (now () - t) * 1e6 / 200);
+
+  t = now ();
+  for (r = 0; r < 200000; r++)
+    hits += geoindex_nearest (&gi, 36.0 + (r % 3000) * 0.01, -9.0 + (r % 3700) * 0.01, GEOBENCH_K, found, km);
+  printf ("k-d tree, %d nearest:     %8.2f us/query\n", GEOBENCH_K, (now () - t) * 1e6 / 200000);
+
+  geoindex_free (&gi);
+  return hits < 0; /* keeps the timed results alive */
+}
@@ -0,0 +1,250 @@
+/* geoindex.c
+ * - Nearest position index
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "memory.h"
+#include "geoindex.h"
+
+/*
+ * Positions are kept as points on the unit sphere, so the straight line
+ * (chord) distance orders them like the distance along the surface, also
+ * across the poles and the 180 degree meridian. The points form a k-d
+ * tree stored in one array: the node of a range is its middle element,
+ * split along the axis with the largest spread, smaller values to the
+ * left. Building takes O(n log n), a query for the k nearest points
+ * visits O(log n + k) nodes for evenly spread points.
+ */
+
+void
+geoindex_point (double lat, double lon, double p[3])
+{
+  double la = lat * M_PI / 180.0, lo = lon * M_PI / 180.0;
+
+  p[0] = cos (la) * cos (lo);
+  p[1] = cos (la) * sin (lo);
+  p[2] = sin (la);
+}
+
+/* Move the element belonging to position mid of [lo,hi) sorted by axis
+ * dim there, smaller ones before it, larger ones behind it (quickselect) */
+static void
+geoindex_select (geoindex_node_t *nodes, int lo, int hi, int mid, int dim)
+{
+  geoindex_node_t t;
+  double pivot;
+  int i, j;
+
+  while (hi - lo > 1)
+  {
+    pivot = nodes[(lo + hi) / 2].p[dim];
+    i = lo;
+    j = hi - 1;
+    while (i <= j)
+    {
+      while (nodes[i].p[dim] < pivot)
+        i++;
+      while (nodes[j].p[dim] > pivot)
+        j--;
+      if (i <= j)
+      {
+        t = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = t;
+        i++;
+        j--;
+      }
+    }
+    if (mid <= j)
+      hi = j + 1;
+    else if (mid >= i)
+      lo = i;
+    else
+      return;
+  }
+}
+
+static void
+geoindex_split (geoindex_node_t *nodes, int lo, int hi)
+{
+  double min[3], max[3];
+  int i, d, dim = 0, mid;
+
+  if (hi - lo < 1)
+    return;
+
+  for (d = 0; d < 3; d++)
+    min[d] = max[d] = nodes[lo].p[d];
+  for (i = lo + 1; i < hi; i++)
+    for (d = 0; d < 3; d++)
+    {
+      if (nodes[i].p[d] < min[d]) min[d] = nodes[i].p[d];
+      if (nodes[i].p[d] > max[d]) max[d] = nodes[i].p[d];
+    }
+  for (d = 1; d < 3; d++)
+    if (max[d] - min[d] > max[dim] - min[dim])
+      dim = d;
+
+  mid = (lo + hi) / 2;
+  geoindex_select (nodes, lo, hi, mid, dim);
+  nodes[mid].dim = dim;
+
+  geoindex_split (nodes, lo, mid);
+  geoindex_split (nodes, mid + 1, hi);
+}
+
+/* Make gi an index of the n nodes, which it takes over. Only p and data
+ * of the nodes need to be set. */
+void
+geoindex_build (geoindex_t *gi, geoindex_node_t *nodes, int n)
+{
+  geoindex_free (gi);
+  gi->nodes = nodes;
+  gi->n = n;
+  geoindex_split (nodes, 0, n);
+}
+
+void
+geoindex_free (geoindex_t *gi)
+{
+  if (gi->nodes)
+  {
+    nfree (gi->nodes);
+  }
+  gi->n = 0;
+}
+
+typedef struct
+{
+  double q[3];
+  int k, found;
+  double *d2;        /* squared chord distances, ascending */
+  void **data;
+} geoindex_search_t;
+
+static void
+geoindex_search (const geoindex_node_t *nodes, int lo, int hi, geoindex_search_t *s)
+{
+  const geoindex_node_t *node;
+  double d2, diff;
+  int i, mid;
+
+  if (hi <= lo)
+    return;
+
+  mid = (lo + hi) / 2;
+  node = &nodes[mid];
+
+  d2 = (node->p[0] - s->q[0]) * (node->p[0] - s->q[0])
+     + (node->p[1] - s->q[1]) * (node->p[1] - s->q[1])
+     + (node->p[2] - s->q[2]) * (node->p[2] - s->q[2]);
+  if (s->found < s->k || d2 < s->d2[s->found - 1])
+  {
+    i = (s->found < s->k) ? s->found++ : s->found - 1;
+    for (; i > 0 && s->d2[i - 1] > d2; i--)
+    {
+      s->d2[i] = s->d2[i - 1];
+      s->data[i] = s->data[i - 1];
+    }
+    s->d2[i] = d2;
+    s->data[i] = node->data;
+  }
+
+  diff = s->q[node->dim] - node->p[node->dim];
+  if (diff < 0)
+  {
+    geoindex_search (nodes, lo, mid, s);
+    if (s->found < s->k || diff * diff < s->d2[s->found - 1])
+      geoindex_search (nodes, mid + 1, hi, s);
+  }
+  else
+  {
+    geoindex_search (nodes, mid + 1, hi, s);
+    if (s->found < s->k || diff * diff < s->d2[s->found - 1])
+      geoindex_search (nodes, lo, mid, s);
+  }
+}
+
+/* Find the (at most) k points nearest to lat, lon. Their data, nearest
+ * first, goes to found and their distance along the surface in km to km,
+ * if not NULL. Returns the number found. */
+int
+geoindex_nearest (const geoindex_t *gi, double lat, double lon, int k, void **found, double *km)
+{
+  geoindex_search_t s;
+  double c;
+  int i;
+
+  if (k <= 0 || gi->n == 0)
+    return 0;
+
+  geoindex_point (lat, lon, s.q);
+  s.k = k;
+  s.found = 0;
+  s.data = found;
+  s.d2 = (double *)nmalloc (k * sizeof (double));
+
+  geoindex_search (gi->nodes, 0, gi->n, &s);
+
+  for (i = 0; km && i < s.found; i++)
+  {
+    c = sqrt (s.d2[i]) / 2.0;
+    km[i] = 2.0 * GEOINDEX_EARTH_RADIUS * asin (c > 1.0 ? 1.0 : c);
+  }
+
+  nfree (s.d2);
+  return s.found;
+}
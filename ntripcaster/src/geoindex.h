@@ -0,0 +1,51 @@
+/* geoindex.h
+ * - Nearest position index function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_GEOINDEX_H
+#define __NTRIPCASTER_GEOINDEX_H
+
+#include "ntripcastertypes.h"
+
+#define GEOINDEX_EARTH_RADIUS 6371.0 /* km */
+
+void geoindex_point (double lat, double lon, double p[3]);
+void geoindex_build (geoindex_t *gi, geoindex_node_t *nodes, int n);
+void geoindex_free (geoindex_t *gi);
+int geoindex_nearest (const geoindex_t *gi, double lat, double lon, int k, void **found, double *km);
+
+#endif
@@ -138,6 +138,7 @@ http_command_t http_commands[] =
   { "describe",     com_describe,       0, NULL },
   { "auth",         com_auth,           0, NULL },
   { "server_info",  com_runtime,        0, NULL },
+  { "latency",      com_latency,        0, NULL },
   { "display",      http_display,       0, NULL },
   { "change",       http_change,        0, NULL },
   { (char *) NULL, (ntripcaster_int_function *) NULL, 0, (char *) NULL },
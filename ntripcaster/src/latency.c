@@ -0,0 +1,164 @@
+/* latency.c
+ * - Ingest to send latency histograms
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "timer.h"
+#include "latency.h"
+
+/*
+ * How long bytes stay in the caster. Every read from a source is stamped
+ * with the stream offset it ends at and the (monotonic) time it came in.
+ * When bytes go out to a client, the age of the oldest of them is counted
+ * in a histogram of the source. Only the source thread writes stamps and
+ * counters, the admin threads read them without locking, see traffic_add().
+ */
+
+/* Upper bounds of the buckets in microseconds, the last bucket has the rest */
+const long latency_bounds[LATENCY_BUCKETS - 1] =
+{
+  10, 20, 50, 100, 200, 500,
+  1000, 2000, 5000, 10000, 20000, 50000,
+  100000, 200000, 500000, 1000000, 2000000, 5000000, 10000000
+};
+
+/* The source read everything up to stream offset end at now */
+void
+latency_stamp (latency_t *lat, unsigned long long end, long long now)
+{
+  latency_stamp_t *stamp = &lat->stamps[lat->num_stamps % LATENCY_STAMPS];
+
+  stamp->end = end;
+  stamp->usec = now;
+  lat->num_stamps++;
+}
+
+/* A client got bytes starting at stream offset pos at now. Bytes older
+ * than the stamps we keep count with the oldest stamp, a bit too young. */
+void
+latency_record (latency_t *lat, unsigned long long pos, long long now)
+{
+  unsigned long lo, hi, mid, n = lat->num_stamps;
+  long long age;
+  int b;
+
+  if (n == 0)
+    return;
+
+  /* the first of the newest stamps ending after pos */
+  lo = n > LATENCY_STAMPS ? n - LATENCY_STAMPS : 0;
+  hi = n - 1;
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (lat->stamps[mid % LATENCY_STAMPS].end > pos)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  age = now - lat->stamps[lo % LATENCY_STAMPS].usec;
+  if (age < 0)
+    age = 0;
+
+  for (b = 0; b < LATENCY_BUCKETS - 1 && age > latency_bounds[b]; b++)
+    ;
+
+  traffic_add (lat->count[b], 1);
+  traffic_add (lat->sum, (unsigned long long)age);
+}
+
+/* Copy the bucket counters to count (LATENCY_BUCKETS of them) and the
+ * sum of all samples in microseconds to sum. Returns the number of samples. */
+unsigned long long
+latency_snapshot (const latency_t *lat, unsigned long long *count, unsigned long long *sum)
+{
+  unsigned long long total = 0;
+  int b;
+
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+  {
+    count[b] = traffic_get (lat->count[b]);
+    total += count[b];
+  }
+  *sum = traffic_get (lat->sum);
+
+  return total;
+}
+
+/* The latency in microseconds q (0..1) of the total samples in count are
+ * below, interpolated within the bucket. Samples in the last bucket count
+ * as its lower bound. */
+double
+latency_percentile (const unsigned long long *count, unsigned long long total, double q)
+{
+  double rank = q * total, seen = 0, lower;
+  int b;
+
+  if (total == 0)
+    return 0;
+
+  for (b = 0; b < LATENCY_BUCKETS - 1; b++)
+  {
+    if (seen + count[b] >= rank && count[b] > 0)
+    {
+      lower = b > 0 ? latency_bounds[b - 1] : 0;
+      return lower + (latency_bounds[b] - lower) * (rank - seen) / count[b];
+    }
+    seen += count[b];
+  }
+
+  return latency_bounds[LATENCY_BUCKETS - 2];
+}
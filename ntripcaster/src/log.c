@@ -94,6 +94,8 @@
 extern int errno, running;
 extern server_info_t info;
 
+int xa_debug_level = 0;
+
 /* logs client accesses. */
 void
 write_clf (connection_t *clicon, source_t *source) {
@@ -361,8 +363,34 @@ write_log_not_me (int whichlog, connection_t *nothim, char *fmt, ...)
   va_end (ap);
 }
 
+/* Recompute xa_debug_level, call this whenever one of the debug levels or
+   the tailing state of an admin changes. */
+void
+update_debug_level ()
+{
+  avl_traverser trav = {0};
+  connection_t *con;
+  int level;
+
+  level = info.logfiledebuglevel;
+  if (info.consoledebuglevel > level)
+    level = info.consoledebuglevel;
+
+  if (info.admins && is_server_running ()) {
+    thread_mutex_lock (&info.admin_mutex);
+    while ((con = avl_traverse (info.admins, &trav)) != NULL) {
+      if (con->type == admin_e && con->food.admin->tailing && con->food.admin->debuglevel > level)
+        level = con->food.admin->debuglevel;
+    }
+    thread_mutex_unlock (&info.admin_mutex);
+  }
+
+  xa_debug_level = level;
+}
+
+/* Use the xa_debug() macro, it skips all of this when nobody listens */
 void
-xa_debug (int level, char *fmt, ...)
+xa_debug_out (int level, char *fmt, ...)
 {
   char buf[BUFSIZE];
   va_list ap;
@@ -371,9 +399,7 @@ xa_debug (int level, char *fmt, ...)
   connection_t *con;
   admin_t *admin;
   mythread_t *mt;
-#ifdef NTRIP_NUMBER
-  return;
-#endif
+
   mt = thread_check_created ();
 
   va_start(ap, fmt);
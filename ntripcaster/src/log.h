@@ -41,7 +41,25 @@
 
 void write_log(int whichlog, char *fmt, ...);
 void write_clf (connection_t *clicon, source_t *source);
-void xa_debug (int level, char *fmt, ...);
+void xa_debug_out (int level, char *fmt, ...);
+void update_debug_level ();
+
+/* Highest debug level anybody listens to (logfile, console or a tailing
+ * admin). xa_debug() checks it before the arguments are evaluated, so
+ * disabled debug output costs one compare. */
+extern int xa_debug_level;
+
+#ifdef __GNUC__
+#define XA_DEBUG_ENABLED(level) __builtin_expect ((level) <= xa_debug_level, 0)
+#else
+#define XA_DEBUG_ENABLED(level) ((level) <= xa_debug_level)
+#endif
+
+#ifdef NTRIP_NUMBER
+#define xa_debug(level, ...) do { if (0) xa_debug_out (level, __VA_ARGS__); } while (0)
+#else
+#define xa_debug(level, ...) do { if (XA_DEBUG_ENABLED (level)) xa_debug_out (level, __VA_ARGS__); } while (0)
+#endif
 void my_perror(char *where);
 void stats_write(server_info_t *info);
 void clear_logfile(char *logfilename);
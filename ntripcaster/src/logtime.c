@@ -89,6 +89,37 @@ long get_time()
   return time(NULL);
 }
 
+/* Wall clock time in milliseconds, for timeouts below one second */
+long long get_time_ms()
+{
+#ifdef _WIN32
+  return (long long)time(NULL) * 1000;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/* Monotonic time in microseconds, for measuring how long things take */
+long long get_time_us()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#elif defined(_WIN32)
+  return (long long)time(NULL) * 1000000;
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
 void get_regular_time(char *s) {
   get_string_time(s, get_time(), REGULAR_TIME);
 }
@@ -48,6 +48,8 @@
 #define HEADER_TIME "%a, %d %b %Y %H:%M:%S %Z"
 
 long get_time();
+long long get_time_ms();
+long long get_time_us();
 void get_regular_time(char *s);
 void get_log_time(char *s);
 void get_regular_date(char *s);
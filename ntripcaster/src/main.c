@@ -102,6 +102,9 @@
 #include "commandline.h"
 #include "admin.h"
 #include "source.h"
+#include "rtcm3.h"
+#include "recorder.h"
+#include "replay.h"
 #include "sourcetable.h"
 #include "rtsp.h"
 #include "rtp.h"
@@ -113,6 +116,7 @@
 #include "relay.h"
 #include "authenticate/basic.h"
 #include "pool.h"
+#include "event.h"
 #include "interpreter.h"
 #include "match.h"
 
@@ -443,6 +447,10 @@ void setup_defaults() {
   thread_create_mutex(&info.session_mutex);
   thread_create_mutex(&info.header_mutex);
 
+  rtcm3_init();
+  recorder_init();
+  replay_init();
+
 #ifdef DEBUG_SOCKETS
   thread_create_mutex(&sock_mutex);
 #endif
@@ -486,6 +494,16 @@ void setup_defaults() {
   info.max_ip_connections = DEFAULT_MAX_IP_CONNECTIONS;
   info.max_clients_per_source = DEFAULT_MAX_CLIENTS_PER_SOURCE;
   info.client_timeout = DEFAULT_CLIENT_TIMEOUT; /* How long to wait after lost encoder to kick clients */
+  info.mount_buffer_size = DEFAULT_MOUNT_BUFFER_SIZE; /* Bytes of client backlog per mountpoint */
+  info.lag_policy = nstrdup (DEFAULT_LAG_POLICY); /* What to do with clients the backlog runs away from */
+  info.recorddir = nstrdup (DEFAULT_RECORD_DIR); /* Recorded streams, relative to the var dir */
+  info.record_segment_size = DEFAULT_RECORD_SEGMENT_SIZE;
+  info.record_max_age = 0; /* Keep recordings for ever */
+  info.record_max_size = 0; /* No size limit for recordings */
+  info.max_replays = DEFAULT_MAX_REPLAYS; /* Replays of all recorded mountpoints together */
+  info.source_threads = DEFAULT_SOURCE_THREADS; /* Worker threads serving all sources */
+  info.stall_timeout = DEFAULT_STALL_TIMEOUT; /* Until the cadence of a source is known */
+  info.stall_epochs = DEFAULT_STALL_EPOCHS; /* Missed epochs before a source stalls */
 
   /* Variables that affect sources */
   info.num_sources = 0;
@@ -611,6 +629,12 @@ void setup_defaults() {
   info.sourcetable.length = 0;
 //  info.sourcetable.show_length = 0;
   info.sourcetable.lines = 0;
+  info.sourcetable.generation = 0;
+  info.sourcetable.body = NULL;
+  info.sourcetable.lru_first = info.sourcetable.lru_last = NULL;
+  info.sourcetable.live.n = 0;
+  info.sourcetable.live.nodes = NULL;
+  info.sourcetable.live_generation = 0;
 }
 
 /* Allocate all the avl trees for admins, directory servers
@@ -623,6 +647,8 @@ allocate_resources()
 
   /* Allocate all the sources. */
   info.sources = avl_create(compare_connection, &info);
+  info.mounts = avl_create(compare_mount_connections, &info);
+  info.hostmounts = avl_create(compare_host_mounts, &info);
 
   /* Allocate all the sources stats. */
   info.sourcesstats = avl_create(compare_statisticsentry, &info);
@@ -636,6 +662,8 @@ allocate_resources()
 
   info.nontripsources = avl_create(compare_nontrip_sources, &info); // nontrip. ajd
 
+  info.mountsettings = avl_create(compare_mount_settings, &info);
+
   /* And a tree of aliases */
   info.aliases = avl_create(compare_aliases, &info);
 
@@ -646,6 +674,7 @@ allocate_resources()
   info.my_hostnames = avl_create(compare_strings, &info);
 
   info.sourcetable.tree = avl_create(compare_sourcetable_entrys, &info);
+  info.sourcetable.filters = avl_create(compare_sourcetable_filters, &info);
 
 #ifdef DEBUG_SOCKETS
   sock_sockets = avl_create (compare_sockets, &info);
@@ -785,6 +814,9 @@ threaded_server_proc (void *infoarg)
   /* Just print some runtime server info */
   print_startup_server_info();
 
+  /* The threads serving all sources, before any source can log in */
+  source_start_workers ();
+
   write_log (LOG_DEFAULT, "Starting Calender Thread...");
   /* Fork another thread that handles stats dumping, directory servers and other time based stuff */
   thread_create("Calendar Thread", startup_timer_thread, NULL);
@@ -809,6 +841,12 @@ threaded_server_proc (void *infoarg)
 
   thread_create("Relay Connector Thread", startup_relay_connector_thread, NULL);
 
+  /* And one which writes recorded streams to disk */
+  thread_create("Recorder Thread", startup_recorder_thread, NULL);
+
+  /* And one which serves replays of recorded streams */
+  thread_create("Replay Thread", startup_replay_thread, NULL);
+
 //  update_sourcetable(); // update 'sourcetable.dat.utd' at startup of the server. ajd
 
   thread_create("NoNTRIP Listen Thread", listen_to_nontrip_sources, NULL); // nontrip. ajd
@@ -990,6 +1028,9 @@ static int store_udp_data(connection_t *con, unsigned char *buffer, int len, uns
       thread_mutex_unlock(&con->udpbuffers->buffer_mutex);
     }
     con->udpbuffers->lastactive = time(0);
+
+    if (len && con->type == source_e)
+      source_wake (con->food.source);
   }
   else
   {
@@ -0,0 +1,300 @@
+/* nearest.c
+ * - Routing of clients to the nearest base
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#else
+#include <winsock.h>
+#endif
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "sock.h"
+#include "log.h"
+#include "memory.h"
+#include "source.h"
+#include "sourcetable.h"
+#include "logtime.h"
+#include "nearest.h"
+#include "authenticate/basic.h"
+
+extern server_info_t info;
+
+/*
+ * Clients of a mount with the "nearest" setting report their position
+ * with NMEA GGA sentences, like they do for virtual reference stations.
+ * They are served by the connected base closest to them, found in the
+ * sourcetable positions of the connected mounts. The source thread of the
+ * base reads what the client sends whenever it writes to it, and when the
+ * client has moved notably, checks whether another base is closer now.
+ * See source_route_nearest () for the move itself.
+ */
+
+nearest_t *
+nearest_create (void)
+{
+  nearest_t *near = (nearest_t *)nmalloc (sizeof (nearest_t));
+
+  memset (near, 0, sizeof (nearest_t));
+  return near;
+}
+
+/* ddmm.mmmm and the hemisphere to degrees */
+static int
+nmea_degrees (const char *value, const char *hemisphere, double *deg)
+{
+  char *end;
+  double v = strtod (value, &end);
+
+  if (end == value || (*end != ',' && *end != '\0'))
+    return 0;
+
+  v = floor (v / 100.0) + fmod (v, 100.0) / 60.0;
+  if (*hemisphere == 'S' || *hemisphere == 'W')
+    v = -v;
+  else if (*hemisphere != 'N' && *hemisphere != 'E')
+    return 0;
+
+  *deg = v;
+  return 1;
+}
+
+/* Position of a $xxGGA sentence with a fix. The checksum is checked if
+ * there is one. Returns 1 on success, 0 for anything else. */
+int
+nmea_parse_gga (const char *s, double *lat, double *lon)
+{
+  const char *field[8], *p, *star;
+  unsigned int sum = 0, given;
+  double la, lo;
+  int i;
+
+  if (s[0] != '$' || strlen (s) < 6 || strncmp (s + 3, "GGA,", 4) != 0)
+    return 0;
+
+  if ((star = strchr (s, '*')) != NULL) {
+    for (p = s + 1; p < star; p++)
+      sum ^= (unsigned char)*p;
+    if (sscanf (star + 1, "%2x", &given) != 1 || given != sum)
+      return 0;
+  }
+
+  /* $xxGGA,time,lat,N,lon,E,quality,... */
+  for (i = 0, p = s; i < 8 && (p = strchr (p, ',')) != NULL; i++)
+    field[i] = ++p;
+  if (i < 7 || field[6][0] < '1' || field[6][0] > '9')
+    return 0;
+
+  if (!nmea_degrees (field[1], field[2], &la) || !nmea_degrees (field[3], field[4], &lo)
+      || la < -90.0 || la > 90.0 || lo < -180.0 || lo > 180.0)
+    return 0;
+
+  *lat = la;
+  *lon = lo;
+  return 1;
+}
+
+/* Take a position, returns 1 if the base has to be checked for it */
+static int
+nearest_position (nearest_t *near, double lat, double lon)
+{
+  double dlat = (lat - near->lat) * M_PI / 180.0;
+  double dlon = (lon - near->lon) * M_PI / 180.0 * cos (lat * M_PI / 180.0);
+
+  /* the first one, or far enough from the last one checked */
+  if (near->lat == 0.0 && near->lon == 0.0)
+    near->moved = 1;
+  else if (sqrt (dlat * dlat + dlon * dlon) * 6371.0 > NEAREST_STEP)
+    near->moved = 1;
+
+  if (near->moved) {
+    near->lat = lat;
+    near->lon = lon;
+  }
+  return near->moved;
+}
+
+/* Split what the client sent into sentences and take the positions.
+ * Returns 1 if the base has to be checked. */
+int
+nearest_feed (nearest_t *near, const char *data, int len)
+{
+  double lat, lon;
+  int i, check = 0;
+
+  for (i = 0; i < len; i++) {
+    if (data[i] == '\r' || data[i] == '\n') {
+      near->line[near->len] = '\0';
+      if (near->len > 0 && nmea_parse_gga (near->line, &lat, &lon))
+        check |= nearest_position (near, lat, lon);
+      near->len = 0;
+    } else if (near->len < NEAREST_LINE - 1)
+      near->line[near->len++] = data[i];
+    else
+      near->len = 0; /* too long for NMEA, the rest won't parse */
+  }
+
+  return check;
+}
+
+/* Wait up to ms milliseconds for the first position of a new client.
+ * Returns 1 if there is one. */
+int
+nearest_wait (connection_t *con, nearest_t *near, int ms)
+{
+  long long deadline = get_time_ms () + ms;
+  char line[NEAREST_LINE];
+  double lat, lon;
+  long long left;
+  int n;
+
+  while ((left = deadline - get_time_ms ()) > 0) {
+    /* a whole line, or timeout, error or end of stream */
+    n = sock_read_until_con (con, line, NEAREST_LINE, 0, (int)left);
+    if (n <= 0)
+      return 0;
+    if (n == NEAREST_LINE + 1 && nmea_parse_gga (line, &lat, &lon))
+      return nearest_position (near, lat, lon);
+  }
+
+  return 0;
+}
+
+/* Read what the client sent since the last call, without waiting.
+ * Returns 1 if the base has to be checked. */
+int
+nearest_read (connection_t *clicon)
+{
+  nearest_t *near = clicon->food.client->near;
+  char buf[512];
+  int n, reads = 0, check = 0;
+
+  if (near == NULL || near->eof || clicon->sock <= 0)
+    return 0;
+
+  while ((n = sock_read_buffered_con (clicon, buf, sizeof (buf))) > 0)
+    check |= nearest_feed (near, buf, n);
+
+  /* a few reads are plenty for a sentence per second */
+  while (reads++ < 4 && (n = recv (clicon->sock, buf, sizeof (buf), 0)) > 0)
+    check |= nearest_feed (near, buf, n);
+
+  if (n == 0)
+    near->eof = 1;
+
+  /* check again when mounts came or went, and until a move is done */
+  if (near->generation != info.sourcetable.generation)
+    near->moved = 1;
+
+  return check || near->moved;
+}
+
+/* Whether clicon may listen to source, by the access rules of its mount */
+static int
+nearest_authorized (connection_t *clicon, source_t *source)
+{
+  ntrip_request_t req;
+
+  memset (&req, 0, sizeof (req));
+  strncpy (req.path, source->audiocast.mount, BUFSIZE);
+  req.path[BUFSIZE-1] = '\0';
+
+  return authenticate_user_request (clicon, &req, client_e);
+}
+
+/* The base clicon at lat, lon should move to from current (NULL for a new
+ * client), or NULL to stay. Bases which are not connected or stalled,
+ * which the client is not authorized for, and exclude, are skipped.
+ * current keeps the client unless another base is NEAREST_MARGIN km
+ * closer. Must have source mutex to call this. */
+connection_t *
+nearest_base_wl (connection_t *clicon, double lat, double lon, source_t *current, source_t *exclude)
+{
+  char *mounts[NEAREST_CANDIDATES];
+  double km[NEAREST_CANDIDATES], current_km = -1.0, best_km = 0.0;
+  connection_t *con, *best = NULL;
+  source_t *source;
+  int i, n;
+
+  n = sourcetable_nearest (lat, lon, NEAREST_CANDIDATES, mounts, km);
+
+  for (i = 0; i < n; i++) {
+    /* mounts are stored with leading slash, the sourcetable has one too */
+    con = mount_index_find (mounts[i]);
+    nfree (mounts[i]);
+    if (con == NULL)
+      continue;
+
+    source = con->food.source;
+    if (source == current)
+      current_km = km[i];
+    if (best == NULL && source != exclude && source->connected == SOURCE_CONNECTED && !source->stalled
+        && (source == current || nearest_authorized (clicon, source))) {
+      best = con;
+      best_km = km[i];
+    }
+  }
+
+  if (best == NULL || best->food.source == current)
+    return NULL;
+
+  if (current != NULL && current != exclude && current_km >= 0.0 && current->connected == SOURCE_CONNECTED
+      && !current->stalled && best_km + NEAREST_MARGIN >= current_km)
+    return NULL;
+
+  return best;
+}
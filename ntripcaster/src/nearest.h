@@ -0,0 +1,56 @@
+/* nearest.h
+ * - Routing of clients to the nearest base function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_NEAREST_H
+#define __NTRIPCASTER_NEAREST_H
+
+#include "ntripcastertypes.h"
+
+#define NEAREST_CANDIDATES 8  /* Closest bases looked at for a position */
+#define NEAREST_MARGIN 2.0    /* km another base has to be closer to take a client over */
+#define NEAREST_STEP 0.5      /* km a client has to move before its base is checked again */
+#define NEAREST_WAIT 10       /* Seconds a client has to send its first position */
+
+nearest_t *nearest_create (void);
+int nmea_parse_gga (const char *s, double *lat, double *lon);
+int nearest_feed (nearest_t *near, const char *data, int len);
+int nearest_wait (connection_t *con, nearest_t *near, int ms);
+int nearest_read (connection_t *clicon);
+connection_t *nearest_base_wl (connection_t *clicon, double lat, double lon, source_t *current, source_t *exclude);
+
+#endif
@@ -428,7 +428,81 @@ http_chunk_t *ntrip_create_http_chunk() {
 
 void ntrip_zero_http_chunk(http_chunk_t *hc) {
   hc->buf[0] = '\0';
-  hc->left = -1;
+  hc->left = 0;
   hc->off = 0;
   hc->finish = 0;
+  hc->state = chunk_size_e;
+}
+
+/* Decode len bytes of a chunked transfer encoded stream in place.
+ * Chunk size lines, chunk extensions, the CRLF behind the data and the
+ * trailer are dropped, the payload is moved to the start of buf. The
+ * decoder state is kept in hc, so buf may end anywhere in the stream.
+ * Returns the number of payload bytes, or -1 if the stream is not valid
+ * chunked encoding. hc->state is chunk_done_e after the last chunk. */
+int ntrip_decode_http_chunk(http_chunk_t *hc, char *buf, int len) {
+  int i = 0, out = 0, n;
+  char c;
+
+  while (i < len && hc->state != chunk_done_e) {
+    switch (hc->state) {
+      case chunk_data_e:
+        n = len - i;
+        if (n > hc->left)
+          n = hc->left;
+        if (out != i)
+          memmove(buf + out, buf + i, n);
+        out += n;
+        i += n;
+        hc->left -= n;
+        if (hc->left == 0)
+          hc->state = chunk_data_end_e;
+        break;
+      case chunk_size_e:
+        c = buf[i++];
+        if (isxdigit((int)(unsigned char)c)) {
+          /* more than 7 digits would overflow left */
+          if (hc->off >= 7) return -1;
+          hc->left = hc->left * 16 + (isdigit((int)(unsigned char)c) ? c - '0' : (tolower((int)(unsigned char)c) - 'a' + 10));
+          hc->off++;
+          break;
+        }
+        if (hc->off == 0) return -1;
+        if (c == ';' || c == ' ' || c == '\t')
+          hc->state = chunk_ext_e;
+        else if (c == '\n')
+          hc->state = (hc->left > 0) ? chunk_data_e : chunk_trailer_e;
+        else if (c != '\r')
+          return -1;
+        if (hc->state != chunk_size_e)
+          hc->off = 0;
+        break;
+      case chunk_ext_e:
+        if (buf[i++] == '\n')
+          hc->state = (hc->left > 0) ? chunk_data_e : chunk_trailer_e;
+        break;
+      case chunk_data_end_e:
+        c = buf[i++];
+        if (c == '\r')
+          break;
+        if (c != '\n') return -1;
+        hc->state = chunk_size_e;
+        break;
+      case chunk_trailer_e:
+        c = buf[i++];
+        if (c == '\r')
+          break;
+        if (c != '\n')
+          hc->off++;
+        else if (hc->off == 0)
+          hc->state = chunk_done_e;
+        else
+          hc->off = 0;
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  return out;
 }
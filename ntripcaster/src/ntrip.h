@@ -119,6 +119,7 @@ int ntrip_read_header(connection_t *con, char *header, ntrip_request_t *req);
 //int ntrip_read_old_source_header(connection_t *con, char *header, ntrip_request_t *req);
 http_chunk_t *ntrip_create_http_chunk();
 void ntrip_zero_http_chunk(http_chunk_t *hc);
+int ntrip_decode_http_chunk(http_chunk_t *hc, char *buf, int len);
 
 #endif
 
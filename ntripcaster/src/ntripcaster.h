@@ -95,6 +95,14 @@
 #define DEFAULT_ACL_POLICY 1 /* 1 means allow, 0 deny */
 #define DEFAULT_ALLOW_HTTP_ADMIN 1
 #define DEFAULT_CLIENT_TIMEOUT 0
+#define DEFAULT_MOUNT_BUFFER_SIZE 65536
+#define DEFAULT_LAG_POLICY "kick"
+#define DEFAULT_RECORD_DIR "record"
+#define DEFAULT_RECORD_SEGMENT_SIZE 16777216
+#define DEFAULT_MAX_REPLAYS 100
+#define DEFAULT_SOURCE_THREADS 4
+#define DEFAULT_STALL_TIMEOUT 1500
+#define DEFAULT_STALL_EPOCHS 3
 #define DEFAULT_LOOKUPS 0
 #define DEFAULT_PORT 2101
 
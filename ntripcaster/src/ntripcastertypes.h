@@ -82,6 +82,8 @@ typedef enum {unknown_source_e = -1, http_source_e = 0, rtsp_client_source_e = 1
 typedef enum {unknown_protocol_e = -1, tcp_e = 0, udp_e = 1, rtp_e = 2, http_e = 3, rtsp_e = 4, ntrip1_0_e = 5, ntrip2_0_e = 6} protocol_t;
 typedef enum {gnss_data_e = 0, gnss_sourcetable_e = 1 } content_type_t;
 typedef enum {not_chunked_e = 0, chunked_e = 1 } transfer_encoding_t;
+typedef enum {lag_default_e = 0, lag_kick_e = 1, lag_frame_e = 2, lag_epoch_e = 3 } lag_policy_t;
+typedef enum {chunk_size_e = 0, chunk_ext_e = 1, chunk_data_e = 2, chunk_data_end_e = 3, chunk_trailer_e = 4, chunk_done_e = 5 } chunk_state_t;
 
 typedef enum contype_e {client_e = 0, source_e = 1, admin_e = 2, unknown_connection_e = 3} contype_t;
 typedef enum { deny = 0, allow = 1, all = 2 } acltype_t;
@@ -101,13 +103,14 @@ typedef int wid_t;
 typedef enum type_e {integer_e = 1, real_e = 2, string_e = 3, function_e = 4, unknown_type_e = -1 } type_t;
 #define BUFSIZE 1000
 #define FILE_LINE_BUFSIZE 100000
-#define SOURCE_READSIZE 100 /* packet size which will be send to client */
+#define SOURCE_READSIZE 1024 /* maximal number of bytes read from a source at once */
+#define SOCK_BUFFER_SIZE 4096 /* read ahead buffer for request and response headers */
+#define CACHE_LINE_SIZE 64 /* keeps counters of different threads apart */
 #define MAXLISTEN 5 /* max number of listening ports */
 
 /* rtsp. */
 #define MAXUDPSIZE 1600
 #define DATAGRAMBUFSIZE 8
-#define CHUNKLEN 32
 
 #ifndef HAVE_SOCKLEN_T
 typedef int socklen_t;
@@ -188,20 +191,187 @@ typedef struct restrict_St
   int num_short_connections;
 } restrict_t;
 
-typedef struct chunkSt
+typedef struct ring_St
 {
-  char data[SOURCE_READSIZE];
-  int len;
-  int clients_left;
-} chunk_t;
+  char *data;
+  unsigned long size;            /* Bytes of client backlog */
+  unsigned long long head;       /* Stream offset of the next byte read from the source */
+  unsigned long long tail;       /* Stream offset of the oldest byte still in data */
+  unsigned long long last;       /* Stream offset where the last read started */
+  unsigned long long low;        /* No client is behind this offset (watermark) */
+} ring_t;
+
+#define RTCM3_FRAMES 64 /* frame starts remembered per mountpoint */
+#define RTCM3_MAX_FRAME 1029 /* header, 1023 bytes payload and CRC */
+#define RTCM3_STATION_TYPES 4 /* 1005, 1006, 1033 and 1230 */
+#define RTCM3_TYPES 4096 /* message numbers have 12 bits */
+
+typedef enum rtcm3_state_e { rtcm3_sync_e, rtcm3_header_e, rtcm3_frame_e } rtcm3_state_t;
+
+/* Latest copy of a slowly repeated RTCM3 message */
+typedef struct rtcm3_messageSt
+{
+  unsigned int len;              /* Bytes in data, 0 if none seen yet */
+  unsigned long long pos;        /* Stream offset the frame was received at */
+  char data[RTCM3_MAX_FRAME];    /* The whole frame */
+} rtcm3_message_t;
+
+/* The frames of a source which pass a message type filter. All clients
+ * of a source with the same filter read from the same ring. */
+typedef struct rtcm3_filterSt
+{
+  unsigned char pass[RTCM3_TYPES / 8]; /* Bit set for each type let through */
+  int shared;                    /* Linked into the source's list, owns ring */
+  int refs;                      /* Clients reading a shared filter */
+  ring_t ring;                   /* The filtered stream */
+  unsigned long num_frames;      /* Frames in the filtered stream */
+  unsigned long long last_frame; /* Filtered stream offset of the newest frame */
+  unsigned long long src_last;   /* Source stream offset of the same frame */
+  unsigned long long epoch;      /* Filtered stream offset where the newest epoch starts */
+  unsigned long epochs;          /* Epoch starts in the filtered stream */
+  int epoch_pending;             /* The next frame let through starts an epoch */
+  struct rtcm3_filterSt *next;
+} rtcm3_filter_t;
+
+/* RTCM3 framing of a source stream, found while the data is read */
+typedef struct rtcm3St
+{
+  rtcm3_state_t state;
+  unsigned long long pos;        /* Stream offset of the next byte to look at */
+  unsigned long long start;      /* Stream offset of the frame being parsed */
+  unsigned int len;              /* Bytes of the current frame, incl. header and CRC */
+  unsigned int got;              /* Bytes of the current frame seen so far */
+  unsigned long crc;             /* CRC24Q over the bytes seen */
+  unsigned long long frames[RTCM3_FRAMES]; /* Starts of the last complete frames */
+  unsigned long num_frames;      /* Complete frames, the newest start is frames[(num_frames - 1) % RTCM3_FRAMES] */
+  rtcm3_message_t station[RTCM3_STATION_TYPES]; /* Station messages new clients get first */
+  unsigned long long frame_end;  /* Stream offset after the last complete frame */
+  unsigned long long discarded;  /* Bytes up to frame_end not belonging to a complete frame */
+  unsigned long crc_errors;      /* Frames with a wrong CRC */
+  unsigned long resyncs;         /* Broken frames (CRC or reserved bits) the search restarted after */
+  unsigned long long epoch;      /* Stream offset of the first frame of the newest epoch */
+  unsigned long epochs;          /* Epoch starts seen */
+  int epoch_next;                /* The last observation message closed an epoch */
+  rtcm3_filter_t *filters;       /* Filtered streams clients asked for */
+} rtcm3_t;
+
+/* Position of a client of a "nearest" mount, from its NMEA GGA sentences */
+#define NEAREST_LINE 128
+typedef struct nearestSt
+{
+  double lat, lon;               /* Last position, degrees */
+  int moved;                     /* New position, the base has to be checked */
+  unsigned long generation;      /* Sourcetable generation the base was checked at */
+  int eof;                       /* Client closed its side, nothing more to read */
+  int len;                       /* Bytes of an unfinished sentence in line */
+  char line[NEAREST_LINE];
+} nearest_t;
+
+/* Archive of one mountpoint's stream in memory mapped segment files. The
+ * source thread copies new data from the backlog into buf, the recorder
+ * thread swaps it with spare and writes it out, so disk latency never
+ * holds up the source. */
+typedef struct recorderSt
+{
+  char *name;                    /* Mountpoint as used in the file names */
+  const char *ext;               /* File name extension */
+  int period;                    /* Seconds covered by one segment file */
+  mutex_t mutex;                 /* Protects buf, len, lost, written and closing, and fd
+                                    and path against other threads reading them */
+  char *buf;                     /* Data taken from the backlog, not on disk yet */
+  unsigned long len;
+  unsigned long size;            /* Bytes allocated for buf and spare */
+  unsigned long long lost;       /* Bytes which left the backlog or did not fit into buf */
+  unsigned long long written;    /* Bytes stored in segment files */
+  int closing;                   /* The source is gone, write the rest and free */
+  unsigned long long pos;        /* Source thread: stream offset of the next byte to take */
+  char *spare;                   /* Recorder thread from here on */
+  int fd;                        /* Current segment file, -1 if none is open */
+  char *map;                     /* The whole segment mapped */
+  unsigned long map_size;
+  unsigned long used;            /* Bytes of the segment holding data */
+  time_t segment_start;          /* Start of the period of the segment */
+  int part;                      /* Segments in the same period before this one */
+  char path[BUFSIZE];            /* Current segment file */
+  int index_fd;                  /* "time offset" lines for the current segment, -1 if none */
+  time_t index_time;             /* Time of the last index line */
+  int failed;                    /* Opening the last segment failed, warned about it */
+  struct recorderSt *next;
+} recorder_t;
+
+/* One line of a recording's time index */
+typedef struct replay_indexSt
+{
+  time_t time;                   /* Second the data was stored in */
+  unsigned long offset;          /* Where it starts in the segment */
+} replay_index_t;
+
+/* A recorded segment file mapped for replays, shared by all clients
+ * replaying it */
+typedef struct replay_segmentSt
+{
+  char path[BUFSIZE];
+  char *name;                    /* Mountpoint as used in the file names */
+  const char *ext;               /* File name extension */
+  int period;                    /* Seconds covered by the segment's file */
+  time_t start;                  /* Start of the period */
+  int part;                      /* Segments of the period before this one */
+  char *map;                     /* The file mapped read only */
+  unsigned long map_size;
+  unsigned long len;             /* Bytes known to hold data */
+  int complete;                  /* The recorder is done with it, len is final */
+  replay_index_t *index;
+  unsigned int num_index;
+  unsigned int max_index;        /* Entries allocated for index */
+  unsigned long index_read;      /* Bytes of the index file parsed */
+  time_t refreshed;              /* Last look at a segment still being recorded */
+  int refs;                      /* Clients using it */
+  struct replay_segmentSt *next;
+} replay_segment_t;
+
+/* Replay state of a client, the ring is a view of the mapped segment
+ * which grows as the replay time goes on */
+typedef struct replaySt
+{
+  replay_segment_t *segment;     /* NULL if the client is not replaying */
+  ring_t ring;                   /* data is the mapping, head what may be sent by now */
+  time_t start;                  /* Recording time the replay started at */
+  long long begin;               /* get_time_ms () when it started */
+  int speed;                     /* Times real time */
+  struct statisticsentry_St *stats; /* Statistics of the recorded mountpoint */
+} replay_t;
 
 typedef struct http_chunkSt {
   char buf[20]; // to store hex length.
-  int off; // store offset in buf.
-  int left;
-  int finish;
+  int off; // store offset in buf, digits or trailer line length when decoding.
+  int left; // payload bytes left in the current chunk.
+  int finish; // trailing CRLF bytes left to send (clients only).
+  chunk_state_t state; // where the decoder is in the chunked stream (sources only).
 } http_chunk_t;
 
+/* Bytes received from a connection but not consumed yet, e.g. data which
+ * arrived together with the header */
+typedef struct sock_bufferSt {
+  char data[SOCK_BUFFER_SIZE];
+  int off;                       /* First byte not handed out yet */
+  int len;                       /* End of the received bytes */
+} sock_buffer_t;
+
+typedef struct event_St {
+  int events;                    /* EVENT_READ, EVENT_WRITE, EVENT_ERROR */
+  void *data;                    /* Pointer given to event_add () */
+} event_t;
+
+typedef struct event_set_St {
+  int fd;                        /* epoll descriptor, -1 without epoll */
+  int wake[2];                   /* Pipe used by event_wake () */
+  int num;                       /* poll/select fallback: used slots */
+  int size;                      /* poll/select fallback: allocated slots */
+  int *fds;
+  int *armed;                    /* Events we still wait for on fds[i] */
+  void **data;
+} event_set_t;
+
 typedef struct statistics_St
 {
   unsigned long int read_bytes;   /* Bytes read from encoder(s) */
@@ -214,10 +384,43 @@ typedef struct statistics_St
   unsigned long int source_connect_time; /* Total sum of the time each source has been connected (minutes) */
 } statistics_t;
 
+/* Bytes moved by one source thread. Only the owning thread writes them,
+ * readers sum them up, so the hot path needs no lock. The padding keeps
+ * them off the cache lines the readers and other sources touch. */
+typedef struct traffic_St
+{
+  char pad_before[CACHE_LINE_SIZE];
+  unsigned long long read_bytes;
+  unsigned long long write_bytes;
+  char pad_after[CACHE_LINE_SIZE - 2 * sizeof (unsigned long long)];
+} traffic_t;
+
+#define LATENCY_STAMPS 128
+#define LATENCY_BUCKETS 20
+
+typedef struct latency_stampSt
+{
+  unsigned long long end;        /* Stream offset after the bytes of one read */
+  long long usec;                /* get_time_us () when they came in */
+} latency_stamp_t;
+
+/* Ingest to send latency of a source, written by its thread only */
+typedef struct latencySt
+{
+  latency_stamp_t stamps[LATENCY_STAMPS]; /* The last reads */
+  unsigned long num_stamps;      /* Reads stamped, the newest is stamps[(num_stamps - 1) % LATENCY_STAMPS] */
+  unsigned long long count[LATENCY_BUCKETS]; /* Samples per bucket, see latency_bounds */
+  unsigned long long sum;        /* Microseconds of all samples */
+} latency_t;
+
 typedef struct statisticsentry_St
 {
   char *       mount;
   statistics_t stats;
+  /* Replays of the mountpoint's recording. Only the replay thread writes
+   * them, the readers add them to stats. */
+  unsigned long long replay_write_bytes;
+  unsigned long long replay_clients;
 } statisticsentry_t;
 
 /* audiocast stuff */
@@ -226,10 +429,45 @@ typedef struct audiocast_St {
   char *mount;    /* Name of this particular channel */
 } audiocast_t;
 
+/* Serialized sourcetable response body, immutable once built. */
+typedef struct sourcetable_body_St {
+  int refs;                 /* holders, the sourcetable itself is one */
+  unsigned long generation; /* sourcetable generation it was built from */
+  int len;
+  char *buf;                /* shown lines and ENDSOURCETABLE, CRLF each */
+} sourcetable_body_t;
+
+/* Position on the unit sphere in a geoindex, see geoindex.c. */
+typedef struct geoindex_node_St {
+  double p[3];
+  int dim;                       /* axis this node splits along */
+  void *data;
+} geoindex_node_t;
+
+typedef struct geoindex_St {
+  int n;
+  geoindex_node_t *nodes;        /* k-d tree, each range split at its middle */
+} geoindex_t;
+
+/* Compiled ?filter or ?match query with its last response body. */
+typedef struct sourcetable_filter_St {
+  char *filter;                  /* normalized query, the key */
+  int matchonly;
+  struct list_St *expressions;   /* parse trees, one per field */
+  sourcetable_body_t *body;      /* NULL or built from an older generation */
+  struct sourcetable_filter_St *prev, *next; /* most recently used first */
+} sourcetable_filter_t;
+
 typedef struct sourcetable_St {
   int length;
   int lines;
   avl_tree *tree;
+  unsigned long generation; /* bumped whenever the shown lines change */
+  sourcetable_body_t *body; /* cached response body, NULL until needed */
+  avl_tree *filters;        /* cached filter queries by filter string */
+  sourcetable_filter_t *lru_first, *lru_last;
+  geoindex_t live;          /* positions of the shown STR entries */
+  unsigned long live_generation; /* generation live was built from */
 } sourcetable_t;
 
 typedef struct source_St {
@@ -237,24 +475,64 @@ typedef struct source_St {
   source_type_t type;            /* Encoder, or pulling redirect */
   audiocast_t audiocast;
   avl_tree *clients;             /* Tree of clients */
-  icethread_t thread;            /* Pointer to running thread */
+  icethread_t thread;            /* Thread serving it */
   statistics_t stats;            /* Statistics for current connection */
   statistics_t *globalstats;     /* Statistics for the mounpoint */
+  traffic_t traffic;             /* Bytes read and written, summed by the stats readers */
+  latency_t latency;             /* How long bytes wait until they are sent */
   unsigned long int num_clients; /* Number of current clients */
-  chunk_t chunk[CHUNKLEN];
-  int cid;
+  ring_t ring;                   /* Client backlog */
+  rtcm3_t *rtcm3;                /* RTCM3 framing of the backlog, NULL if not parsed */
+  lag_policy_t lag_policy;       /* What happens to clients the backlog runs away from */
+  unsigned long config_generation; /* Config generation lag_policy was read at */
+  recorder_t *recorder;          /* Stream archive, NULL if the mount is not recorded */
   int priority;                  /* order for getting the default mount in the sourcetree */
+  event_set_t *events;           /* Source socket and blocked clients, shared with the
+                                    other sources of its worker */
+  struct source_workerSt *worker; /* Pool thread serving it, NULL until it is handed over */
+  struct connectionSt *next_served; /* Next source of the same worker */
+  int woken;                     /* Set by other threads before waking the worker, see source_wake () */
+  int readable;                  /* The socket may have data */
+  long long deadline;            /* get_time_ms () by which the worker has to look at it */
+  struct connectionSt *new_clients; /* Clients handed over by other threads, newest first */
+  char *hostkey;                 /* host:port/path for http:// mounts, key in info.hostmounts */
+  char *twin;                    /* Mount the clients move to when this one fails, NULL if none */
+  int stalled;                   /* No (new) data, clients go to the twin until it comes */
+  unsigned long long stall_pos;  /* Backlog head when the stall began */
+  long long last_data;           /* get_time_ms () of the last read */
+  long cadence;                  /* Learned milliseconds between epochs */
+  unsigned int gaps;             /* Gaps between epochs the cadence was learned from */
+  unsigned long stalls;          /* Times the source stalled */
+  int twin_return;               /* Set by a recovered twin: send its clients home */
+  int near_check;                /* A "nearest" client sent a new position */
 } source_t;
 
+/* One thread of the fixed pool serving all sources. A source stays with
+ * its worker from start to end, so its state still has a single writer. */
+typedef struct source_workerSt {
+  event_set_t *events;           /* Sockets of all its sources and their clients */
+  struct connectionSt *incoming; /* Sources handed over, not served yet */
+  int num_sources;               /* Sources handed over and not closed yet */
+  struct connectionSt *sources;  /* Worker thread only: the sources it serves */
+} source_worker_t;
+
 typedef struct client_St {
-  int errors;             /* Used at first to mark position in buf, later to mark error */
-  int offset;
-  int cid;
+  unsigned long long pos; /* Stream offset of the next byte to send */
   int alive;
   client_type_t type;
   unsigned long int write_bytes;  /* Number of bytes written to client */
   int virgin;     /* Need sync? */
+  int blocked;    /* Socket buffer full, wait until it is writable */
   source_t *source;        /* Pointer back to the source (to avoid having to find it) */
+  struct connectionSt *next_new; /* Next client in the source's new_clients list */
+  char *prime;             /* Sent before the stream, e.g. cached station messages */
+  unsigned int prime_len;
+  unsigned int prime_off;  /* Bytes of prime already sent */
+  rtcm3_filter_t *filter;  /* RTCM3 message filter of a virtual mount, pos is in its ring */
+  unsigned long skips;     /* Times the client was moved ahead instead of kicked */
+  replay_t replay;         /* Time shifted replay from a recording, pos is in its segment */
+  char *home;              /* Mount the client came from while its twin serves it, else NULL */
+  nearest_t *near;         /* Client of a "nearest" mount, served by the closest base */
 } client_t;
 
 typedef struct admin_St {
@@ -268,6 +546,19 @@ typedef struct admin_St {
   scheme_t scheme;
 } admin_t;
 
+typedef struct mountsettings_St {
+  char *mount;
+  unsigned long buffer_size;     /* Client backlog in bytes, 0 for mount_buffer_size */
+  int rtcm3;                     /* Parse RTCM3 frames, clients start on a frame */
+  char *source;                  /* Virtual mount: the mount the data comes from */
+  char *types;                   /* Virtual mount: RTCM3 message types let through */
+  int exclude;                   /* types are the ones left out */
+  lag_policy_t lag_policy;       /* Slow clients: lag_default_e for the lag_policy setting */
+  int record;                    /* Seconds per recorded segment file, 0 for no recording */
+  char *twin;                    /* Mount the clients move to when this one fails */
+  int nearest;                   /* Virtual mount: clients get the base closest to them */
+} mountsettings_t;
+
 typedef struct nontripsource_St { // nontrip.
   int port;
   char *mount;
@@ -352,6 +643,7 @@ typedef struct connectionSt {
   transfer_encoding_t trans_encoding;
   long int session_id;
   http_chunk_t *http_chunk; // rtsp. used for chunked transfer encoding.
+  sock_buffer_t *readbuf; // bytes read ahead by the header functions.
   rtp_t *rtp;
   char groupactive; /* valid for group count */
 #ifdef HAVE_TLS
@@ -406,6 +698,8 @@ typedef struct {
 
   /* Encoder stuff */
   avl_tree *sources;  /* Source array */
+  avl_tree *mounts;   /* Sources by mount name */
+  avl_tree *hostmounts; /* Sources with http:// mounts by host:port/path */
   avl_tree *sourcesstats;  /* Source statistics array */
   unsigned long int num_sources;  /* Encoders connected */
   unsigned long int max_sources;  /* Maximal number of encoders */
@@ -545,6 +839,9 @@ typedef struct {
   statistics_t hourly_stats;
   statistics_t daily_stats;
   statistics_t total_stats;
+  traffic_t traffic_closed;          /* Traffic of sources already gone */
+  unsigned long long hourly_read_mark;  /* Traffic sum at the start of the hour */
+  unsigned long long hourly_write_mark;
 
   /* Server meta info */
   char *location;
@@ -569,6 +866,19 @@ typedef struct {
 
   avl_tree *nontripsources;
 
+  avl_tree *mountsettings;        /* Per mountpoint settings from the config file */
+  int mount_buffer_size;          /* Default client backlog of a mountpoint in bytes */
+  char *lag_policy;               /* Default for slow clients: kick, frame or epoch */
+  char *recorddir;                /* Where recorded streams go, relative to the var dir */
+  int record_segment_size;        /* Bytes of one recorded segment file */
+  int record_max_age;             /* Hours recordings are kept, 0 for ever */
+  int record_max_size;            /* Megabytes all recordings may take, 0 for no limit */
+  int max_replays;                /* Clients replaying recordings at the same time */
+  int source_threads;             /* Threads serving all sources, read at startup */
+  int stall_timeout;              /* Milliseconds without data before a source stalls, until its cadence is known */
+  int stall_epochs;               /* Missed epochs before a source with a known cadence stalls */
+  unsigned long config_generation; /* Bumped whenever the config file was parsed */
+
 } server_info_t;
 
 #define COMREQUEST_NUMARGS 10
@@ -83,12 +83,20 @@
 #include "ntripcaster.h"
 #include "log.h"
 #include "pool.h"
+#include "source.h"
+#include "event.h"
 
 extern server_info_t info;
 
-/* The pool variables :) */
+/* Clients are handed over to their source through a lock-free list per
+ * source. Any thread may push, only the source thread takes them out, and
+ * it always takes the whole list at once, so a plain compare-and-swap
+ * stack is safe. Without the atomic builtins the pool mutex is used. */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define POOL_LOCK_FREE 1
+#endif
+
 static mutex_t pool_mutex = {MUTEX_STATE_UNINIT};
-static avl_tree *pool = NULL;
 
 /* Initialize the connection pool.
  * No possible errors.
@@ -99,7 +107,6 @@ pool_init ()
 {
   xa_debug (1, "DEBUG: Initializing Connection Pool.");
   thread_create_mutex (&pool_mutex);
-  pool = avl_create (compare_connection, &info);
 }
 
 /* Shutdown the connection pool.
@@ -109,14 +116,11 @@ pool_init ()
 void
 pool_shutdown ()
 {
-  xa_debug (1, "DEBUG: Closing the pool.");
-//  pool_cleaner ();
-  avl_destroy (pool, NULL);
   xa_debug (1, "DEBUG: Pool closed.");
 }
 
 /*
- * Add a connection to the connection pool.
+ * Hand a connection over to the source in con->food.client->source.
  * Possible error codes:
  * ICE_ERROR_NOT_INITIALIZED
  * ICE_ERROR_NULL - Argument was NULL
@@ -125,61 +129,68 @@ pool_shutdown ()
 int
 pool_add (connection_t *con)
 {
-  if (!con)
+  source_t *source;
+
+  if (!con || !con->food.client || !(source = con->food.client->source))
     return ICE_ERROR_NULL;
 
-  if ((pool_mutex.thread_id == MUTEX_STATE_UNINIT) || pool == NULL) {
+  if (pool_mutex.thread_id == MUTEX_STATE_UNINIT) {
     xa_debug (1, "WARNING: Tried to use an unitialized pool");
     return ICE_ERROR_NOT_INITIALIZED;
   }
 
-  /* Acquire mutex lock */
+#ifdef POOL_LOCK_FREE
+  con->food.client->next_new = __atomic_load_n (&source->new_clients, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n (&source->new_clients, &con->food.client->next_new, con,
+                                       1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+#else
   pool_lock_write ();
-
-  /* Throw connection into the pool */
-  if (avl_replace (pool, con) != NULL)
-    xa_debug (1, "WARNING: Duplicate connections in the pool (id = %d)", con->id);
-
-  /* Release mutex lock */
+  con->food.client->next_new = source->new_clients;
+  source->new_clients = con;
   pool_unlock_write ();
+#endif
+
+  /* Let the source pick it up right away */
+  source_wake (source);
 
   return OK;
 }
 
 /*
- * Called from a source, who wants to see if the pool has any connections
- * in stock for it.
- * Returns NULL on errors.
+ * Called from a source, to take all connections handed over to it.
+ * Returns them in the order they were added, linked through
+ * food.client->next_new, or NULL if there are none.
  * Assert Class: 3
  */
 connection_t *
-pool_get_my_clients (const source_t *source)
+pool_get_my_clients (source_t *source)
 {
-  avl_traverser trav = {0};
-  connection_t *clicon = NULL;
+  connection_t *list, *next, *fifo = NULL;
 
   if (!source) {
     xa_debug (1, "WARNING: pool_get_my_clients() called with NULL source!");
     return NULL;
   }
 
-  /* Acquire mutex lock */
+#ifdef POOL_LOCK_FREE
+  list = __atomic_exchange_n (&source->new_clients, NULL, __ATOMIC_ACQUIRE);
+#else
   pool_lock_write ();
-
-  /* Search for clients for this source */
-  while ((clicon = avl_traverse (pool, &trav)))
-    if (clicon->food.client->source == source)
-      break;
-
-  /* If found, remove it from the pool */
-  if (clicon)
-    if (avl_delete (pool, clicon) == NULL)
-      xa_debug (1, "WARNING: pool_get_my_clients(): Connection Pool Security Comprimised!");
-
-  /* Release mutex lock */
+  list = source->new_clients;
+  source->new_clients = NULL;
   pool_unlock_write ();
+#endif
 
-  return clicon;
+  /* The list is newest first, turn it around */
+  while (list) {
+    next = list->food.client->next_new;
+    list->food.client->next_new = fifo;
+    fifo = list;
+    list = next;
+  }
+
+  return fifo;
 }
 
 /* We use internal_lock_mutex() here, because we trust
@@ -204,9 +215,3 @@ pool_cleaner ()
 {
 
 }
-
-
-
-
-
-
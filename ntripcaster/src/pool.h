@@ -42,7 +42,7 @@
 void pool_init ();
 void pool_shutdown ();
 int pool_add (connection_t *con);
-connection_t *pool_get_my_clients (const source_t *source);
+connection_t *pool_get_my_clients (source_t *source);
 void pool_lock_write ();
 void pool_unlock_write ();
 void pool_cleaner ();
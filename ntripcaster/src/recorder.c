@@ -0,0 +1,629 @@
+/* recorder.c
+ * - Stream recorder functions
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "utility.h"
+#include "log.h"
+#include "logtime.h"
+#include "memory.h"
+#include "ring.h"
+#include "recorder.h"
+
+extern server_info_t info;
+
+/*
+ * Recordings are segment files named like RINEX 3 long names after the
+ * UTC start of their period, MOUNT_YYYYDDDHHMM_01H.rtcm3 for hourly and
+ * MOUNT_YYYYDDDHHMM_01D.rtcm3 for daily files (.raw for mounts without
+ * "format=rtcm3"). A segment is created with record_segment_size bytes
+ * and mapped, the data is copied into the mapping and the file is cut to
+ * the used length when it is closed. A period with more data continues in
+ * MOUNT_YYYYDDDHHMM_01H_1.rtcm3 and so on, a source reconnecting within
+ * the period appends to the last file. Next to each segment, a .idx file
+ * gets a "time offset" line for every second data was stored in, with the
+ * time in seconds since 1970 and the offset into the segment.
+ */
+
+#define RECORDER_INTERVAL 200000 /* microseconds between writes */
+#define RECORDER_PRUNE_TIME 60 /* seconds between checks of the age and size limits */
+#define RECORDER_MIN_SEGMENT 65536
+
+static mutex_t recorders_mutex;
+static recorder_t *recorders = NULL; /* Newest first, only the recorder thread unlinks */
+
+void
+recorder_init ()
+{
+  thread_create_mutex (&recorders_mutex);
+}
+
+/* The name of a mountpoint in recording file names, BUFSIZE bytes */
+void
+recorder_name (const char *mount, char *name)
+{
+  char *p;
+
+  snprintf (name, BUFSIZE, "%s", mount[0] == '/' ? mount + 1 : mount);
+  for (p = name; *p; p++)
+    if (*p == '/' || *p == '\\')
+      *p = '_';
+}
+
+/* Start recording a mountpoint into segments of period seconds. size is
+ * how much data may wait for the recorder thread, pos the stream offset
+ * to start at. Returns NULL if recording is not possible.
+ * Assert Class: 1
+ */
+recorder_t *
+recorder_create (const char *mount, int period, int rtcm3, unsigned long size, unsigned long long pos)
+{
+#ifdef HAVE_MMAP
+  recorder_t *rec = (recorder_t *)nmalloc (sizeof (recorder_t));
+  char name[BUFSIZE];
+
+  memset (rec, 0, sizeof (recorder_t));
+
+  recorder_name (mount, name);
+  rec->name = nstrdup (name);
+
+  rec->ext = rtcm3 ? "rtcm3" : "raw";
+  rec->period = period;
+  rec->size = size;
+  rec->buf = (char *)nmalloc (size);
+  rec->spare = (char *)nmalloc (size);
+  rec->pos = pos;
+  rec->fd = -1;
+  rec->index_fd = -1;
+  thread_create_mutex (&rec->mutex);
+
+  thread_mutex_lock (&recorders_mutex);
+  rec->next = recorders;
+  recorders = rec;
+  thread_mutex_unlock (&recorders_mutex);
+
+  write_log (LOG_DEFAULT, "Recording mountpoint %s into %s segments", mount, period == RECORD_DAILY ? "daily" : "hourly");
+
+  return rec;
+#else
+  write_log (LOG_DEFAULT, "WARNING: Can not record mountpoint %s, no mmap() on this system", mount);
+  return NULL;
+#endif
+}
+
+/* Take what came into the backlog since the last call. Never waits for
+ * the disk: what does not fit into the buffer is counted as lost.
+ * Assert Class: 1
+ */
+void
+recorder_feed (recorder_t *rec, const ring_t *ring)
+{
+  unsigned long long skip = 0;
+  unsigned long n, room;
+
+  if (rec->pos < ring->tail)
+  {
+    skip = ring->tail - rec->pos;
+    rec->pos = ring->tail;
+  }
+
+  n = ring->head - rec->pos;
+
+  thread_mutex_lock (&rec->mutex);
+
+  room = rec->size - rec->len;
+  if (n > room)
+  {
+    skip += n - room;
+    n = room;
+  }
+
+  rec->len += ring_read (ring, rec->pos, rec->buf + rec->len, n);
+  rec->lost += skip;
+
+  thread_mutex_unlock (&rec->mutex);
+
+  rec->pos = ring->head;
+}
+
+/* The source is gone. The recorder thread writes what is left and frees
+ * the recorder, the caller must not use it any more. */
+void
+recorder_stop (recorder_t *rec)
+{
+  if (!rec)
+    return;
+
+  thread_mutex_lock (&rec->mutex);
+  rec->closing = 1;
+  thread_mutex_unlock (&rec->mutex);
+}
+
+void
+recorder_stats (recorder_t *rec, unsigned long long *written, unsigned long long *lost)
+{
+  thread_mutex_lock (&rec->mutex);
+  *written = rec->written;
+  *lost = rec->lost;
+  thread_mutex_unlock (&rec->mutex);
+}
+
+#ifdef HAVE_MMAP
+
+/* Put the recording directory into dir (BUFSIZE bytes), creating it if
+ * create is set. Returns 0 if it is not usable. */
+int
+recorder_dir (char *dir, int create)
+{
+  if (!info.recorddir || !info.recorddir[0])
+    return 0;
+
+  if (info.recorddir[0] == DIR_DELIMITER)
+    snprintf (dir, BUFSIZE, "%s", info.recorddir);
+  else
+    snprintf (dir, BUFSIZE, "%s%c%s", info.vardir, DIR_DELIMITER, info.recorddir);
+
+  if (access (dir, W_OK) == 0)
+    return 1;
+
+  return create && mkdir (dir, 0755) == 0;
+}
+
+/* Put the file name of a segment into path (BUFSIZE bytes). Returns 0 if
+ * it is too long. */
+int
+recorder_segment_path (char *path, const char *dir, const char *name, const char *ext,
+                       int period, time_t start, int part)
+{
+  char stamp[20], num[16];
+  struct tm tm;
+
+  gmtime_r (&start, &tm);
+  strftime (stamp, sizeof (stamp), "%Y%j%H%M", &tm);
+
+  num[0] = '\0';
+  if (part > 0)
+    snprintf (num, sizeof (num), "_%d", part);
+
+  return snprintf (path, BUFSIZE, "%s%c%s_%s_%s%s.%s", dir, DIR_DELIMITER, name, stamp,
+                   period == RECORD_DAILY ? "01D" : "01H", num, ext) < BUFSIZE;
+}
+
+static void
+recorder_close_segment (recorder_t *rec)
+{
+  if (rec->fd < 0)
+    return;
+
+  munmap (rec->map, rec->map_size);
+  if (ftruncate (rec->fd, rec->used) != 0)
+    write_log (LOG_DEFAULT, "WARNING: Could not cut recording %s to %lu bytes: %s", rec->path, rec->used, strerror (errno));
+  close (rec->fd);
+
+  thread_mutex_lock (&rec->mutex);
+  rec->fd = -1;
+  thread_mutex_unlock (&rec->mutex);
+  rec->map = NULL;
+
+  if (rec->index_fd >= 0)
+  {
+    close (rec->index_fd);
+    rec->index_fd = -1;
+  }
+
+  xa_debug (2, "DEBUG: Closed recording %s with %lu bytes", rec->path, rec->used);
+}
+
+/* Open the segment for the period now is in, or the next part of it if
+ * the current segment is full. Returns 0 on failure. */
+static int
+recorder_open_segment (recorder_t *rec, time_t now)
+{
+  char dir[BUFSIZE], path[BUFSIZE], idx[BUFSIZE + 4];
+  unsigned long size = info.record_segment_size;
+  time_t start = now - now % rec->period;
+  struct stat st;
+  char *map;
+  int fd;
+
+  if (size < RECORDER_MIN_SEGMENT)
+    size = RECORDER_MIN_SEGMENT;
+
+  if (start != rec->segment_start)
+  {
+    rec->segment_start = start;
+    rec->part = 0;
+  }
+  else if (rec->fd >= 0)
+    rec->part++;
+
+  recorder_close_segment (rec);
+
+  if (!recorder_dir (dir, 1))
+  {
+    if (!rec->failed)
+      write_log (LOG_DEFAULT, "WARNING: Recording directory %s is not writable", dir);
+    rec->failed = 1;
+    return 0;
+  }
+
+  /* after a reconnect go on with the last part which still has room */
+  for (;; rec->part++)
+  {
+    if (!recorder_segment_path (path, dir, rec->name, rec->ext, rec->period, start, rec->part))
+    {
+      if (!rec->failed)
+        write_log (LOG_DEFAULT, "WARNING: Recording file name in %s too long", dir);
+      rec->failed = 1;
+      return 0;
+    }
+
+    if (stat (path, &st) != 0 || (unsigned long) st.st_size < size)
+      break;
+  }
+
+  fd = open (path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0 || fstat (fd, &st) != 0 || ftruncate (fd, size) != 0
+      || (map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    if (!rec->failed)
+      write_log (LOG_DEFAULT, "WARNING: Could not open recording %s: %s", path, strerror (errno));
+    rec->failed = 1;
+    if (fd >= 0)
+      close (fd);
+    return 0;
+  }
+
+  thread_mutex_lock (&rec->mutex);
+  strcpy (rec->path, path);
+  rec->fd = fd;
+  thread_mutex_unlock (&rec->mutex);
+
+  rec->map = map;
+  rec->map_size = size;
+  rec->used = st.st_size;
+  rec->failed = 0;
+
+  snprintf (idx, sizeof (idx), "%s.idx", rec->path);
+  rec->index_fd = open (idx, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  rec->index_time = 0;
+
+  xa_debug (2, "DEBUG: Recording into %s from offset %lu", rec->path, rec->used);
+
+  return 1;
+}
+
+/* Store len bytes received at time now. Returns the number of bytes which
+ * made it into a segment. */
+static unsigned long
+recorder_write (recorder_t *rec, const char *data, unsigned long len, time_t now)
+{
+  unsigned long n, done = 0;
+  char line[64];
+  int l;
+
+  if (rec->fd >= 0 && now - now % rec->period != rec->segment_start)
+    recorder_close_segment (rec);
+
+  while (done < len)
+  {
+    if ((rec->fd < 0 || rec->used == rec->map_size) && !recorder_open_segment (rec, now))
+      break;
+
+    if (rec->index_time != now && rec->index_fd >= 0)
+    {
+      l = snprintf (line, sizeof (line), "%ld %lu\n", (long) now, rec->used);
+      if (write (rec->index_fd, line, l) != l)
+        xa_debug (1, "DEBUG: Could not write index of %s: %s", rec->path, strerror (errno));
+      rec->index_time = now;
+    }
+
+    n = len - done;
+    if (n > rec->map_size - rec->used)
+      n = rec->map_size - rec->used;
+
+    memcpy (rec->map + rec->used, data + done, n);
+    rec->used += n;
+    done += n;
+  }
+
+  return done;
+}
+
+/* Write out what the source thread collected. Returns 1 if the source is
+ * gone and this was the last of it. */
+static int
+recorder_flush (recorder_t *rec, time_t now)
+{
+  unsigned long len, done = 0;
+  int closing;
+  char *data;
+
+  thread_mutex_lock (&rec->mutex);
+  data = rec->buf;
+  rec->buf = rec->spare;
+  rec->spare = data;
+  len = rec->len;
+  rec->len = 0;
+  closing = rec->closing;
+  thread_mutex_unlock (&rec->mutex);
+
+  if (len > 0 || rec->fd >= 0)
+    done = recorder_write (rec, data, len, now);
+
+  if (len > 0)
+  {
+    thread_mutex_lock (&rec->mutex);
+    rec->written += done;
+    rec->lost += len - done;
+    thread_mutex_unlock (&rec->mutex);
+  }
+
+  return closing;
+}
+
+static void
+recorder_remove (recorder_t *rec)
+{
+  recorder_t **prev;
+
+  thread_mutex_lock (&recorders_mutex);
+  for (prev = &recorders; *prev != NULL; prev = &(*prev)->next)
+    if (*prev == rec)
+    {
+      *prev = rec->next;
+      break;
+    }
+  thread_mutex_unlock (&recorders_mutex);
+
+  write_log (LOG_DEFAULT, "Stopped recording %s, %llu bytes stored, %llu bytes lost", rec->name, rec->written, rec->lost);
+
+  thread_mutex_destroy (&rec->mutex);
+  nfree (rec->name);
+  nfree (rec->buf);
+  nfree (rec->spare);
+  nfree (rec);
+}
+
+/* Write out all recorders, free the ones whose source is gone. With final
+ * set all segments are closed. */
+static void
+recorder_flush_all (time_t now, int final)
+{
+  recorder_t *rec, *next;
+  int closing;
+
+  thread_mutex_lock (&recorders_mutex);
+  rec = recorders;
+  thread_mutex_unlock (&recorders_mutex);
+
+  for (; rec != NULL; rec = next)
+  {
+    next = rec->next;
+    closing = recorder_flush (rec, now);
+
+    if (closing || final)
+      recorder_close_segment (rec);
+    if (closing)
+      recorder_remove (rec);
+  }
+}
+
+/* Is path a segment file (not its index) this module writes */
+static int
+recorder_file_name (const char *name)
+{
+  const char *ext = strrchr (name, '.');
+
+  if (!ext || (strcmp (ext, ".rtcm3") != 0 && strcmp (ext, ".raw") != 0))
+    return 0;
+
+  return strstr (name, "_01H") != NULL || strstr (name, "_01D") != NULL;
+}
+
+/* Is the recorder writing to path right now */
+int
+recorder_is_open (const char *path)
+{
+  recorder_t *rec;
+  int found = 0;
+
+  thread_mutex_lock (&recorders_mutex);
+  for (rec = recorders; rec != NULL && !found; rec = rec->next)
+  {
+    thread_mutex_lock (&rec->mutex);
+    found = rec->fd >= 0 && strcmp (rec->path, path) == 0;
+    thread_mutex_unlock (&rec->mutex);
+  }
+  thread_mutex_unlock (&recorders_mutex);
+
+  return found;
+}
+
+static void
+recorder_delete (const char *path)
+{
+  char idx[BUFSIZE + 4];
+
+  write_log (LOG_DEFAULT, "Removing recording %s", path);
+
+  unlink (path);
+  snprintf (idx, sizeof (idx), "%s.idx", path);
+  unlink (idx);
+}
+
+/* Delete the recordings in dir which are older than record_max_age and
+ * return the bytes the others take, with their index. oldest (BUFSIZE
+ * bytes) is set to the oldest recording not written to at the moment,
+ * or "" if there is none. */
+static unsigned long long
+recorder_scan (const char *dir, time_t now, char *oldest)
+{
+  char path[BUFSIZE], idx[BUFSIZE + 4];
+  unsigned long long total = 0;
+  time_t oldest_time = 0;
+  struct dirent *de;
+  struct stat st;
+  DIR *d;
+  int open;
+
+  oldest[0] = '\0';
+
+  if ((d = opendir (dir)) == NULL)
+    return 0;
+
+  while ((de = readdir (d)) != NULL)
+  {
+    if (!recorder_file_name (de->d_name))
+      continue;
+
+    snprintf (path, BUFSIZE, "%s%c%s", dir, DIR_DELIMITER, de->d_name);
+    if (stat (path, &st) != 0)
+      continue;
+
+    open = recorder_is_open (path);
+
+    if (!open && info.record_max_age > 0 && st.st_mtime < now - (time_t) info.record_max_age * 3600)
+    {
+      recorder_delete (path);
+      continue;
+    }
+
+    total += st.st_size;
+    if (!open && (oldest[0] == '\0' || st.st_mtime < oldest_time))
+    {
+      snprintf (oldest, BUFSIZE, "%s", path);
+      oldest_time = st.st_mtime;
+    }
+
+    snprintf (idx, sizeof (idx), "%s.idx", path);
+    if (stat (idx, &st) == 0)
+      total += st.st_size;
+  }
+
+  closedir (d);
+
+  return total;
+}
+
+/* Keep the recordings within record_max_age and record_max_size */
+static void
+recorder_prune (time_t now)
+{
+  unsigned long long total, budget = (unsigned long long) info.record_max_size * 1024 * 1024;
+  char dir[BUFSIZE], oldest[BUFSIZE];
+
+  if ((info.record_max_age <= 0 && info.record_max_size <= 0) || !recorder_dir (dir, 0))
+    return;
+
+  total = recorder_scan (dir, now, oldest);
+
+  while (info.record_max_size > 0 && total > budget && oldest[0])
+  {
+    recorder_delete (oldest);
+    total = recorder_scan (dir, now, oldest);
+  }
+}
+
+#endif /* HAVE_MMAP */
+
+/* Writes all recordings to disk, so the source threads never wait for it */
+void *
+startup_recorder_thread (void *arg)
+{
+  mythread_t *mt;
+#ifdef HAVE_MMAP
+  time_t now, last_prune = 0;
+#endif
+
+  thread_init ();
+
+  mt = thread_get_mythread ();
+
+#ifdef HAVE_MMAP
+  while (thread_alive (mt))
+  {
+    now = get_time ();
+
+    recorder_flush_all (now, 0);
+
+    if (now - last_prune >= RECORDER_PRUNE_TIME)
+    {
+      recorder_prune (now);
+      last_prune = now;
+    }
+
+    my_sleep (RECORDER_INTERVAL);
+  }
+
+  recorder_flush_all (get_time (), 1);
+#endif
+
+  thread_exit (0);
+  return NULL;
+}
@@ -0,0 +1,59 @@
+/* recorder.h
+ * - Stream recorder function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_RECORDER_H
+#define __NTRIPCASTER_RECORDER_H
+
+#include "ntripcastertypes.h"
+
+#define RECORD_HOURLY 3600
+#define RECORD_DAILY 86400
+
+void recorder_init ();
+void recorder_name (const char *mount, char *name);
+int recorder_dir (char *dir, int create);
+int recorder_segment_path (char *path, const char *dir, const char *name, const char *ext,
+                           int period, time_t start, int part);
+int recorder_is_open (const char *path);
+recorder_t *recorder_create (const char *mount, int period, int rtcm3, unsigned long size, unsigned long long pos);
+void recorder_feed (recorder_t *rec, const ring_t *ring);
+void recorder_stop (recorder_t *rec);
+void recorder_stats (recorder_t *rec, unsigned long long *written, unsigned long long *lost);
+void *startup_recorder_thread (void *arg);
+
+#endif
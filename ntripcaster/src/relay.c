@@ -497,19 +497,19 @@ void *relay_connect_list_item (void *arg) // relay (arg) must be freed. ajd
   xa_debug (2, "DEBUG: Reconnecting relay %s [%s:%d%s]", rel->localmount,
   relreq->host, relreq->port, relreq->path);
 
-  /* Does not return unless an error happens or the source dies. */
-  relay_connect_pull (rel);
-
-  thread_mutex_lock (&info.relay_mutex);
+  /* Once the source is handed to a worker, its source_close () resets the relay. */
+  if (relay_connect_pull (rel) != OK) {
+    thread_mutex_lock (&info.relay_mutex);
+
+    orginal = relay_find_with_req (relreq, rel->localmount);
+    if (orginal != NULL) {
+      orginal->con = NULL;
+      orginal->pending = 0;
+    }
 
-  orginal = relay_find_with_req (relreq, rel->localmount);
-  if (orginal != NULL) {
-    orginal->con = NULL;
-    orginal->pending = 0;
+    thread_mutex_unlock (&info.relay_mutex);
   }
 
-  thread_mutex_unlock (&info.relay_mutex);
-
   xa_debug (4, "DEBUG: Reconnecting relay [%s:%d%s] ended", relreq->host,
   relreq->port, relreq->path);
 
@@ -575,15 +575,14 @@ int relay_connect_pull (relay_t *rel) {
 
   thread_mutex_unlock (&info.relay_mutex);
 
-  /* Does not return unless an error happens or the source dies. */
-  relay_source_login (newcon, rel);
-
-  xa_debug (4, "Relay connection ended.");
-
-  return OK;
+  return relay_source_login (newcon, rel);
 }
 
-void relay_source_login(connection_t *con, relay_t *rel) {
+/*
+ * Add a relay source and hand it to a source worker.
+ * Returns OK, or ICE_ERROR_INSERT_FAILED if it was kicked.
+ */
+int relay_source_login(connection_t *con, relay_t *rel) {
   source_t *source = con->food.source;
 
   xa_debug (2, "DEBUG: Relay encoder logging in on mount [%s]", source->audiocast.mount);
@@ -593,26 +592,27 @@ void relay_source_login(connection_t *con, relay_t *rel) {
   if (mount_exists (source->audiocast.mount)) {
     thread_mutex_unlock(&info.source_mutex);
     kick_connection (con, "Relay source with existing Mountpoint");
-    return;
+    return ICE_ERROR_INSERT_FAILED;
   }
 
   if ((info.num_sources + 1) > info.max_sources) {
     thread_mutex_unlock(&info.source_mutex);
     kick_connection (con, "Relay source: server Full (too many streams)");
-    return;
+    return ICE_ERROR_INSERT_FAILED;
   }
 
   add_source();
   source->connected = SOURCE_CONNECTED;
   avl_insert(info.sources, con);
+  mount_index_add(con);
 
   thread_mutex_unlock(&info.source_mutex);
 
   write_log (LOG_DEFAULT, "Accepted relay encoder on mountpoint %s from %s. %d sources connected", source->audiocast.mount, con_host(con), info.num_sources);
 
-  thread_rename("Source Thread");
-
   source_func(con);
+
+  return OK;
 }
 
 
@@ -693,9 +693,9 @@ login_as_client_on_server (connection_t *con, relay_t *rel)
       res = tls_read_lines_with_timeout(con->tls_socket, recvbuf, sizeof(buffer)-i);
     else
 #endif /*HAVE_TLS */
-          res = sock_read_lines_with_timeout(sockfd, recvbuf, sizeof(buffer)-i);
+          res = sock_read_lines_with_timeout_con(con, recvbuf, sizeof(buffer)-i);
   else
-          res = sock_read_line_with_timeout(sockfd, recvbuf, sizeof(buffer)-i);
+          res = sock_read_line_with_timeout_con(con, recvbuf, sizeof(buffer)-i);
 
   if (res < 0) {
     kick_connection (con, "Relay: Error in read");
@@ -53,7 +53,7 @@ void *relay_connect_list_item (void *arg);
 int relay_pull (com_request_t *comreq, char *arg);
 //connection_t *relay_pull_stream (ntrip_request_t *req, int *err);
 int relay_connect_pull (relay_t *rel);
-void relay_source_login(connection_t *con, relay_t *rel);
+int relay_source_login(connection_t *con, relay_t *rel);
 int login_as_client_on_server (connection_t *con, relay_t *rel);
 int login_as_nontrip_client_on_server (connection_t *con, relay_t *rel);
 connection_t *relay_setup_connection (ntrip_request_t *req);
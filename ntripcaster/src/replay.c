@@ -0,0 +1,643 @@
+/* replay.c
+ * - Time shifted replay of recorded streams
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "utility.h"
+#include "log.h"
+#include "logtime.h"
+#include "memory.h"
+#include "avl_functions.h"
+#include "event.h"
+#include "ring.h"
+#include "rtcm3.h"
+#include "crc24q.h"
+#include "source.h"
+#include "connection.h"
+#include "recorder.h"
+#include "replay.h"
+
+extern server_info_t info;
+
+/*
+ * A client asking for /MOUNT@START gets the recording of /MOUNT from START
+ * on, /MOUNT@START*SPEED the same SPEED times faster than real time. START
+ * is YYYYMMDDhhmmss in UTC or seconds since 1970. Replay clients belong to
+ * a source of their own which no encoder feeds, its thread releases the
+ * recorded data as the replay time goes on and sends it with write_chunk ()
+ * like live data. The segment files are mapped once for all clients
+ * replaying them and sent straight from the mapping.
+ */
+
+#define REPLAY_TICK 100 /* milliseconds between releases of recorded data */
+#define REPLAY_MAX_SPEED 100
+#define REPLAY_MAX_GAP (31 * 86400) /* how far to look for the next recording */
+
+static mutex_t replay_mutex;           /* Protects segments and their refs */
+static replay_segment_t *segments = NULL;
+static connection_t *replay_con = NULL; /* The source all replay clients belong to */
+static statistics_t replay_stats;
+
+void
+replay_init ()
+{
+  source_t *source;
+
+  thread_create_mutex (&replay_mutex);
+
+  replay_con = create_connection ();
+  put_source (replay_con);
+  source = replay_con->food.source;
+  source->connected = SOURCE_CONNECTED;
+  source->audiocast.mount = nstrdup ("/replay");
+  source->globalstats = &replay_stats;
+  source->events = event_set_create (); /* served by the replay thread, not a source worker */
+}
+
+/* Seconds since 1970 of a UTC date */
+static time_t
+replay_utc (int year, int mon, int day, int hour, int min, int sec)
+{
+  long days;
+
+  /* days from civil, March based years */
+  if (mon <= 2)
+  {
+    year--;
+    mon += 12;
+  }
+  days = 365L * year + year / 4 - year / 100 + year / 400 + (153 * (mon - 3) + 2) / 5 + day - 719469;
+
+  return (time_t) days * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+/* Is path a replay request, /MOUNT@START[*SPEED]. If so, copy the mount to
+ * mount (BUFSIZE bytes) and return 1, 0 for any other path and -1 for a
+ * malformed replay request.
+ * Assert Class: 1
+ */
+int
+replay_parse_path (const char *path, char *mount, time_t *start, int *speed)
+{
+  const char *at = strrchr (path, '@'), *p;
+  int y, mo, d, h, mi, s, n;
+
+  if (at == NULL)
+    return 0;
+
+  if (at - path >= BUFSIZE || at == path)
+    return -1;
+
+  memcpy (mount, path, at - path);
+  mount[at - path] = '\0';
+
+  for (p = at + 1, n = 0; isdigit ((unsigned char) *p); p++)
+    n++;
+
+  if (n == 14 && sscanf (at + 1, "%4d%2d%2d%2d%2d%2d", &y, &mo, &d, &h, &mi, &s) == 6)
+  {
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60)
+      return -1;
+    *start = replay_utc (y, mo, d, h, mi, s);
+  }
+  else if (n > 0 && n < 14)
+    *start = (time_t) strtol (at + 1, NULL, 10);
+  else
+    return -1;
+
+  *speed = 1;
+  if (*p == '*')
+  {
+    *speed = atoi (p + 1);
+    if (*speed < 1 || *speed > REPLAY_MAX_SPEED)
+      return -1;
+  }
+  else if (*p != '\0')
+    return -1;
+
+  return 1;
+}
+
+connection_t *
+replay_get_source ()
+{
+  return replay_con;
+}
+
+#ifdef HAVE_MMAP
+
+/* Read the index lines added since the last look and find out how much
+ * of the segment holds data. A segment still being recorded has data up
+ * to the last index line, the bytes after it are on the way. */
+static void
+replay_segment_refresh (replay_segment_t *seg)
+{
+  char idx[BUFSIZE + 4], buf[4096], *line, *end;
+  replay_index_t *grown;
+  struct stat st;
+  long t;
+  unsigned long off;
+  ssize_t n;
+  int fd;
+
+  seg->complete = !recorder_is_open (seg->path);
+  seg->refreshed = get_time ();
+
+  snprintf (idx, sizeof (idx), "%s.idx", seg->path);
+  if ((fd = open (idx, O_RDONLY)) >= 0)
+  {
+    while ((n = pread (fd, buf, sizeof (buf) - 1, seg->index_read)) > 0)
+    {
+      buf[n] = '\0';
+
+      /* whole lines only, the rest is read next time */
+      for (line = buf; (end = strchr (line, '\n')) != NULL; line = end + 1)
+      {
+        if (sscanf (line, "%ld %lu", &t, &off) != 2)
+          continue;
+
+        if (seg->num_index == seg->max_index)
+        {
+          seg->max_index = seg->max_index ? 2 * seg->max_index : 64;
+          grown = (replay_index_t *)nmalloc (seg->max_index * sizeof (replay_index_t));
+          if (seg->num_index > 0)
+          {
+            memcpy (grown, seg->index, seg->num_index * sizeof (replay_index_t));
+            nfree (seg->index);
+          }
+          seg->index = grown;
+        }
+
+        seg->index[seg->num_index].time = t;
+        seg->index[seg->num_index].offset = off;
+        seg->num_index++;
+      }
+
+      if (line == buf)
+        break;
+      seg->index_read += line - buf;
+    }
+    close (fd);
+  }
+
+  if (seg->complete && stat (seg->path, &st) == 0)
+    seg->len = st.st_size;
+  else if (seg->num_index > 0)
+    seg->len = seg->index[seg->num_index - 1].offset;
+
+  if (seg->len > seg->map_size)
+    seg->len = seg->map_size;
+}
+
+/* Map a segment or take the mapping other clients use. Returns NULL if
+ * there is no such recording. Call with replay_mutex locked. */
+static replay_segment_t *
+replay_segment_get (const char *name, const char *ext, int period, time_t start, int part)
+{
+  char dir[BUFSIZE], path[BUFSIZE];
+  replay_segment_t *seg;
+  struct stat st;
+  char *map = NULL;
+  int fd;
+
+  if (!recorder_dir (dir, 0) || !recorder_segment_path (path, dir, name, ext, period, start, part))
+    return NULL;
+
+  for (seg = segments; seg != NULL; seg = seg->next)
+    if (strcmp (seg->path, path) == 0)
+    {
+      seg->refs++;
+      return seg;
+    }
+
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return NULL;
+
+  if (fstat (fd, &st) != 0
+      || (st.st_size > 0 && (map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED))
+  {
+    write_log (LOG_DEFAULT, "WARNING: Could not map recording %s: %s", path, strerror (errno));
+    close (fd);
+    return NULL;
+  }
+  close (fd);
+
+  seg = (replay_segment_t *)nmalloc (sizeof (replay_segment_t));
+  memset (seg, 0, sizeof (replay_segment_t));
+  snprintf (seg->path, BUFSIZE, "%s", path);
+  seg->name = nstrdup (name);
+  seg->ext = ext;
+  seg->period = period;
+  seg->start = start;
+  seg->part = part;
+  seg->map = map;
+  seg->map_size = st.st_size;
+  seg->refs = 1;
+
+  replay_segment_refresh (seg);
+
+  seg->next = segments;
+  segments = seg;
+
+  xa_debug (2, "DEBUG: Mapped recording %s, %lu bytes, %u index lines", path, seg->len, seg->num_index);
+
+  return seg;
+}
+
+/* Call with replay_mutex locked */
+static void
+replay_segment_release (replay_segment_t *seg)
+{
+  replay_segment_t **prev;
+
+  if (--seg->refs > 0)
+    return;
+
+  for (prev = &segments; *prev != NULL; prev = &(*prev)->next)
+    if (*prev == seg)
+    {
+      *prev = seg->next;
+      break;
+    }
+
+  xa_debug (2, "DEBUG: Unmapping recording %s", seg->path);
+
+  if (seg->map)
+    munmap (seg->map, seg->map_size);
+  if (seg->index)
+  {
+    nfree (seg->index);
+  }
+  nfree (seg->name);
+  nfree (seg);
+}
+
+/* Look through the recording directory once for the first segment of the
+ * recording of name with data of second from or later, started by now and
+ * at most REPLAY_MAX_GAP after from. With ext or period set only
+ * recordings of that format or period count. Returns 1 and sets found_ext, found_period and
+ * found_start if there is one. An hourly recording goes before a daily
+ * one, RTCM3 before raw data. */
+static int
+replay_find (const char *name, const char *ext, int period, time_t from, time_t now,
+             const char **found_ext, int *found_period, time_t *found_start)
+{
+  static const char *exts[] = { "rtcm3", "raw" };
+  char dir[BUFSIZE];
+  size_t len = strlen (name);
+  const char *f;
+  int y, doy, h, mi, i, e, p, found = 0;
+  time_t s, key, best = 0;
+  struct dirent *de;
+  DIR *d;
+
+  if (from > now || !recorder_dir (dir, 0) || (d = opendir (dir)) == NULL)
+    return 0;
+
+  while ((de = readdir (d)) != NULL)
+  {
+    /* NAME_YYYYDDDHHMM_01H.EXT or _01D, later parts are left out */
+    f = de->d_name;
+    if (strncmp (f, name, len) != 0 || f[len] != '_')
+      continue;
+    f += len + 1;
+
+    for (i = 0; i < 11 && isdigit ((unsigned char) f[i]); i++)
+      ;
+    if (i < 11 || strncmp (f + 11, "_01", 3) != 0 || (f[14] != 'H' && f[14] != 'D') || f[15] != '.')
+      continue;
+
+    for (e = 0; e < 2 && strcmp (f + 16, exts[e]) != 0; e++)
+      ;
+    p = f[14] == 'H' ? RECORD_HOURLY : RECORD_DAILY;
+    if (e == 2 || (ext != NULL && strcmp (ext, exts[e]) != 0) || (period && period != p))
+      continue;
+
+    sscanf (f, "%4d%3d%2d%2d", &y, &doy, &h, &mi);
+    s = replay_utc (y, 1, doy, h, mi, 0);
+    key = s > from ? s : from;
+    if (s + p <= from || s > now || key - from > REPLAY_MAX_GAP)
+      continue;
+
+    if (!found || key < best || (key == best && (p < *found_period
+        || (p == *found_period && e == 0))))
+    {
+      found = 1;
+      best = key;
+      *found_ext = exts[e];
+      *found_period = p;
+      *found_start = s;
+    }
+  }
+
+  closedir (d);
+
+  return found;
+}
+
+/* The recording after seg: its next part or the first segment of a later
+ * period, up to now. Call with replay_mutex locked. */
+static replay_segment_t *
+replay_segment_next (const replay_segment_t *seg)
+{
+  replay_segment_t *next;
+  const char *ext;
+  time_t start;
+  int period;
+
+  if ((next = replay_segment_get (seg->name, seg->ext, seg->period, seg->start, seg->part + 1)) != NULL)
+    return next;
+
+  if (replay_find (seg->name, seg->ext, seg->period, seg->start + seg->period, get_time (), &ext, &period, &start))
+    return replay_segment_get (seg->name, ext, period, start, 0);
+
+  return NULL;
+}
+
+/* Offset in seg of the first data stored after second t */
+static unsigned long
+replay_offset_after (const replay_segment_t *seg, time_t t)
+{
+  unsigned int lo = 0, hi = seg->num_index, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (seg->index[mid].time <= t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return (lo < seg->num_index && seg->index[lo].offset < seg->len) ? seg->index[lo].offset : seg->len;
+}
+
+/* Where a replay of seg from start on begins: the first data stored at or
+ * after start, on RTCM3 recordings the first frame from there */
+static unsigned long
+replay_start_offset (const replay_segment_t *seg, time_t start)
+{
+  unsigned long pos = replay_offset_after (seg, start - 1), len, end;
+  const unsigned char *p;
+
+  if (strcmp (seg->ext, "rtcm3") != 0)
+    return pos;
+
+  for (end = seg->len; pos + 6 <= end; pos++)
+  {
+    p = (const unsigned char *)seg->map + pos;
+    if (p[0] != 0xD3 || (p[1] & 0xFC) != 0)
+      continue;
+    len = (((p[1] & 0x03) << 8) | p[2]) + 6;
+    if (pos + len <= end && crc24q (0, p, len) == 0)
+      break;
+  }
+
+  return pos + 6 <= end ? pos : seg->len;
+}
+
+/* Let the replay go on in seg from pos on */
+static void
+replay_set_segment (replay_t *rp, replay_segment_t *seg, unsigned long long pos)
+{
+  rp->segment = seg;
+  rp->ring.data = seg->map;
+  rp->ring.size = seg->map_size ? seg->map_size : 1;
+  rp->ring.tail = 0;
+  rp->ring.head = pos;
+  rp->ring.last = pos;
+}
+
+/* Find the recording of mount at start for a new client. Returns 0 if
+ * there is none, otherwise the client has to start at rp->ring.head.
+ * Any period and format the recorder may have used is tried, as well as
+ * later recordings if the mount was not recorded at start. This reads
+ * the recording directory, so call it without holding the global locks.
+ * Assert Class: 1
+ */
+int
+replay_start (replay_t *rp, const char *mount, time_t start, int speed)
+{
+  replay_segment_t *seg, *next;
+  char name[BUFSIZE];
+  const char *ext;
+  time_t t;
+  int period;
+
+  recorder_name (mount, name);
+
+  if (!replay_find (name, NULL, 0, start, get_time (), &ext, &period, &t))
+    return 0;
+
+  thread_mutex_lock (&replay_mutex);
+
+  seg = replay_segment_get (name, ext, period, t, 0);
+
+  /* go on to the part of the period start is in */
+  while (seg != NULL && seg->num_index > 0 && seg->index[seg->num_index - 1].time < start
+         && (next = replay_segment_get (seg->name, seg->ext, seg->period, seg->start, seg->part + 1)) != NULL)
+  {
+    replay_segment_release (seg);
+    seg = next;
+  }
+
+  if (seg != NULL)
+  {
+    replay_set_segment (rp, seg, replay_start_offset (seg, start));
+    rp->start = start;
+    rp->speed = speed;
+    rp->begin = get_time_ms ();
+    rp->stats = get_mount_stats (mount);
+  }
+
+  thread_mutex_unlock (&replay_mutex);
+
+  return seg != NULL;
+}
+
+/* The replay is over, let go of its segment */
+void
+replay_stop (replay_t *rp)
+{
+  if (rp->segment == NULL)
+    return;
+
+  thread_mutex_lock (&replay_mutex);
+  replay_segment_release (rp->segment);
+  thread_mutex_unlock (&replay_mutex);
+
+  rp->segment = NULL;
+}
+
+/* Release what was recorded up to the client's replay time. Returns 0
+ * when the replay is over. */
+static int
+replay_advance (client_t *client, long long now)
+{
+  replay_t *rp = &client->replay;
+  replay_segment_t *seg = rp->segment, *next;
+  time_t t = rp->start + (time_t) ((now - rp->begin) * rp->speed / 1000);
+
+  if (!seg->complete && (client->pos >= seg->len || rp->ring.head >= seg->len) && seg->refreshed != get_time ())
+  {
+    thread_mutex_lock (&replay_mutex);
+    replay_segment_refresh (seg);
+    thread_mutex_unlock (&replay_mutex);
+  }
+
+  rp->ring.head = replay_offset_after (seg, t);
+  if (rp->ring.head < client->pos)
+    rp->ring.head = client->pos;
+
+  if (client->pos < seg->len || !seg->complete)
+    return 1;
+
+  /* everything of this segment is sent */
+  thread_mutex_lock (&replay_mutex);
+  next = replay_segment_next (seg);
+  if (next != NULL)
+  {
+    replay_segment_release (seg);
+    replay_set_segment (rp, next, 0);
+    client->pos = 0;
+    rp->ring.head = replay_offset_after (next, t);
+  }
+  thread_mutex_unlock (&replay_mutex);
+
+  return next != NULL;
+}
+
+#else
+
+int
+replay_start (replay_t *rp, const char *mount, time_t start, int speed)
+{
+  return 0;
+}
+
+void
+replay_stop (replay_t *rp)
+{
+}
+
+#endif /* HAVE_MMAP */
+
+/* Serves all replay clients */
+void *
+startup_replay_thread (void *arg)
+{
+  source_t *source = replay_con->food.source;
+  avl_traverser trav = {0};
+  connection_t *clicon;
+  event_t ev[EVENT_MAX];
+  mythread_t *mt;
+  long long now;
+  int i, n;
+
+  thread_init ();
+
+  mt = thread_get_mythread ();
+  source->thread = thread_self ();
+
+  while (thread_alive (mt))
+  {
+    n = event_wait (source->events, ev, EVENT_MAX, REPLAY_TICK);
+
+    source_get_new_clients (source);
+
+    for (i = 0; i < n; i++)
+      ((connection_t *)ev[i].data)->food.client->blocked = 0;
+
+    now = get_time_ms ();
+    zero_trav (&trav);
+
+    while ((clicon = avl_traverse (source->clients, &trav)) != NULL)
+    {
+      if (clicon->food.client->alive == CLIENT_DEAD)
+        continue;
+#ifdef HAVE_MMAP
+      if (!replay_advance (clicon->food.client, now))
+      {
+        kick_connection (clicon, "End of replay");
+        continue;
+      }
+#endif
+      if (!clicon->food.client->blocked)
+        source_write_to_client (source, clicon);
+    }
+
+    kick_dead_clients (source);
+
+    if (mt->ping == 1)
+      mt->ping = 0;
+  }
+
+  thread_exit (0);
+  return NULL;
+}
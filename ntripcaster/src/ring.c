@@ -0,0 +1,198 @@
+/* ring.c
+ * - Client backlog ring buffer functions
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "log.h"
+#include "memory.h"
+#include "ring.h"
+
+/*
+ * The ring holds the last size bytes read from a source. Positions are
+ * stream offsets counted from the start of the source connection, so
+ * every client only needs one number to know where it is, and how far
+ * it is behind is head - pos. Bytes from tail up to head are valid.
+ * The owner has to make sure no client is behind the data it is going
+ * to overwrite, see source_make_room().
+ */
+
+/* Allocate the backlog.
+ * Returns OK or ICE_ERROR_INIT_FAILED.
+ * Assert Class: 1
+ */
+int
+ring_init (ring_t *ring, unsigned long size)
+{
+  memset (ring, 0, sizeof (ring_t));
+
+  ring->data = (char *)nmalloc (size);
+  if (!ring->data)
+    return ICE_ERROR_INIT_FAILED;
+
+  ring->size = size;
+
+  return OK;
+}
+
+void
+ring_free (ring_t *ring)
+{
+  if (ring->data)
+  {
+    nfree (ring->data);
+  }
+  ring->size = 0;
+}
+
+/* Return where the next bytes from the source go. len is the
+ * wanted amount on input and is cut down to the room left before
+ * the end of the buffer.
+ * Assert Class: 1
+ */
+char *
+ring_space (ring_t *ring, unsigned long *len)
+{
+  unsigned long off = ring->head % ring->size;
+
+  if (*len > ring->size - off)
+    *len = ring->size - off;
+
+  return ring->data + off;
+}
+
+/* len bytes were stored at ring_space () */
+void
+ring_commit (ring_t *ring, unsigned long len)
+{
+  ring->last = ring->head;
+  ring->head += len;
+
+  if (ring->head - ring->tail > ring->size)
+    ring->tail = ring->head - ring->size;
+}
+
+/* Copy len bytes into the ring, wrapping around at the end */
+void
+ring_write (ring_t *ring, const char *buf, unsigned long len)
+{
+  unsigned long long last = ring->head;
+  unsigned long n;
+  char *p;
+
+  /* only the end fits, skip the rest */
+  if (len > ring->size)
+  {
+    ring->head += len - ring->size;
+    buf += len - ring->size;
+    len = ring->size;
+  }
+
+  while (len > 0)
+  {
+    n = len;
+    p = ring_space (ring, &n);
+    memcpy (p, buf, n);
+    ring_commit (ring, n);
+    buf += n;
+    len -= n;
+  }
+
+  ring->last = last;
+}
+
+/* Find the bytes a client at stream offset pos has to receive next.
+ * Returns the number of bytes which can be read from *data in one
+ * piece, 0 if the client is up to date or was overrun.
+ * Assert Class: 1
+ */
+unsigned long
+ring_data (const ring_t *ring, unsigned long long pos, char **data)
+{
+  unsigned long off, len;
+
+  if (pos >= ring->head || pos < ring->tail)
+    return 0;
+
+  off = pos % ring->size;
+  len = ring->size - off;
+
+  if (len > ring->head - pos)
+    len = ring->head - pos;
+
+  *data = ring->data + off;
+
+  return len;
+}
+
+/* Copy len bytes starting at stream offset pos out of the ring.
+ * Returns the number of bytes copied, less than len if some of them
+ * are not (or no longer) in the ring.
+ */
+unsigned long
+ring_read (const ring_t *ring, unsigned long long pos, char *buf, unsigned long len)
+{
+  unsigned long n, done = 0;
+  char *data;
+
+  while (done < len && (n = ring_data (ring, pos + done, &data)) > 0)
+  {
+    if (n > len - done)
+      n = len - done;
+    memcpy (buf + done, data, n);
+    done += n;
+  }
+
+  return done;
+}
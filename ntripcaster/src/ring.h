@@ -0,0 +1,52 @@
+/* ring.h
+ * - Client backlog ring buffer function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_RING_H
+#define __NTRIPCASTER_RING_H
+
+#include "ntripcastertypes.h"
+
+int ring_init (ring_t *ring, unsigned long size);
+void ring_free (ring_t *ring);
+char *ring_space (ring_t *ring, unsigned long *len);
+void ring_commit (ring_t *ring, unsigned long len);
+void ring_write (ring_t *ring, const char *buf, unsigned long len);
+unsigned long ring_data (const ring_t *ring, unsigned long long pos, char **data);
+unsigned long ring_read (const ring_t *ring, unsigned long long pos, char *buf, unsigned long len);
+
+#endif
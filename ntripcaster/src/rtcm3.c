@@ -0,0 +1,619 @@
+/* rtcm3.c
+ * - RTCM3 frame parsing functions
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#ifdef _WIN32
+#include <win32config.h>
+#else
+#include <config.h>
+#endif
+#endif
+
+#include "definitions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "avl.h"
+#include "threads.h"
+#include "ntripcastertypes.h"
+#include "ntripcaster.h"
+#include "log.h"
+#include "memory.h"
+#include "ring.h"
+#include "rtcm3.h"
+#include "crc24q.h"
+
+/*
+ * An RTCM3 frame is the preamble 0xD3, 6 reserved zero bits, a 10 bit
+ * payload length, the payload and a CRC24Q over all of it. The parser
+ * follows the data in the client backlog as it comes in and remembers
+ * where the last complete frames started, so clients can be started on
+ * a frame instead of in the middle of one. When a frame turns out to be
+ * broken, the search for the next preamble continues one byte after the
+ * start of the broken one, the bytes are still in the backlog.
+ */
+
+#define RTCM3_PREAMBLE 0xD3
+#define RTCM3_HEADER 3  /* preamble and length */
+#define RTCM3_CRC 3
+#define RTCM3_SYNC_BYTES 7 /* payload up to the synchronous GNSS flag */
+
+/* Messages a rover needs before it can use the observations, but which
+ * are repeated only every few seconds: ARP (1005, 1006), antenna and
+ * receiver (1033) and GLONASS biases (1230). */
+static const int rtcm3_station_types[RTCM3_STATION_TYPES] = { 1005, 1006, 1033, 1230 };
+
+/* Build the CRC tables, call once before any parsing */
+void
+rtcm3_init ()
+{
+  crc24q_init ();
+}
+
+/* Start parsing a stream at offset pos */
+rtcm3_t *
+rtcm3_create (unsigned long long pos)
+{
+  rtcm3_t *rtcm3 = (rtcm3_t *)nmalloc (sizeof (rtcm3_t));
+
+  memset (rtcm3, 0, sizeof (rtcm3_t));
+  rtcm3->state = rtcm3_sync_e;
+  rtcm3->pos = pos;
+  rtcm3->frame_end = pos;
+
+  return rtcm3;
+}
+
+void
+rtcm3_free (rtcm3_t *rtcm3)
+{
+  rtcm3_filter_t *filter;
+
+  if (rtcm3)
+  {
+    while ((filter = rtcm3->filters) != NULL)
+    {
+      rtcm3->filters = filter->next;
+      rtcm3_filter_free (filter);
+    }
+    nfree (rtcm3);
+  }
+}
+
+/* Parse a list of message types like "1005,1006,1071-1077". With exclude
+ * the listed types are left out, otherwise only they pass.
+ * Returns the new filter, NULL if the list is invalid.
+ */
+rtcm3_filter_t *
+rtcm3_filter_create (const char *types, int exclude)
+{
+  rtcm3_filter_t *filter;
+  const char *p = types;
+  char *end;
+  long from, to, t;
+
+  if (!types || !types[0])
+    return NULL;
+
+  filter = (rtcm3_filter_t *)nmalloc (sizeof (rtcm3_filter_t));
+  memset (filter, 0, sizeof (rtcm3_filter_t));
+
+  if (exclude)
+    memset (filter->pass, 0xFF, sizeof (filter->pass));
+
+  while (*p)
+  {
+    from = to = strtol (p, &end, 10);
+    if (end == p)
+      break;
+    if (*end == '-')
+    {
+      p = end + 1;
+      to = strtol (p, &end, 10);
+      if (end == p)
+        break;
+    }
+    if (from < 0 || to >= RTCM3_TYPES || from > to)
+      break;
+
+    for (t = from; t <= to; t++)
+    {
+      if (exclude)
+        filter->pass[t / 8] &= ~(1 << (t % 8));
+      else
+        filter->pass[t / 8] |= 1 << (t % 8);
+    }
+
+    p = end;
+    if (*p == ',')
+      p++;
+    else if (*p)
+      break;
+  }
+
+  if (*p)
+  {
+    nfree (filter);
+    return NULL;
+  }
+
+  return filter;
+}
+
+void
+rtcm3_filter_free (rtcm3_filter_t *filter)
+{
+  if (filter)
+  {
+    if (filter->shared)
+      ring_free (&filter->ring);
+    nfree (filter);
+  }
+}
+
+/* A new, unshared filter letting through the same types as filter, for a
+ * client which moves to another source */
+rtcm3_filter_t *
+rtcm3_filter_copy (const rtcm3_filter_t *filter)
+{
+  rtcm3_filter_t *copy = (rtcm3_filter_t *)nmalloc (sizeof (rtcm3_filter_t));
+
+  memset (copy, 0, sizeof (rtcm3_filter_t));
+  memcpy (copy->pass, filter->pass, sizeof (copy->pass));
+
+  return copy;
+}
+
+static int
+rtcm3_filter_pass (const rtcm3_filter_t *filter, int type)
+{
+  return (filter->pass[type / 8] >> (type % 8)) & 1;
+}
+
+/* Find the filtered stream for a new client. If another client already
+ * uses the same filter, filter is freed and the existing one returned,
+ * otherwise filter starts a new filtered stream with size bytes of backlog.
+ * Returns NULL if there is no memory for the backlog. Each client gives
+ * the filter back with rtcm3_filter_release().
+ */
+rtcm3_filter_t *
+rtcm3_filter_share (rtcm3_t *rtcm3, rtcm3_filter_t *filter, unsigned long size)
+{
+  rtcm3_filter_t *f;
+
+  for (f = rtcm3->filters; f != NULL; f = f->next)
+  {
+    if (memcmp (f->pass, filter->pass, sizeof (f->pass)) == 0)
+    {
+      rtcm3_filter_free (filter);
+      f->refs++;
+      return f;
+    }
+  }
+
+  if (ring_init (&filter->ring, size) != OK)
+  {
+    rtcm3_filter_free (filter);
+    return NULL;
+  }
+
+  filter->shared = 1;
+  filter->refs = 1;
+  filter->next = rtcm3->filters;
+  rtcm3->filters = filter;
+
+  return filter;
+}
+
+/* A client is done with filter. A shared filter stops filtering and is
+ * freed with its last client, an unshared one right away. Must be called
+ * by the thread of the source rtcm3 belongs to. */
+void
+rtcm3_filter_release (rtcm3_t *rtcm3, rtcm3_filter_t *filter)
+{
+  rtcm3_filter_t **f;
+
+  if (!filter->shared)
+  {
+    rtcm3_filter_free (filter);
+    return;
+  }
+
+  if (--filter->refs > 0 || rtcm3 == NULL)
+    return;
+
+  for (f = &rtcm3->filters; *f != NULL; f = &(*f)->next)
+  {
+    if (*f == filter)
+    {
+      xa_debug (2, "DEBUG: rtcm3_filter_release: last client gone, freeing filtered stream");
+      *f = filter->next;
+      rtcm3_filter_free (filter);
+      return;
+    }
+  }
+}
+
+/* Where a new client of a filtered stream starts: the newest complete
+ * frame, or the live end if there is none. Returns the source stream
+ * offset which belongs to that position.
+ */
+unsigned long long
+rtcm3_filter_start (const rtcm3_t *rtcm3, const rtcm3_filter_t *filter, unsigned long long *pos)
+{
+  if (filter->num_frames > 0 && filter->last_frame >= filter->ring.tail)
+  {
+    *pos = filter->last_frame;
+    return filter->src_last;
+  }
+
+  *pos = filter->ring.head;
+  return rtcm3->pos;
+}
+
+/* Copy the frame which just completed into every filtered stream it passes */
+static void
+rtcm3_filter_frame (rtcm3_t *rtcm3, const ring_t *ring, int type)
+{
+  rtcm3_filter_t *filter;
+  unsigned long n, done;
+  char *data;
+
+  for (filter = rtcm3->filters; filter != NULL; filter = filter->next)
+  {
+    if (!rtcm3_filter_pass (filter, type))
+      continue;
+
+    filter->last_frame = filter->ring.head;
+    filter->src_last = rtcm3->start;
+    filter->num_frames++;
+
+    if (filter->epoch_pending)
+    {
+      filter->epoch = filter->ring.head;
+      filter->epochs++;
+      filter->epoch_pending = 0;
+    }
+
+    for (done = 0; done < rtcm3->len; done += n)
+    {
+      n = ring_data (ring, rtcm3->start + done, &data);
+      if (n == 0)
+        break;
+      if (n > rtcm3->len - done)
+        n = rtcm3->len - done;
+      ring_write (&filter->ring, data, n);
+    }
+  }
+}
+
+/* The frame at start is broken, look for a preamble after it */
+static void
+rtcm3_resync (rtcm3_t *rtcm3)
+{
+  rtcm3->resyncs++;
+  rtcm3->pos = rtcm3->start + 1;
+  rtcm3->state = rtcm3_sync_e;
+}
+
+/* Keep a copy of the frame which just completed if it is a station message */
+static void
+rtcm3_keep_station_message (rtcm3_t *rtcm3, const ring_t *ring, int type)
+{
+  rtcm3_message_t *msg;
+  int i;
+
+  for (i = 0; i < RTCM3_STATION_TYPES; i++)
+  {
+    if (rtcm3_station_types[i] != type)
+      continue;
+
+    msg = &rtcm3->station[i];
+    if (ring_read (ring, rtcm3->start, msg->data, rtcm3->len) == rtcm3->len)
+    {
+      msg->len = rtcm3->len;
+      msg->pos = rtcm3->start;
+    }
+    else
+      msg->len = 0;
+
+    xa_debug (4, "DEBUG: rtcm3: Keeping message %d of %u bytes from %llu", type, msg->len, msg->pos);
+    return;
+  }
+}
+
+/* The synchronous GNSS flag of an observation message, the last message
+ * of an epoch has it cleared. -1 if type is no observation message or the
+ * payload is too short. */
+static int
+rtcm3_sync_flag (const unsigned char *payload, unsigned int len, int type)
+{
+  int bit;
+
+  if ((type >= 1001 && type <= 1004) || (type >= 1071 && type <= 1137))
+    bit = 54; /* after type, station id and a 30 bit epoch time */
+  else if (type >= 1009 && type <= 1012)
+    bit = 51; /* GLONASS epoch time has 27 bits */
+  else
+    return -1;
+
+  if (len <= (unsigned int) bit / 8)
+    return -1;
+
+  return (payload[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/* The frame at start opens a new epoch, so do the filtered streams with the
+ * next frame they let through */
+static void
+rtcm3_epoch_start (rtcm3_t *rtcm3)
+{
+  rtcm3_filter_t *filter;
+
+  rtcm3->epoch = rtcm3->start;
+  rtcm3->epochs++;
+  rtcm3->epoch_next = 0;
+
+  for (filter = rtcm3->filters; filter != NULL; filter = filter->next)
+    filter->epoch_pending = 1;
+}
+
+/* A frame passed the CRC check, remember it and pass it on */
+static void
+rtcm3_frame_done (rtcm3_t *rtcm3, const ring_t *ring)
+{
+  unsigned char payload[RTCM3_SYNC_BYTES];
+  unsigned int n;
+  int t;
+
+  rtcm3->frames[rtcm3->num_frames % RTCM3_FRAMES] = rtcm3->start;
+  rtcm3->num_frames++;
+  if (rtcm3->start > rtcm3->frame_end)
+    rtcm3->discarded += rtcm3->start - rtcm3->frame_end;
+  rtcm3->frame_end = rtcm3->start + rtcm3->len;
+
+  if (rtcm3->epoch_next)
+    rtcm3_epoch_start (rtcm3);
+
+  /* the message number is in the first 12 bits of the payload */
+  n = rtcm3->len - RTCM3_HEADER - RTCM3_CRC;
+  if (n > RTCM3_SYNC_BYTES)
+    n = RTCM3_SYNC_BYTES;
+  if (rtcm3->len < RTCM3_HEADER + 2 + RTCM3_CRC
+      || ring_read (ring, rtcm3->start + RTCM3_HEADER, (char *)payload, n) != n)
+    return;
+
+  t = (payload[0] << 4) | (payload[1] >> 4);
+
+  if (rtcm3_sync_flag (payload, n, t) == 0)
+    rtcm3->epoch_next = 1;
+
+  rtcm3_keep_station_message (rtcm3, ring, t);
+
+  if (rtcm3->filters)
+    rtcm3_filter_frame (rtcm3, ring, t);
+}
+
+/* Parse everything which came into the ring since the last call.
+ * Assert Class: 1
+ */
+void
+rtcm3_scan (rtcm3_t *rtcm3, const ring_t *ring)
+{
+  unsigned char *base, *p, *end, *q;
+  unsigned long n, k;
+  int broken;
+  char *data;
+
+  /* Overwritten before we could look at it */
+  if (rtcm3->pos < ring->tail)
+  {
+    rtcm3->pos = ring->tail;
+    rtcm3->state = rtcm3_sync_e;
+  }
+
+  while ((n = ring_data (ring, rtcm3->pos, &data)) > 0)
+  {
+    base = p = (unsigned char *)data;
+    end = p + n;
+    broken = 0;
+
+    while (p < end)
+    {
+      if (rtcm3->state == rtcm3_sync_e)
+      {
+        q = memchr (p, RTCM3_PREAMBLE, end - p);
+        if (q == NULL)
+        {
+          p = end;
+          break;
+        }
+        rtcm3->start = rtcm3->pos + (q - base);
+        rtcm3->state = rtcm3_header_e;
+        rtcm3->len = 0;
+        rtcm3->got = 1;
+        rtcm3->crc = crc24q (0, q, 1);
+        p = q + 1;
+      }
+      else if (rtcm3->state == rtcm3_header_e)
+      {
+        if (rtcm3->got == 1)
+        {
+          if (*p & 0xFC)
+          {
+            broken = 1;
+            break;
+          }
+          rtcm3->len = (*p & 0x03) << 8;
+        }
+        else
+        {
+          rtcm3->len = (rtcm3->len | *p) + RTCM3_HEADER + RTCM3_CRC;
+          rtcm3->state = rtcm3_frame_e;
+        }
+        rtcm3->crc = crc24q (rtcm3->crc, p, 1);
+        rtcm3->got++;
+        p++;
+      }
+      else
+      {
+        k = rtcm3->len - rtcm3->got;
+        if (k > (unsigned long)(end - p))
+          k = end - p;
+        rtcm3->crc = crc24q (rtcm3->crc, p, k);
+        rtcm3->got += k;
+        p += k;
+
+        if (rtcm3->got < rtcm3->len)
+          continue;
+        if (rtcm3->crc != 0)
+        {
+          rtcm3->crc_errors++;
+          broken = 1;
+          break;
+        }
+
+        rtcm3_frame_done (rtcm3, ring);
+        rtcm3->state = rtcm3_sync_e;
+      }
+    }
+
+    if (broken)
+    {
+      xa_debug (4, "DEBUG: rtcm3_scan(): Broken frame at %llu, searching from %llu", rtcm3->start, rtcm3->start + 1);
+      rtcm3_resync (rtcm3);
+    }
+    else
+      rtcm3->pos += n;
+  }
+}
+
+/* Stream offset of the newest complete frame still in the ring.
+ * Returns 0 if there is none.
+ */
+int
+rtcm3_last_frame (const rtcm3_t *rtcm3, const ring_t *ring, unsigned long long *pos)
+{
+  unsigned long long start;
+
+  if (rtcm3->num_frames == 0)
+    return 0;
+
+  start = rtcm3->frames[(rtcm3->num_frames - 1) % RTCM3_FRAMES];
+  if (start < ring->tail)
+    return 0;
+
+  *pos = start;
+  return 1;
+}
+
+/* Where a client which fell behind goes on: the start of the newest epoch
+ * if epoch is set and one was seen, otherwise the newest frame. Offsets
+ * below limit are gone. filter is the client's message filter or NULL,
+ * ring the backlog it reads from. 0 if no such point is left.
+ */
+int
+rtcm3_skip_point (const rtcm3_t *rtcm3, const rtcm3_filter_t *filter, const ring_t *ring,
+                  int epoch, unsigned long long limit, unsigned long long *pos)
+{
+  unsigned long long last;
+
+  if (filter)
+  {
+    if (epoch && filter->epochs > 0 && filter->epoch >= limit)
+      *pos = filter->epoch;
+    else if (filter->num_frames > 0 && filter->last_frame >= limit)
+      *pos = filter->last_frame;
+    else
+      return 0;
+    return 1;
+  }
+
+  if (epoch && rtcm3->epochs > 0 && rtcm3->epoch >= limit)
+  {
+    *pos = rtcm3->epoch;
+    return 1;
+  }
+
+  if (!rtcm3_last_frame (rtcm3, ring, &last) || last < limit)
+    return 0;
+
+  *pos = last;
+  return 1;
+}
+
+/* Copy the cached station messages which were received before stream
+ * offset pos (a client starting at pos gets the newer ones anyway) and
+ * pass filter, if one is given.
+ * Returns an nmalloc()ed buffer with *len bytes, NULL if there is nothing.
+ */
+char *
+rtcm3_station_messages (const rtcm3_t *rtcm3, unsigned long long pos, const rtcm3_filter_t *filter, unsigned int *len)
+{
+  char *buf;
+  int i, use[RTCM3_STATION_TYPES];
+
+  *len = 0;
+  for (i = 0; i < RTCM3_STATION_TYPES; i++)
+  {
+    use[i] = rtcm3->station[i].len > 0 && rtcm3->station[i].pos < pos
+      && (!filter || rtcm3_filter_pass (filter, rtcm3_station_types[i]));
+    if (use[i])
+      *len += rtcm3->station[i].len;
+  }
+
+  if (*len == 0)
+    return NULL;
+
+  buf = (char *)nmalloc (*len);
+
+  *len = 0;
+  for (i = 0; i < RTCM3_STATION_TYPES; i++)
+  {
+    if (use[i])
+    {
+      memcpy (buf + *len, rtcm3->station[i].data, rtcm3->station[i].len);
+      *len += rtcm3->station[i].len;
+    }
+  }
+
+  return buf;
+}
@@ -0,0 +1,59 @@
+/* rtcm3.h
+ * - RTCM3 frame parsing function headers
+ *
+ * Copyright (c) 2023
+ * German Federal Agency for Cartography and Geodesy (BKG)
+ *
+ * Developed for Networked Transport of RTCM via Internet Protocol (NTRIP)
+ * for streaming GNSS data over the Internet.
+ *
+ * Designed by Informatik Centrum Dortmund http://www.icd.de
+ *
+ * The BKG disclaims any liability nor responsibility to any person or entity
+ * with respect to any loss or damage caused, or alleged to be caused,
+ * directly or indirectly by the use and application of the NTRIP technology.
+ *
+ * For latest information and updates, access:
+ * http://igs.ifag.de/index_ntrip.htm
+ *
+ * Georg Weber
+ * BKG, Frankfurt, Germany, June 2003-06-13
+ * E-mail: euref-ip@bkg.bund.de
+ *
+ * Based on the GNU General Public License published Icecast 1.3.12
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NTRIPCASTER_RTCM3_H
+#define __NTRIPCASTER_RTCM3_H
+
+#include "ntripcastertypes.h"
+
+void rtcm3_init ();
+rtcm3_t *rtcm3_create (unsigned long long pos);
+void rtcm3_free (rtcm3_t *rtcm3);
+void rtcm3_scan (rtcm3_t *rtcm3, const ring_t *ring);
+int rtcm3_last_frame (const rtcm3_t *rtcm3, const ring_t *ring, unsigned long long *pos);
+int rtcm3_skip_point (const rtcm3_t *rtcm3, const rtcm3_filter_t *filter, const ring_t *ring,
+                      int epoch, unsigned long long limit, unsigned long long *pos);
+char *rtcm3_station_messages (const rtcm3_t *rtcm3, unsigned long long pos, const rtcm3_filter_t *filter, unsigned int *len);
+rtcm3_filter_t *rtcm3_filter_create (const char *types, int exclude);
+void rtcm3_filter_free (rtcm3_filter_t *filter);
+rtcm3_filter_t *rtcm3_filter_copy (const rtcm3_filter_t *filter);
+rtcm3_filter_t *rtcm3_filter_share (rtcm3_t *rtcm3, rtcm3_filter_t *filter, unsigned long size);
+void rtcm3_filter_release (rtcm3_t *rtcm3, rtcm3_filter_t *filter);
+unsigned long long rtcm3_filter_start (const rtcm3_t *rtcm3, const rtcm3_filter_t *filter, unsigned long long *pos);
+
+#endif
@@ -134,14 +134,15 @@ void *rtsp_client_func(connection_t *con, ntrip_request_t *req) {
       xa_debug (2, "DEBUG: rtsp method not implemented");
     }
 
-    while ((res = readable_timeo(con->sock, 1)) == 0) my_sleep(500000);
+    res = 1;
+    while (sock_buffered_con(con) == 0 && (res = readable_timeo(con->sock, 1)) == 0) my_sleep(500000);
 
     if (res < 0) {
       xa_debug (2, "DEBUG: readable timeout result < 0");
       break;
     }
 
-    res = sock_read_lines_with_timeout(con->sock, lines, BUFSIZE);
+    res = sock_read_lines_with_timeout_con(con, lines, BUFSIZE);
 
     if (res <= BUFSIZE) {
       xa_debug (2, "DEBUG: sock_read_lines_with_timeout = %d", res);
@@ -779,6 +780,7 @@ int rtsp_post(connection_t *con, ntrip_request_t *req) {
 
     add_source();
     avl_insert(info.sources, session->con);
+    mount_index_add(session->con);
 
     thread_create("Source Thread", source_rtsp_function, (void *)session->con);
   }
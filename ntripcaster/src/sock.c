@@ -100,6 +100,7 @@ int deny_severity = LOG_WARNING;
 #include "rtsp.h"
 #include "ntripcaster_resolv.h"
 #include "log.h"
+#include "logtime.h"
 #include "avl_functions.h"
 #include "main.h"
 #include "utility.h"
@@ -582,6 +583,62 @@ int sock_write_bytes(SOCKET sockfd, const char *buff, int len)
   return t;
 }
 
+/*
+ * Write all iovcnt buffers in iov to the socket, using as few syscalls
+ * as possible. The iov array is modified to describe what is left.
+ * Returns the number of bytes written, or the return value from writev()
+ * if nothing could be written.
+ * Assert Class: 0
+ */
+int sock_writev_bytes(SOCKET sockfd, struct iovec *iov, int iovcnt)
+{
+  int t = 0;
+
+  if (!iov || iovcnt <= 0) {
+    xa_debug(1,
+       "ERROR: sock_writev_bytes() called with no data");
+    return -1;
+  } else if (!sock_valid(sockfd)) {
+    xa_debug(1,
+       "ERROR: sock_writev_bytes() called with invalid socket");
+    return -1;
+  }
+
+  while (iovcnt > 0) {
+    int n;
+
+    if (iov->iov_len == 0) {
+      iov++;
+      iovcnt--;
+      continue;
+    }
+
+#ifdef _WIN32
+    n = send(sockfd, iov->iov_base, iov->iov_len, 0);
+#else
+    n = writev(sockfd, iov, iovcnt);
+#endif
+
+    if (n < 0)
+      return (t == 0) ? n : t;
+    t += n;
+
+    /* Skip what was written */
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov->iov_len = 0;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return t;
+}
+
 int sock_write_bytes_udp(connection_t *con, const char *buff, int totlen)
 {
   int sendsize = 0;
@@ -619,7 +676,7 @@ int sock_write_bytes_con(connection_t *con, const char *buff, int len)
  */
 int sock_write_string(SOCKET sockfd, const char *buff)
 {
-  int write_bytes = 0, res = 0, len = ntripcaster_strlen(buff);
+  int write_bytes = 0, len = ntripcaster_strlen(buff);
 
   if (!sock_valid(sockfd)) {
     fprintf(stderr,
@@ -645,23 +702,45 @@ int sock_write_string(SOCKET sockfd, const char *buff)
       write_bytes = fprintf(stdout, "%s", buff);
       fflush(stdout);
     }
-  } else {
-    while (write_bytes < len) {
-      res =
-        send(sockfd, &buff[write_bytes],
-             len - write_bytes, 0);
-      if (res < 0 && !is_recoverable(errno))
-        return 0;
-      if (res > 0)
-        write_bytes += res;
-      else
-        my_sleep(30000);
-    }
-  }
+  } else
+    return sock_write_buffer(sockfd, buff, len);
 
   return (write_bytes == len ? 1 : 0);
 }
 
+/*
+ * Write len bytes from buff to the socket, waiting while a nonblocking
+ * socket is full.
+ * Return 1 if all bytes where successfully written, and 0 if not.
+ * Assert Class: 2
+ */
+int sock_write_buffer(SOCKET sockfd, const char *buff, int len)
+{
+  int write_bytes = 0, res = 0;
+
+  while (write_bytes < len) {
+    res =
+      send(sockfd, &buff[write_bytes],
+           len - write_bytes, 0);
+    if (res < 0 && !is_recoverable(errno))
+      return 0;
+    if (res > 0)
+      write_bytes += res;
+    else
+      my_sleep(30000);
+  }
+
+  return 1;
+}
+
+int sock_write_buffer_con(connection_t *con, const char *buff, int len)
+{
+  if(con->sock > 0)
+    return sock_write_buffer(con->sock, buff, len);
+  else
+    return (sock_write_bytes_udp(con, buff, len) == len ? 1 : 0);
+}
+
 int sock_write_string_con(connection_t *con, const char *buff)
 {
   if(con->sock > 0)
@@ -744,183 +823,233 @@ int sock_write_line_con(connection_t *con, const char *fmt, ...)
     return sock_write_con(con, "%s\r\n", buff);
 }
 
-/* reads one line (or a maximum of len bytes) and
- * returns string without trailing \n.
- * returns -1 on error, len+1 if a whole line could be read,
- * or the number of bytes received otherwise. rtsp.
+/*
+ * Wait at most ms milliseconds for the socket to become readable.
+ * Returns > 0 if it is, 0 on timeout and -1 on error.
  */
-int sock_read_line(SOCKET sockfd, char *buff, const int len) {
-  char c = '\r';
-  int read_bytes;
-  int pos = 0;
-  int maxpos = len-1;
+static int
+sock_wait_readable (SOCKET sockfd, int ms)
+{
+#ifdef HAVE_POLL
+  struct pollfd fds = {sockfd, POLLIN, 0};
+  return poll(&fds, 1, ms);
+#else /* HAVE_POLL */
+  fd_set rset;
+  struct timeval tv;
 
-  if (!sock_valid(sockfd)) {
-    xa_debug(1, "ERROR: sock_read_line() called with invalid socket");
+  FD_ZERO(&rset);
+  FD_SET(sockfd, &rset);
+
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+
+  return select(sockfd + 1, &rset, NULL, NULL, &tv);
+#endif /* HAVE_POLL */
+}
+
+/*
+ * Receive whatever the socket has into the read ahead buffer of the
+ * connection, waiting up to ms milliseconds for it (not at all if ms <= 0).
+ * Returns the return value from recv(), or -1 on timeout.
+ */
+static int
+sock_fill_con (connection_t *con, int ms)
+{
+  sock_buffer_t *rb;
+  int n;
+
+  if (con->readbuf == NULL) {
+    con->readbuf = (sock_buffer_t *) nmalloc (sizeof (sock_buffer_t));
+    con->readbuf->off = con->readbuf->len = 0;
+  }
+  rb = con->readbuf;
+
+  if (rb->off > 0) {
+    memmove(rb->data, rb->data + rb->off, rb->len - rb->off);
+    rb->len -= rb->off;
+    rb->off = 0;
+  }
+  if (rb->len >= SOCK_BUFFER_SIZE) {
+    errno = ENOBUFS;
     return -1;
   }
 
-  if (maxpos < 0) return 0;
+  if (ms > 0 && sock_wait_readable(con->sock, ms) <= 0) {
+    errno = EAGAIN;
+    return -1;
+  }
 
 #ifdef _WIN32
   WSASetLastError(0);
 #else
   errno = 0;
 #endif
-  read_bytes = recv(sockfd, &c, 1, 0);
+  n = recv(con->sock, rb->data + rb->len, SOCK_BUFFER_SIZE - rb->len, 0);
+  if (n > 0)
+    rb->len += n;
 
-  while (read_bytes > 0) {
-    if (c != '\r') {
-      if (c == '\n') {
-        buff[pos] = '\0';
-        return len+1;
-      }
-      buff[pos] = c;
-      if (pos == maxpos) {
-        return len;
-      }
-      pos++;
-    }
-#ifdef _WIN32
-    WSASetLastError(0);
-#else
-    errno = 0;
-#endif
-    read_bytes = recv(sockfd, &c, 1, 0);
-  }
+  return n;
+}
 
-  buff[pos] = '\0';
-  if ((pos > 0) || (read_bytes == 0)) return pos;
-  return -1;
+/*
+ * Hand out up to len bytes from the read ahead buffer, dropping '\r'.
+ * Returns the number of characters stored in buff, *used tells how many
+ * buffered bytes they took.
+ */
+static int
+sock_copy_buffered (sock_buffer_t *rb, int end, char *buff, int len, int *used)
+{
+  int pos = 0, i;
+
+  for (i = rb->off; i < end && pos < len; i++)
+    if (rb->data[i] != '\r')
+      buff[pos++] = rb->data[i];
+
+  *used = i - rb->off;
+  return pos;
 }
 
-/* tries to read one line (or a maximum of len bytes) until
- * a timeout occurs. Returns string without trailing \n.
- * returns -1 on error, len+1 if a whole line could be read,
- * or the number of bytes received otherwise. rtsp.
+/*
+ * Read one line (lines == 0) or everything up to an empty line (lines != 0)
+ * from the connection, receiving in bulk and keeping the bytes behind it
+ * for later. Waits on the socket at most ms milliseconds, not at all if
+ * ms <= 0.
+ * Returns the string without the last '\n' and '\r's,
+ * -1 on error, len+1 if the whole line(s) could be read,
+ * or the number of bytes received otherwise.
  */
-int sock_read_line_with_timeout(SOCKET sockfd, char *buff, const int len) {
-  char c = '\r';
-  int read_bytes;
-  int pos = 0;
-  int maxpos = len-1;
-  long timeout = time(NULL) + SOCK_READ_LINE_TIMEOUT;
+int
+sock_read_until_con (connection_t *con, char *buff, const int len, int lines, int ms)
+{
+  sock_buffer_t *rb;
+  long long deadline = get_time_ms() + ms;
+  int maxpos = len - 1, scan = 0, pos, used, n = 1;
+  char *nl;
 
-  if (!sock_valid(sockfd)) {
-    xa_debug(1, "ERROR: sock_read_line() called with invalid socket");
+  if (!sock_valid(con->sock)) {
+    xa_debug(1, "ERROR: sock_read_until_con() called with invalid socket");
+    return -1;
+  } else if (!buff) {
+    xa_debug(1, "ERROR: sock_read_until_con() called with NULL storage pointer");
+    return -1;
+  } else if (len <= 0) {
+    xa_debug(1, "ERROR: sock_read_until_con() called with invalid length");
     return -1;
   }
 
-  if (maxpos < 0) return 0;
-
-#ifdef _WIN32
-  WSASetLastError(0);
-#else
-  errno = 0;
-#endif
-  read_bytes = recv(sockfd, &c, 1, 0);
-
-  while ((read_bytes != 0) && (timeout > 0)) {
-    if (c != '\r') {
-      if (c == '\n') {
-        buff[pos] = '\0';
-        return len+1;
+  if (con->readbuf == NULL || con->readbuf->off >= con->readbuf->len)
+    n = sock_fill_con(con, ms);
+
+  while (n > 0) {
+    rb = con->readbuf;
+
+    /* Look for the end of the line(s) in what has not been scanned yet */
+    while ((nl = memchr(rb->data + rb->off + scan, '\n', rb->len - rb->off - scan)) != NULL) {
+      int end = nl - rb->data;
+
+      scan = end - rb->off + 1;
+      if (lines) {
+        int next = end + 1;
+
+        while (next < rb->len && rb->data[next] == '\r')
+          next++;
+        if (next >= rb->len) {
+          /* don't know yet, look at this '\n' again */
+          scan = end - rb->off;
+          break;
+        }
+        if (rb->data[next] != '\n')
+          continue;
+        /* keep the first '\n', drop the one ending the header */
+        end = next;
       }
-      buff[pos] = c;
-      if (pos == maxpos) {
+
+      pos = sock_copy_buffered(rb, end, buff, maxpos, &used);
+      buff[pos] = '\0';
+      if (rb->off + used < end) {
+        rb->off += used;
         return len;
       }
-      pos++;
+      rb->off = end + 1;
+      return len+1;
+    }
+
+    /* Hand out a line which does not fit into buff */
+    pos = sock_copy_buffered(rb, rb->len, buff, maxpos, &used);
+    if (pos == maxpos) {
+      buff[pos] = '\0';
+      rb->off += used;
+      return len;
     }
-#ifdef _WIN32
-    WSASetLastError(0);
-#else
-    errno = 0;
-#endif
-    read_bytes = recv(sockfd, &c, 1, 0);
 
-    while (read_bytes < 0) {
-      if (time(NULL) > timeout) {
-        timeout = -1;
+    if (ms > 0) {
+      long long left = deadline - get_time_ms();
+      if (left <= 0)
         break;
-      }
-      my_sleep(200000);
-      read_bytes = recv(sockfd, &c, 1, 0);
+      n = sock_fill_con(con, (int)left);
+    } else {
+      n = sock_fill_con(con, 0);
     }
   }
 
+  /* Timeout, error or end of stream, hand out what we have */
+  pos = 0;
+  if (con->readbuf != NULL) {
+    rb = con->readbuf;
+    pos = sock_copy_buffered(rb, rb->len, buff, maxpos, &used);
+    rb->off += used;
+  }
   buff[pos] = '\0';
-  if ((pos > 0) || (read_bytes == 0)) return pos;
+  if ((pos > 0) || (n == 0)) return pos;
   return -1;
 }
 
+/* tries to read one line (or a maximum of len bytes) until
+ * a timeout occurs. Returns string without trailing \n.
+ * returns -1 on error, len+1 if a whole line could be read,
+ * or the number of bytes received otherwise. rtsp.
+ */
+int sock_read_line_with_timeout_con(connection_t *con, char *buff, const int len) {
+  return sock_read_until_con(con, buff, len, 0, SOCK_READ_LINE_TIMEOUT*1000);
+}
+
 /* reads multiple lines until two consecutive '\n' or a timeout occur
  * or a maximum of len bytes and returns string without last '\n'.
  * returns -1 on error, len+1 if "\n\n" could be read, or the number
  * of bytes received otherwise. rtsp.
  */
-int sock_read_lines_with_timeout(SOCKET sockfd, char *buff, const int len) {
-  char c = '\r';
-  char last = '\r';
-  int read_bytes;
-  int pos = 0;
-  int maxpos = len-1;
-  long timeout = time(NULL) + SOCK_READ_LINES_TIMEOUT;
-
-  if (!sock_valid(sockfd)) {
-    xa_debug(1, "ERROR: sock_read_lines_with_timeout() called with invalid socket");
-    return -1;
-  } else if (!buff) {
-    xa_debug(1, "ERROR: sock_read_lines_with_timeout() called with NULL storage pointer");
-    return -1;
-  } else if (len <= 0) {
-    xa_debug(1, "ERROR: sock_read_lines_with_timeout() called with invalid length");
-    return -1;
-  }
-
-  if (maxpos < 0) return 0;
+int sock_read_lines_with_timeout_con(connection_t *con, char *buff, const int len) {
+  return sock_read_until_con(con, buff, len, 1, SOCK_READ_LINES_TIMEOUT*1000);
+}
 
-#ifdef _WIN32
-  WSASetLastError(0);
-#else
-  errno = 0;
-#endif
+/*
+ * Move up to len bytes which were read ahead together with a header
+ * into buff.
+ * Returns the number of bytes moved, 0 if nothing is buffered.
+ */
+int sock_read_buffered_con(connection_t *con, char *buff, const int len)
+{
+  sock_buffer_t *rb = con->readbuf;
+  int n;
 
-  read_bytes = recv(sockfd, &c, 1, 0);
+  if (rb == NULL || rb->off >= rb->len || len <= 0)
+    return 0;
 
-  while ((read_bytes != 0) && (timeout > 0)) {
-    if (c != '\r') {
-      if ((c == '\n') && (last == '\n')) {
-        buff[pos] = '\0';
-        return len+1;
-      }
-      buff[pos] = c;
-      last = c;
-      if (pos == maxpos) {
-        return len;
-      }
-      pos++;
-    }
-#ifdef _WIN32
-    WSASetLastError(0);
-#else
-    errno = 0;
-#endif
-    read_bytes = recv(sockfd, &c, 1, 0);
+  n = rb->len - rb->off;
+  if (n > len)
+    n = len;
+  memcpy(buff, rb->data + rb->off, n);
+  rb->off += n;
 
-    while (read_bytes < 0) {
-      if (time(NULL) > timeout) {
-        timeout = -1;
-        break;
-      }
-      my_sleep(200000);
-      read_bytes = recv(sockfd, &c, 1, 0);
-    }
-  }
+  return n;
+}
 
-  buff[pos] = '\0';
-  if ((pos > 0)|| (read_bytes == 0)) return pos;
-  return -1;
+/*
+ * Returns the number of bytes read ahead and not consumed yet.
+ */
+int sock_buffered_con(connection_t *con)
+{
+  return (con->readbuf != NULL) ? con->readbuf->len - con->readbuf->off : 0;
 }
 
 int sock_read_line_nb(SOCKET sock, char *buff, const int len)
@@ -57,6 +57,12 @@ typedef struct ntripcaster_socket_St
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
 #include <sys/socket.h>
+#include <sys/uio.h>
+#else
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
 #endif
 
 enum blockmode {SOCK_BLOCK=0, SOCK_BLOCKNOT=1};
@@ -94,20 +100,25 @@ SOCKET sock_connect_wto(const char *hostname, const int port, const int timeout)
 
 /* Socket write functions */
 int sock_write_bytes(SOCKET sockfd, const char *buff, int len);
+int sock_writev_bytes(SOCKET sockfd, struct iovec *iov, int iovcnt);
 int sock_read_line_nb (SOCKET sock, char *buff, const int len);
 int sock_write_bytes_or_kick (SOCKET sockfd, connection_t *clicon, const char *buff, const int len);
 int sock_write(SOCKET sockfd, const char *fmt, ...);
 int sock_write_line (SOCKET sockfd, const char *fmt, ...);
 int sock_write_string (SOCKET sockfd, const char *buff);
+int sock_write_buffer (SOCKET sockfd, const char *buff, int len);
 int sock_write_bytes_con(connection_t *con, const char *buff, int len);
 int sock_write_con(connection_t *con, const char *fmt, ...);
 int sock_write_line_con (connection_t *con, const char *fmt, ...);
 int sock_write_string_con (connection_t *con, const char *buff);
+int sock_write_buffer_con (connection_t *con, const char *buff, int len);
 
 /* Socket read functions */
-int sock_read_line (SOCKET sockfd, char *string, const int len);
-int sock_read_line_with_timeout(SOCKET sockfd, char *buff, const int len);
-int sock_read_lines_with_timeout(SOCKET sockfd, char *buff, const int len);
+int sock_read_line_with_timeout_con(connection_t *con, char *buff, const int len);
+int sock_read_until_con(connection_t *con, char *buff, const int len, int lines, int ms);
+int sock_read_lines_with_timeout_con(connection_t *con, char *buff, const int len);
+int sock_read_buffered_con(connection_t *con, char *buff, const int len);
+int sock_buffered_con(connection_t *con);
 
 int readable_timeo (int fd, int sec);
 
@@ -105,22 +105,42 @@
 #include "pool.h"
 #include "logtime.h"
 #include "vars.h"
+#include "event.h"
+#include "ring.h"
+#include "rtcm3.h"
+#include "nearest.h"
+#include "recorder.h"
+#include "replay.h"
+#include "latency.h"
 #include "authenticate/basic.h"
 #ifdef HAVE_TLS
 #include "tls.h"
 #endif /* HAVE_TLS */
 
-/* in microseconds */
+/* in milliseconds */
 #define READ_RETRY_DELAY 400
 #define READ_TIMEOUT 16000
 
+/* Stall detection, in milliseconds */
+#define STALL_BURST_GAP 20      /* reads closer together belong to one epoch */
+#define STALL_MAX_CADENCE 60000 /* longer gaps don't teach us anything */
+#define STALL_MIN_TIMEOUT 100
+#define STALL_LEARN_GAPS 8      /* gaps to see before the cadence is used */
+
+static void source_arrival (source_t *source, long long now);
+static int source_stall_timeout (const source_t *source);
+static void source_stall (source_t *source, long long quiet);
+static void source_failover (source_t *source);
+static void source_send_home (source_t *source);
+static void source_route_nearest (source_t *source);
+static void source_unstall (source_t *source);
+
 extern server_info_t info;
-const int source_read_sleep = READ_RETRY_DELAY * 1000; // in microseconds
-const int source_read_tries = READ_TIMEOUT / READ_RETRY_DELAY;
 
-void add_global_stats(source_t *source)
+/* The statistics kept for mount across source connections, added if
+ * there are none yet. Entries stay until shutdown. */
+statisticsentry_t *get_mount_stats(const char *mount)
 {
-  statistics_t *stats = 0;
   statisticsentry_t *s;
 
   avl_traverser trav = {0};
@@ -128,25 +148,28 @@ void add_global_stats(source_t *source)
   thread_mutex_lock (&info.sourcesstats_mutex);
   while ((s = avl_traverse (info.sourcesstats, &trav)))
   {
-    if ((ntripcaster_strcmp (s->mount, source->audiocast.mount) == 0))
-    {
-      stats = &s->stats;
+    if ((ntripcaster_strcmp (s->mount, mount) == 0))
       break;
-    }
   }
-  if(!stats) /* add */
+  if(!s) /* add */
   {
     s = (statisticsentry_t *)nmalloc(sizeof(statisticsentry_t));
     memset(s, 0, sizeof(statisticsentry_t));
-    s->mount = nstrdup(source->audiocast.mount);
-    stats = &s->stats;
+    s->mount = nstrdup(mount);
     avl_insert(info.sourcesstats, s);
-    zero_stats (stats);
+    zero_stats (&s->stats);
   }
   thread_mutex_unlock (&info.sourcesstats_mutex);
 
-  stats->source_connections++;
-  source->globalstats = stats;
+  return s;
+}
+
+void add_global_stats(source_t *source)
+{
+  statisticsentry_t *s = get_mount_stats (source->audiocast.mount);
+
+  s->stats.source_connections++;
+  source->globalstats = &s->stats;
 }
 
 void http_source_login(connection_t *con, ntrip_request_t *req) {
@@ -221,14 +244,13 @@ void http_source_login(connection_t *con, ntrip_request_t *req) {
   add_source();
   source->connected = SOURCE_CONNECTED;
   avl_insert(info.sources, con);
+  mount_index_add(con);
 
   num_sources = info.num_sources; // store it, so we can unlock before write_log() call
   thread_mutex_unlock(&info.source_mutex);
 
   write_log (LOG_DEFAULT, "Accepted encoder on mountpoint %s from %s. %d sources connected", source->audiocast.mount, con_host(con), num_sources);
 
-  thread_rename("Source Thread");
-
   source_func(con);
 }
 
@@ -254,6 +276,59 @@ xa_debug(2, "DEBUG: Enc %s", info.encoder_pass);
   return 0;
 }
 
+/*
+ * Sources are served by a fixed pool of source_threads worker threads.
+ * source_func () hands a new source to the worker with the fewest. A
+ * worker sleeps in event_wait () on one event set holding the sockets of
+ * all its sources and their blocked clients, until a source socket is
+ * readable, a client which was full becomes writable, a source needs a
+ * look by its deadline (read timeout, stall), or another thread wakes a
+ * source with source_wake () (new client, source kicked, UDP data arrived,
+ * twin back). A source keeps its worker until source_close (), so only
+ * that thread touches its clients and backlog.
+ */
+
+static mutex_t workers_mutex;          /* Protects incoming and num_sources of all workers */
+static source_worker_t *workers = NULL;
+static int num_workers = 0;
+
+static void *source_worker (void *arg);
+
+/* Start the worker threads. Called once at startup.
+ * Assert Class: 1
+ */
+void
+source_start_workers ()
+{
+  int i;
+
+  thread_create_mutex (&workers_mutex);
+
+  num_workers = info.source_threads > 0 ? info.source_threads : 1;
+  workers = (source_worker_t *)nmalloc (num_workers * sizeof (source_worker_t));
+  memset (workers, 0, num_workers * sizeof (source_worker_t));
+
+  for (i = 0; i < num_workers; i++)
+  {
+    if ((workers[i].events = event_set_create ()) == NULL)
+      write_log (LOG_DEFAULT, "WARNING: No event set for source thread %d", i);
+    thread_create ("Source Thread", source_worker, (void *)&workers[i]);
+  }
+
+  write_log (LOG_DEFAULT, "Serving sources with %d threads", num_workers);
+}
+
+/* Have the worker serving source look at it, e.g. for new clients.
+ * May be called from any thread.
+ * Assert Class: 0
+ */
+void
+source_wake (source_t *source)
+{
+  source->woken = 1;
+  event_wake (source->events);
+}
+
 void *source_rtsp_function(void *conarg) {
   thread_init();
   source_func(conarg);
@@ -262,58 +337,86 @@ void *source_rtsp_function(void *conarg) {
 }
 
 /*
-   A lot can be said about termination of this thread.
+   Set up a source which was just added to info.sources and hand it to the
+   worker serving the fewest sources. Returns right away, the worker frees
+   the source in source_close () when it is gone.
+
+   A lot can be said about termination of a source.
    Either it gets killed by another thread, using the kick_connection (thiscon,..),
-   which should set the connected value to SOURCE_KILLED, and let this thread
-   exit on it's on with the close_connection at the end.
-   Or it kills itself, when the encoder dies, and then it should call kick_connection (thiscon,..),
-   on itself, setting the value of connected to SOURCE_KILLED, and exit through close_connection () */
+   which should set the connected value to SOURCE_KILLED and wake the worker,
+   which closes it with source_close ().
+   Or it kills itself, when the encoder dies, and then the worker calls kick_connection (thiscon,..),
+   on it, setting the value of connected to SOURCE_KILLED, and closes it the same way. */
 void *
 source_func(void *conarg)
 {
   source_t *source;
-  avl_traverser trav = {0};
-  connection_t *clicon, *con = (connection_t *)conarg;
-  mythread_t *mt;
-  int i;
+  connection_t *con = (connection_t *)conarg;
+  source_worker_t *worker;
+  int i, period;
 
   source = con->food.source;
-  con->food.source->thread = thread_self();
-
-  mt = thread_get_mythread ();
 
   if(con->sock > 0)
     sock_set_blocking(con->sock, SOCK_BLOCKNOT);
 
-  sourcetable_add_source(source);
+  if (ring_init(&source->ring, source_buffer_size(source->audiocast.mount)) != OK)
+  {
+    thread_mutex_lock (&info.double_mutex);
+    kick_connection(con, "No memory for client backlog");
+    thread_mutex_unlock (&info.double_mutex);
+  }
 
-  while (thread_alive (mt) && ((source->connected == SOURCE_CONNECTED) || (source->connected == SOURCE_PAUSED)))
+  xa_debug (2, "DEBUG: Using %lu bytes of client backlog on mountpoint [%s]", source->ring.size, source->audiocast.mount);
+
+  if (source_rtcm3_frames(source->audiocast.mount))
   {
-    source_get_new_clients (source);
+    source->rtcm3 = rtcm3_create(source->ring.head);
+    xa_debug (2, "DEBUG: Parsing RTCM3 frames on mountpoint [%s]", source->audiocast.mount);
+  }
 
-    add_chunk(con);
+  source->lag_policy = source_lag_policy(source->audiocast.mount);
+  source->config_generation = info.config_generation;
 
-    for (i = 0; i < 10; i++) {
+  /* a twin keeps our clients until we have data */
+  if ((source->twin = source_twin(source->audiocast.mount)) != NULL)
+    source->stalled = 1;
 
-      if (source->connected != SOURCE_CONNECTED)
-        break;
+  if ((period = source_record_period(source->audiocast.mount)) > 0)
+    source->recorder = recorder_create(source->audiocast.mount, period, source->rtcm3 != NULL, source->ring.size, source->ring.head);
 
-      zero_trav (&trav);
+  sourcetable_add_source(source);
 
-      while ((clicon = avl_traverse(source->clients, &trav)) != NULL) {
+  source->last_data = get_time_ms ();
+  source->readable = 1;
 
-        if (source->connected == SOURCE_KILLED || source->connected == SOURCE_PAUSED)
-          break;
+  thread_mutex_lock (&workers_mutex);
 
-        source_write_to_client (source, clicon);
+  worker = &workers[0];
+  for (i = 1; i < num_workers; i++)
+    if (workers[i].num_sources < worker->num_sources)
+      worker = &workers[i];
 
-      }
+  worker->num_sources++;
+  source->worker = worker;
+  source->events = worker->events;
+  source->next_served = worker->incoming;
+  worker->incoming = con;
+
+  thread_mutex_unlock (&workers_mutex);
+
+  event_wake (worker->events);
+
+  return NULL;
+}
+
+/* The source is gone: take it out of the sourcetable, move its clients to
+ * the twin if there is one, and free it. Called by its worker. */
+static void
+source_close (connection_t *con)
+{
+  source_t *source = con->food.source;
 
-      if (mt->ping == 1)
-        mt->ping = 0;
-    }
-    kick_dead_clients (source); //-> client_mutex, authentication_mutex (in close_connection) locked inside.
-  }
   sourcetable_remove_source(source);
 
   thread_mutex_lock (&info.double_mutex);
@@ -321,11 +424,244 @@ source_func(void *conarg)
 
   source_get_new_clients (source); // to clean the pool before source dies.
 
+  if (is_server_running ())
+    source_failover (source);
+
+  if (source->type == pulling_source_e)
+  {
+    relay_t *rel;
+
+    thread_mutex_lock (&info.relay_mutex);
+    if ((rel = relay_find_with_con (con)) != NULL)
+    {
+      rel->con = NULL;
+      rel->pending = 0;
+    }
+    thread_mutex_unlock (&info.relay_mutex);
+  }
+
+  if (con->sock > 0)
+    event_del (source->events, con->sock);
+
   close_connection (con); //-> client_mutex (in kick_dead_clients), authentication_mutex locked inside.
 
   thread_mutex_unlock (&info.source_mutex);
   thread_mutex_unlock (&info.double_mutex);
+}
+
+/* Take the new clients and data of a source and pass the data on.
+ * Returns the get_time_ms () by which the worker has to look at the
+ * source again, or -1 if it is gone and was closed. */
+static long long
+source_serve (connection_t *con)
+{
+  source_t *source = con->food.source;
+  avl_traverser trav = {0};
+  connection_t *clicon;
+  long long now;
+  int n, timeout, stall;
+
+  if (source->woken)
+  {
+    source->woken = 0;
+
+    /* UDP sources have no socket, the UDP listener wakes us up */
+    if (con->sock <= 0)
+      source->readable = 1;
+  }
+
+  if (source->connected != SOURCE_CONNECTED && source->connected != SOURCE_PAUSED)
+  {
+    source_close (con);
+    return -1;
+  }
+
+  source_get_new_clients (source);
+
+  if (source->twin_return)
+    source_send_home (source);
+
+  /* Edge triggered, so read until the source has nothing left for us.
+     Every chunk is passed on to the clients right away. */
+  while (source->readable && (source->connected == SOURCE_CONNECTED || source->connected == SOURCE_PAUSED))
+  {
+    n = add_chunk(con);
+
+    if (n <= 0)
+    {
+      source->readable = 0;
+      event_rearm(source->events, con->sock, EVENT_READ);
+      break;
+    }
+
+    source_arrival (source, get_time_ms ());
+
+    if (source->connected != SOURCE_CONNECTED)
+      continue;
+
+    /* find the watermark on the way */
+    source->ring.low = source->ring.head;
+
+    zero_trav (&trav);
+
+    while ((clicon = avl_traverse(source->clients, &trav)) != NULL) {
+
+      if (source->connected == SOURCE_KILLED || source->connected == SOURCE_PAUSED)
+        break;
+
+      if (!clicon->food.client->blocked)
+        source_write_to_client (source, clicon);
+
+      if (clicon->food.client->alive != CLIENT_DEAD && clicon->food.client->virgin == 0
+          && clicon->food.client->filter == NULL && clicon->food.client->pos < source->ring.low)
+        source->ring.low = clicon->food.client->pos;
+    }
+  }
+
+  kick_dead_clients (source); //-> client_mutex, authentication_mutex (in close_connection) locked inside.
+
+  if (source->near_check)
+    source_route_nearest (source);
+
+  if (source->connected != SOURCE_CONNECTED && source->connected != SOURCE_PAUSED)
+  {
+    source_close (con);
+    return -1;
+  }
+
+  now = get_time_ms ();
+  timeout = READ_TIMEOUT - (int)(now - source->last_data);
+
+  if (timeout <= 0)
+  {
+    write_log(LOG_DEFAULT, "Didn't receive data from source after %d milliseconds, assuming it died...", READ_TIMEOUT);
+
+    thread_mutex_lock (&info.double_mutex);
+    kick_connection(con, "Source died");
+    thread_mutex_unlock (&info.double_mutex);
+
+    source_close (con);
+    return -1;
+  }
+
+  /* Nothing to do until data comes or the source misses too many
+     epochs. Clients of a stalled source with a twin don't wait. */
+  if (source->connected == SOURCE_CONNECTED && (stall = source_stall_timeout (source)) > 0)
+  {
+    stall -= (int)(now - source->last_data);
+
+    if (stall <= 0 && (!source->stalled || (source->twin != NULL && avl_count (source->clients) > 0)))
+      source_stall (source, now - source->last_data);
+    else if (stall > 0 && stall < timeout)
+      timeout = stall;
+  }
+
+  return now + timeout;
+}
+
+/* Serves the sources handed to one worker and their clients */
+static void *
+source_worker (void *arg)
+{
+  source_worker_t *worker = (source_worker_t *)arg;
+  connection_t *con, *next, **prev;
+  source_t *source;
+  event_t ev[EVENT_MAX];
+  mythread_t *mt;
+  long long now, deadline;
+  int i, n, timeout = 0;
+
+  thread_init ();
+
+  mt = thread_get_mythread ();
+
+  while (thread_alive (mt))
+  {
+    n = event_wait(worker->events, ev, EVENT_MAX, timeout);
+
+    if (n < 0)
+    {
+      xa_debug (1, "WARNING: source_worker(): event_wait() failed, errno %d", errno);
+      my_sleep(READ_RETRY_DELAY * 1000);
+      n = 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      con = (connection_t *)ev[i].data;
+
+      if (con->type == source_e)
+      {
+        con->food.source->readable = 1;
+        continue;
+      }
+
+      /* a client unblocked, its source is one of ours since clients
+         are only moved by the worker of the source they leave */
+      source = con->food.client->source;
+      con->food.client->blocked = 0;
+
+      if (source->connected == SOURCE_CONNECTED)
+        source_write_to_client (source, con);
+    }
+
+    /* sources handed over meanwhile */
+    thread_mutex_lock (&workers_mutex);
+    con = worker->incoming;
+    worker->incoming = NULL;
+    thread_mutex_unlock (&workers_mutex);
+
+    for (; con != NULL; con = next)
+    {
+      source = con->food.source;
+      next = source->next_served;
+      source->next_served = worker->sources;
+      worker->sources = con;
+      source->thread = thread_self ();
+      source->deadline = 0;
+      if (con->sock > 0)
+        event_add (worker->events, con->sock, EVENT_READ, con);
+    }
+
+    now = get_time_ms ();
+    timeout = READ_TIMEOUT;
+
+    for (prev = &worker->sources; (con = *prev) != NULL; )
+    {
+      source = con->food.source;
+      next = source->next_served;
+
+      if (source->readable || source->woken || now >= source->deadline)
+      {
+        if ((deadline = source_serve (con)) < 0)
+        {
+          *prev = next;
+          thread_mutex_lock (&workers_mutex);
+          worker->num_sources--;
+          thread_mutex_unlock (&workers_mutex);
+          continue;
+        }
+        source->deadline = deadline;
+      }
+
+      if (source->deadline - now < timeout)
+        timeout = source->deadline - now > 0 ? (int)(source->deadline - now) : 0;
+
+      prev = &source->next_served;
+    }
 
+    if (mt->ping == 1)
+      mt->ping = 0;
+  }
+
+  /* shutting down, close what is left */
+  while ((con = worker->sources) != NULL)
+  {
+    worker->sources = con->food.source->next_served;
+    source_close (con);
+  }
+
+  thread_exit (0);
   return NULL;
 }
 
@@ -341,7 +677,6 @@ create_source()
 void
 put_source(connection_t *con)
 {
-  register int i;
   source_t *source = create_source();
 
   con->food.source = source;
@@ -351,16 +686,11 @@ put_source(connection_t *con)
   source->type = unknown_source_e;
   source->audiocast.name = NULL;
   source->audiocast.mount = NULL;
-  source->cid = 0;
   source->clients = avl_create (compare_connection, &info);
   source->num_clients = 0;
   source->priority = 0;
-
-  for (i = 0; i < CHUNKLEN; i++)
-  {
-    source->chunk[i].clients_left = 0;
-    source->chunk[i].len = 0;
-  }
+  source->events = NULL; /* the worker's, see source_func () */
+  memset (&source->ring, 0, sizeof (ring_t));
 
   con->type = source_e;
 }
@@ -378,13 +708,106 @@ del_source ()
   info.num_sources--;
 }
 
+/* Mount index. Sources are found by their mount name in info.mounts and,
+ * for mounts given as http://host:port/path, by host, port and path in
+ * info.hostmounts. Must have source mutex to call these. */
+
+/* Build the host index key host:port/path, host in lower case */
+static void
+mount_host_key (const char *host, int port, const char *path, char *key, int len)
+{
+  int i;
+
+  snprintf (key, len, "%s:%d%s", host, port, path);
+  for (i = 0; key[i] && key[i] != ':'; i++)
+    key[i] = tolower ((int)(unsigned char)key[i]);
+}
+
+void
+mount_index_add (connection_t *con)
+{
+  source_t *source = con->food.source;
+  ntrip_request_t search;
+  char key[BUFSIZE];
+
+  if (!source->audiocast.mount)
+    return;
+
+  if (avl_insert (info.mounts, con) != NULL)
+  {
+    write_log (LOG_DEFAULT, "WARNING: Mountpoint %s indexed twice", source->audiocast.mount);
+    return;
+  }
+
+  if (ntripcaster_strncmp (source->audiocast.mount, "http://", 7) == 0)
+  {
+    zero_request (&search);
+    generate_request (source->audiocast.mount, &search);
+    if (search.path[0])
+    {
+      mount_host_key (search.host, search.port, search.path, key, BUFSIZE);
+      source->hostkey = nstrdup (key);
+      if (avl_insert (info.hostmounts, con) != NULL)
+      {
+        nfree (source->hostkey);
+        source->hostkey = NULL;
+      }
+    }
+  }
+}
+
+void
+mount_index_remove (connection_t *con)
+{
+  source_t *source = con->food.source;
+
+  if (!source->audiocast.mount)
+    return;
+
+  if (avl_find (info.mounts, con) == con)
+    avl_delete (info.mounts, con);
+
+  if (source->hostkey)
+  {
+    if (avl_find (info.hostmounts, con) == con)
+      avl_delete (info.hostmounts, con);
+    nfree (source->hostkey);
+    source->hostkey = NULL;
+  }
+}
+
+/* Returns the source with exactly this mount name */
+connection_t *
+mount_index_find (const char *mount)
+{
+  connection_t search;
+  source_t ssearch;
+
+  ssearch.audiocast.mount = (char *) mount;
+  search.food.source = &ssearch;
+
+  return avl_find (info.mounts, &search);
+}
+
+/* Returns the source with a http:// mount for host, port and path */
+connection_t *
+mount_index_find_host (const char *host, int port, const char *path)
+{
+  connection_t search;
+  source_t ssearch;
+  char key[BUFSIZE];
+
+  mount_host_key (host, port, path, key, BUFSIZE);
+  ssearch.hostkey = key;
+  search.food.source = &ssearch;
+
+  return avl_find (info.hostmounts, &search);
+}
+
 connection_t *
 find_mount(char *mount) {
-//  char tempbuf[256] = "";
   connection_t *con;
   alias_t *alias = NULL;
-  int true = 0;
-  avl_traverser trav = {0};
 
   if (!mount) {
     write_log (LOG_DEFAULT, "WARNING: find_mount called with NULL mount!");
@@ -401,36 +824,24 @@ find_mount(char *mount) {
     return find_mount_with_req (alias->real, &alias);
   }
 
-  while ((con = avl_traverse(info.sources, &trav)) != NULL) {
-    true = 0;
-
-    xa_debug(2, "DEBUG: Looking on mount [%s]", con->food.source->audiocast.mount);
+  /* Mounts are stored with leading slash, except virtual ones */
+  con = mount_index_find (mount);
+  if (!con && mount[0] && (con = mount_index_find (mount+1)) != NULL
+      && con->food.source->audiocast.mount[0] == '/')
+    con = NULL;
 
-    if (con->food.source->audiocast.mount[0] == '/') {
-      if (ntripcaster_strcmp(con->food.source->audiocast.mount, mount) == 0) true = 1;
-    } else {
-      if (ntripcaster_strcmp(con->food.source->audiocast.mount, mount+1) == 0) true = 1;
-    }
+  if (con)
+    xa_debug(1, "DEBUG: Found local mount for [%s]", mount);
 
-    if (true) {
-      xa_debug(1, "DEBUG: Found local mount for [%s]", mount);
-      return con;
-    }
-  }
-  return NULL;
+  return con;
 }
 
 /* Must have source and double mutex to call this */
 connection_t *
 find_mount_with_req (ntrip_request_t *req, alias_t **wasalias)
 {
-  char tempbuf[256] = "";
-
-  connection_t *con;
+  connection_t *con = NULL;
   alias_t *alias = NULL;
-  ntrip_request_t search;
-
-  avl_traverser trav = {0};
 
   if (!req || !req->path[0] || !req->host[0])
   {
@@ -456,49 +867,23 @@ find_mount_with_req (ntrip_request_t *req, alias_t **wasalias)
   xa_debug (1, "DEBUG: Search local mount points path %s host %s port %d",
   req->path, req->host, req->port);
 
-  int pathlen = strlen(req->path);
+  /* Mounts given as http://host:port/path */
+  con = mount_index_find_host (req->host, req->port, req->path);
 
-  while ((con = avl_traverse(info.sources, &trav)) != NULL)
+  /* Regular mounts, and virtual ones without the leading slash */
+  if (!con && hostname_local (req->host))
   {
-    int true = 0;
-    int mlen = strlen(con->food.source->audiocast.mount);
-
-    zero_request(&search);
-
-    /* shortcut to prevent complicated next steps, mount must end with path */
-    if(mlen < pathlen || strcmp(con->food.source->audiocast.mount+mlen-pathlen,
-    req->path))
-      continue;
-
-    generate_request(con->food.source->audiocast.mount, &search);
-
-    strncpy(tempbuf, con->food.source->audiocast.mount, 252);
-
-    if (search.path[0] && (ntripcaster_strcasecmp(search.host, req->host) == 0)
-    && (search.port == req->port) && ((ntripcaster_strcmp(search.path,
-    req->path) == 0) || (ntripcaster_strcmp(tempbuf, req->path) == 0))) {
-      true = 1;
-    } else if (con->food.source->audiocast.mount[0] == '/') { /* regular mount */
-      if ((hostname_local(req->host) && ((ntripcaster_strcmp(
-      con->food.source->audiocast.mount, req->path) == 0)
-      || (ntripcaster_strcmp(tempbuf, req->path) == 0)))) {
-        true = 1;
-      }
-    } else {
-      if ((hostname_local(req->host) && ((ntripcaster_strcmp(
-      con->food.source->audiocast.mount, req->path + 1) == 0)
-      || (ntripcaster_strcmp(tempbuf, req->path + 1) == 0)))) {
-        true = 1;
-      }
-    }
+    con = mount_index_find (req->path);
+    if (!con)
+      con = mount_index_find (req->path + 1);
+  }
 
-    if (true) {
-      if (con->food.source->connected == SOURCE_CONNECTED) {
-        xa_debug(1, "DEBUG: Found local mount for [%s]", req->path);
-        return con;
-      } else
-        return NULL;
-    }
+  if (con) {
+    if (con->food.source->connected == SOURCE_CONNECTED) {
+      xa_debug(1, "DEBUG: Found local mount for [%s]", req->path);
+      return con;
+    } else
+      return NULL;
   }
 
   xa_debug (1, "DEBUG: End search local mount points");
@@ -506,271 +891,333 @@ find_mount_with_req (ntrip_request_t *req, alias_t **wasalias)
   return NULL;
 }
 
-void
+/* Read what the source has for us into the client backlog. Never waits for data.
+ * Returns the number of bytes read, 0 when reading would block,
+ * and -1 when the source is gone.
+ */
+int
 add_chunk (connection_t *con)
 {
-  int read_bytes = 0;
-  int len = -1;
-  int tries = 0;
-  int maxread = (int)(0.5 * SOURCE_READSIZE);
+  source_t *source = con->food.source;
+  unsigned long room = SOURCE_READSIZE;
+  char *buf;
+  int len = -1, err;
 
-  if (con->food.source->connected == SOURCE_KILLED) return;
+  if (source->connected == SOURCE_KILLED) return -1;
 
-  if (con->food.source->chunk[con->food.source->cid].clients_left > 0)
-    kick_trailing_clients(con->food.source); // rtsp
-
-  do
-  {
-    errno = 0;
+  errno = 0;
 #ifdef _WIN32
-    if(con->sock > 0)
-      sock_set_blocking(con->sock, SOCK_BLOCK);
+  if(con->sock > 0)
+    sock_set_blocking(con->sock, SOCK_BLOCK);
 #endif
 
-    switch (con->data_protocol)
+  switch (con->data_protocol)
+  {
+    case tcp_e:
     {
-      case tcp_e:
+      source_make_room(source, room);
+      buf = ring_space(&source->ring, &room);
+
+      if (con->trans_encoding == chunked_e && con->http_chunk->state == chunk_done_e)
+        len = 0; /* the last chunk ended the stream */
+      else do
       {
-        if (con->trans_encoding == chunked_e)
-        {
-          if (con->http_chunk->left <= 0)
-          {
+        /* Data which came in together with the header goes first */
+        if (sock_buffered_con(con) > 0)
+          len = sock_read_buffered_con(con, buf, room);
+        else
 #ifdef HAVE_TLS
-            if(con->tls_socket)
-              len = tls_read_line(con->tls_socket, con->http_chunk->buf + con->http_chunk->off, 20 - con->http_chunk->off);
-            else
+        if(con->tls_socket)
+          len = tls_recv(con->tls_socket, buf, room);
+        else
 #endif
-            len = sock_read_line(con->sock, con->http_chunk->buf + con->http_chunk->off, 20 - con->http_chunk->off);
-
-            xa_debug (5, "DEBUG: add_chunk: hex [%s], read=%d (%d) of max=%d on mountpoint [%s] tries=%d", con->http_chunk->buf,
-            len, strlen(con->http_chunk->buf), 20 - con->http_chunk->off, con->food.source->audiocast.mount, tries);
-
-            if (len > (20 - con->http_chunk->off))
-            { // a whole line could be read.
-              if(con->http_chunk->finish)
-              {
-                xa_debug (4, "DEBUG: add_chunk: read trailing [%s] on mountpoint [%s]", con->http_chunk->buf, con->food.source->audiocast.mount);
-                con->http_chunk->finish = 0;
-                continue;
-              }
-              else
-              {
-                con->http_chunk->left = strtol(con->http_chunk->buf, (char **)NULL, 16);
-                con->http_chunk->off = 0;
-                con->http_chunk->finish = 1;
-                xa_debug (4, "DEBUG: add_chunk: http chunk left=%d on mountpoint [%s]", con->http_chunk->left, con->food.source->audiocast.mount);
-              }
-            }
-            else if (len > 0)
-            {
-              con->http_chunk->off += len;
-              len = -1;
-              break;
-            }
-            else
-              break;
-          }
+        len = recv(con->sock, buf, room, 0);
 
-          if (con->http_chunk->left < SOURCE_READSIZE)
-          {
-#ifdef HAVE_TLS
-            if(con->tls_socket)
-              len = tls_recv(con->tls_socket, con->food.source->chunk[con->food.source->cid].data + read_bytes, con->http_chunk->left - read_bytes);
-            else
-#endif
-            len = recv(con->sock, con->food.source->chunk[con->food.source->cid].data + read_bytes, con->http_chunk->left - read_bytes, 0);
-            maxread = con->http_chunk->left;
-          }
-          else
-          {
-#ifdef HAVE_TLS
-            if(con->tls_socket)
-              len = tls_recv(con->tls_socket, con->food.source->chunk[con->food.source->cid].data + read_bytes, SOURCE_READSIZE - read_bytes);
-            else
-#endif
-            len = recv(con->sock, con->food.source->chunk[con->food.source->cid].data + read_bytes, SOURCE_READSIZE - read_bytes, 0);
-          }
+        if (len <= 0 || con->trans_encoding != chunked_e)
           break;
-        }
-        else
+
+        /* Strip the chunked framing, only the payload stays in the ring */
+        len = ntrip_decode_http_chunk(con->http_chunk, buf, len);
+        xa_debug (5, "DEBUG: add_chunk: %d bytes of payload, http chunk left=%d, state %d on mountpoint [%s]", len,
+          con->http_chunk->left, con->http_chunk->state, source->audiocast.mount);
+
+        if (len < 0)
         {
-#ifdef HAVE_TLS
-          if(con->tls_socket)
-            len = tls_recv(con->tls_socket, con->food.source->chunk[con->food.source->cid].data + read_bytes, SOURCE_READSIZE - read_bytes);
-          else
-#endif
-          len = recv(con->sock, con->food.source->chunk[con->food.source->cid].data + read_bytes, SOURCE_READSIZE - read_bytes, 0);
-          xa_debug (5, "DEBUG: Source receive no-chunk %d bytes (want %d have %d) on mountpoint [%s]", len, SOURCE_READSIZE - read_bytes, read_bytes, con->food.source->audiocast.mount);
-          break;
+          thread_mutex_lock (&info.double_mutex);
+          kick_connection(con, "Invalid chunked transfer encoding");
+          thread_mutex_unlock (&info.double_mutex);
+          return -1;
         }
-      }
-      case rtp_e:
+      } while (len == 0 && con->http_chunk->state != chunk_done_e);
+
+      if (len > 0)
+        ring_commit(&source->ring, len);
+      break;
+    }
+    case rtp_e:
+    {
+      len = rtp_recieve_datagram_buffered(con);
+      if (len > 0)
       {
-        len = rtp_recieve_datagram_buffered(con);
-        if (len > 0)
-        {
-          source_fill_chunks(con->food.source, con->rtp->datagram->data, len);
-          maxread = 0;
-        }
-        break;
+        source_make_room(source, len);
+        ring_write(&source->ring, con->rtp->datagram->data, len);
       }
-      case udp_e:
-      {
-        time_t ct = time(0);
-        thread_mutex_lock(&con->udpbuffers->buffer_mutex);
+      break;
+    }
+    case udp_e:
+    {
+      time_t ct = time(0);
+      thread_mutex_lock(&con->udpbuffers->buffer_mutex);
 
-        if (con->udpbuffers && ct-con->udpbuffers->lastsend > 20)
-        {
-          sock_write_string_con(con, "");
-          con->udpbuffers->lastsend = ct;
-        }
-        if(con->udpbuffers->len)
-        {
-          len = SOURCE_READSIZE - read_bytes;
-          if(len > con->udpbuffers->len)
-            len = con->udpbuffers->len;
-          memcpy(con->food.source->chunk[con->food.source->cid].data + read_bytes,
-          con->udpbuffers->buffer, len);
-          con->udpbuffers->len -= len;
-          if(con->udpbuffers->len)
-          {
-            memmove(con->udpbuffers->buffer,
-            con->udpbuffers->buffer+len,con->udpbuffers->len);
-          }
-        }
-        thread_mutex_unlock(&con->udpbuffers->buffer_mutex);
-        break;
+      if (con->udpbuffers && ct-con->udpbuffers->lastsend > 20)
+      {
+        sock_write_string_con(con, "");
+        con->udpbuffers->lastsend = ct;
       }
-      default:
+      if(con->udpbuffers->len)
       {
-        len = recv(con->sock, con->food.source->chunk[con->food.source->cid].data + read_bytes, SOURCE_READSIZE - read_bytes, 0);
+        len = con->udpbuffers->len;
+        source_make_room(source, len);
+        ring_write(&source->ring, (char *)con->udpbuffers->buffer, len);
+        con->udpbuffers->len = 0;
       }
+      thread_mutex_unlock(&con->udpbuffers->buffer_mutex);
+      break;
+    }
+    default:
+    {
+      source_make_room(source, room);
+      buf = ring_space(&source->ring, &room);
+      len = recv(con->sock, buf, room, 0);
+      if (len > 0)
+        ring_commit(&source->ring, len);
     }
+  }
+
+  err = errno;
 
-    xa_debug (5, "DEBUG: Source received %d bytes on mountpoint [%s] in try %d, total %d, errno: %d (%s)", len, con->food.source->audiocast.mount, tries, read_bytes, errno, strerror(errno));
+  xa_debug (5, "DEBUG: Source received %d bytes on mountpoint [%s], errno: %d (%s)", len, source->audiocast.mount, err, strerror(err));
 
 #ifdef _WIN32
-    if(con->sock > 0)
-      sock_set_blocking(con->sock, SOCK_BLOCKNOT);
+  if(con->sock > 0)
+    sock_set_blocking(con->sock, SOCK_BLOCKNOT);
 #endif
 
-    if (con->food.source->connected == SOURCE_KILLED)
-      return;
+  if (source->connected == SOURCE_KILLED)
+    return -1;
 
-    if (len > 0)
+  if (len <= 0)
+  {
+    /* end of stream or reset, otherwise nothing left to read for now */
+    if ((len == 0 || (err != 0 && !is_recoverable(err))) && con->data_protocol != rtp_e && con->data_protocol != udp_e)
     {
-      stat_add_read(&con->food.source->stats, len);
-      stat_add_read(con->food.source->globalstats, len);
+      thread_mutex_lock (&info.double_mutex);
+      kick_connection(con, "Source died");
+      thread_mutex_unlock (&info.double_mutex);
+      return -1;
+    }
+    return 0;
+  }
 
-      internal_lock_mutex (&info.misc_mutex);
-      info.hourly_stats.read_bytes += len;
-      internal_unlock_mutex (&info.misc_mutex);
+  latency_stamp(&source->latency, source->ring.head, get_time_us());
 
-      read_bytes += len;
+  if (source->rtcm3)
+    rtcm3_scan(source->rtcm3, &source->ring);
 
-      if (read_bytes > SOURCE_READSIZE) { // rtsp
-        read_bytes = read_bytes % SOURCE_READSIZE;
-        if (read_bytes == 0) read_bytes = SOURCE_READSIZE;
-      }
-      len = 0;
-    }
-    else if (len == 0 || (read_bytes && tries))
-    {
-      break;
-    }
-    else
-    {
-      my_sleep(read_bytes ? source_read_sleep/10 : source_read_sleep);
-    }
+  if (source->recorder)
+    recorder_feed(source->recorder, &source->ring);
+
+  stat_add_read(&source->stats, len);
+  stat_add_read(source->globalstats, len);
+  traffic_add(source->traffic.read_bytes, len);
+
+#ifndef NTRIP_NUMBER
+  xa_debug (4, "DEBUG: add_chunk: Read [%d] bytes on mountpoint [%s], backlog now %llu - %llu", len, source->audiocast.mount, source->ring.tail, source->ring.head);
+#endif
+
+  return len;
+}
 
-    tries++;
-  } while ((read_bytes < maxread) && (tries < source_read_tries));
+/* Send payload to an NTRIP 2.0 client as part of an HTTP chunk. A new
+ * chunk covering all *plen bytes in the num segments of data is started
+ * when the previous one is done, and the hex length line, the payload and
+ * the trailing CRLF go out together in one writev(). What could not be
+ * sent is remembered in clicon->http_chunk and completed on the next call.
+ * Returns the number of payload bytes written, or -1 on error. *plen is
+ * cut down to what belongs to the current chunk, *partial is set when the
+ * socket did not accept everything. */
+static long int
+write_http_chunk(connection_t *clicon, struct iovec *data, int num, long int *plen, int *partial)
+{
+  http_chunk_t *hc = clicon->http_chunk;
+  struct iovec iov[4];
+  long int len = *plen, total = 0, n, head, payload;
+  int hlen, i, cnt = 0;
 
-  if (read_bytes == 0)
+  if (hc->left <= 0 && hc->finish <= 0)
   {
-    write_log(LOG_DEFAULT, "Didn't receive data from source after %d milliseconds, assuming it died...", tries * READ_RETRY_DELAY);
+    snprintf(hc->buf, sizeof(hc->buf), "%lX\r\n", len);
+    hc->off = 0;
+    hc->left = len;
+    hc->finish = 2;
+  }
 
-    thread_mutex_lock (&info.double_mutex);
-    kick_connection(con, "Source died");
-    thread_mutex_unlock (&info.double_mutex);
-    return;
+  hlen = strlen(hc->buf);
+  if (hc->off < hlen)
+  {
+    iov[cnt].iov_base = hc->buf + hc->off;
+    iov[cnt++].iov_len = hlen - hc->off;
+  }
+  if (len > hc->left)
+    len = *plen = hc->left;
+  for (i = 0, n = len; i < num && n > 0; i++)
+  {
+    iov[cnt] = data[i];
+    if ((long int)iov[cnt].iov_len > n)
+      iov[cnt].iov_len = n;
+    n -= iov[cnt++].iov_len;
+  }
+  if (hc->finish > 0 && len == hc->left)
+  {
+    iov[cnt].iov_base = (char *)"\r\n" + 2 - hc->finish;
+    iov[cnt++].iov_len = hc->finish;
   }
 
-#ifndef NTRIP_NUMBER
-  xa_debug (4, "DEBUG: add_chunk: Chunk %d was [%d] bytes on mountpoint [%s]", con->food.source->cid, read_bytes, con->food.source->audiocast.mount );
-#endif
+  for (i = 0; i < cnt; i++)
+    total += iov[i].iov_len;
 
-  con->food.source->chunk[con->food.source->cid].len = read_bytes;
-  con->food.source->chunk[con->food.source->cid].clients_left = con->food.source->num_clients;
-  con->food.source->cid = (con->food.source->cid + 1) % CHUNKLEN;
+  *partial = 0;
+  if (total <= 0)
+    return 0;
 
-  if (con->trans_encoding == chunked_e)
+  n = sock_writev_bytes(clicon->sock, iov, cnt);
+  if (n < 0)
+    return -1;
+  *partial = (n < total);
+
+  /* Account for what made it out, in frame order */
+  head = hlen - hc->off;
+  if (head > n)
+    head = n;
+  hc->off += head;
+  n -= head;
+
+  payload = (n < len) ? n : len;
+  hc->left -= payload;
+  n -= payload;
+
+  hc->finish -= n;
+
+  return payload;
+}
+
+/* The client needs bytes before limit which are gone. Unless the mount's
+ * lag policy is to kick it, move it ahead to the newest epoch or frame
+ * start (or the newest read without RTCM3 framing) at or after limit,
+ * failing that to the head of the backlog. Returns 0 if the client has to
+ * be kicked. The policy is looked up again after a rehash.
+ */
+static int
+source_skip_client (source_t *source, connection_t *clicon, unsigned long long limit)
+{
+  client_t *client = clicon->food.client;
+  ring_t *ring = client_ring (source, client);
+  unsigned long long pos;
+
+  if (source->config_generation != info.config_generation)
   {
-    con->http_chunk->left = con->http_chunk->left - read_bytes;
-    xa_debug (4, "DEBUG: add_chunk: http_chunk left now=%d ", con->http_chunk->left );
+    source->config_generation = info.config_generation;
+    source->lag_policy = source_lag_policy (source->audiocast.mount);
   }
+
+  if (source->lag_policy == lag_kick_e || source->lag_policy == lag_default_e)
+    return 0;
+
+  if (source->rtcm3 == NULL
+      || !rtcm3_skip_point (source->rtcm3, client->filter, ring, source->lag_policy == lag_epoch_e, limit, &pos))
+    pos = ring->last;
+
+  if (pos < limit || pos > ring->head)
+    pos = ring->head;
+
+  xa_debug (2, "DEBUG: Client %d on [%s] skipped %llu bytes ahead", clicon->id, source->audiocast.mount, pos - client->pos);
+
+  client->pos = pos;
+  client->skips++;
+
+  return 1;
 }
 
 void
 write_chunk(source_t *source, connection_t *clicon)
 {
-  int i = 0;
+  client_t *client = clicon->food.client;
+  ring_t *ring = client_ring(source, client);
+  int i = 0, err, partial;
   long int write_bytes = 0, len = 0;
+  struct iovec iov[2];
   char *buff;
 
-  if (clicon->food.client->alive == CLIENT_DEAD) return; // rtsp
+  if (client->alive == CLIENT_DEAD) return; // rtsp
 
-  /* Try to write 2 times */
-  for (i = 0; i < 2; i++)
+  /* Write until the client caught up with the source or its socket is full */
+  for (i = 0; !client->blocked; i++)
   {
-    if (source->cid == clicon->food.client->cid) return;
-
-    /* This is how much we should be writing to the client */
-    len = source->chunk[clicon->food.client->cid].len - clicon->food.client->offset;
-
-    xa_debug (5, "DEBUG: write_chunk(): Try: %d, writing chunk %d to client %d on mountpoint [%s], len(%d) - offset(%d) == %d", i, clicon->food.client->cid, clicon->id, source->audiocast.mount, source->chunk[clicon->food.client->cid].len, clicon->food.client->offset, len);
+    if (client->pos < ring->tail && !source_skip_client(source, clicon, ring->tail))
+    {
+      kick_connection(clicon, "Too many errors (client not receiving data fast enough)");
+      break;
+    }
 
-    if (len < 0 || source->chunk[clicon->food.client->cid].len == 0)
+    /* This is how much we can write to the client in one piece,
+     * cached station messages go out before the stream */
+    if (client->prime != NULL)
     {
-#ifndef NTRIP_NUMBER
-      xa_debug (5, "DEBUG: write_chunk: Empty chunk [%d] [%d]", source->chunk[clicon->food.client->cid].len,
-          clicon->food.client->offset );
-#endif
-      source->chunk[clicon->food.client->cid].clients_left--;
-      clicon->food.client->cid = (clicon->food.client->cid + 1) % CHUNKLEN;
-      clicon->food.client->offset = 0;
-      continue; /* Perhaps for some reason the source read a zero sized chunk but the next one is ok.. */
+      buff = client->prime + client->prime_off;
+      len = client->prime_len - client->prime_off;
     }
+    else
+      len = ring_data(ring, client->pos, &buff);
+    partial = 0;
+
+    xa_debug (5, "DEBUG: write_chunk(): Try: %d, writing %ld bytes at %llu to client %d on mountpoint [%s]", i, len, client->pos, clicon->id, source->audiocast.mount);
 
-    buff = &source->chunk[clicon->food.client->cid].data[clicon->food.client->offset];
+    /* An HTTP chunk may still wait for its trailing CRLF */
+    if (len <= 0 && !(clicon->trans_encoding == chunked_e && clicon->http_chunk->finish > 0 && clicon->http_chunk->left <= 0))
+      break;
 
     switch (clicon->data_protocol)
     {
       case tcp_e:
       {
-        if (clicon->trans_encoding == chunked_e)
+        if (clicon->sock <= 0)
         {
-          if (clicon->http_chunk->left <= 0)
-          {
-            snprintf(clicon->http_chunk->buf, 20, "%X\r\n", source->chunk[clicon->food.client->cid].len);
-
-            write_bytes = sock_write_bytes_con(clicon, clicon->http_chunk->buf, strlen(clicon->http_chunk->buf)); // rtsp
-
-            if (write_bytes > 0)
-              clicon->http_chunk->left = source->chunk[clicon->food.client->cid].len;
-            else break;
-          }
           write_bytes = sock_write_bytes_con(clicon, buff, len);
           break;
         }
+
+        /* Catch up with everything pending in one syscall, including
+         * the part that wrapped around to the start of the ring */
+        iov[0].iov_base = buff;
+        iov[0].iov_len = len;
+        iov[1].iov_len = (len > 0 && client->prime == NULL) ? ring_data(ring, client->pos + len, &buff) : 0;
+        iov[1].iov_base = buff;
+        len += iov[1].iov_len;
+
+        if (clicon->trans_encoding == chunked_e)
+          write_bytes = write_http_chunk(clicon, iov, 2, &len, &partial);
         else
         {
-          write_bytes = sock_write_bytes_con(clicon, buff, len);
-          break;
+          write_bytes = sock_writev_bytes(clicon->sock, iov, 2);
+          partial = (write_bytes < len);
         }
+        break;
       }
       case rtp_e:
       {
+        if (len > (long int)sizeof(clicon->rtp->datagram->data))
+          len = sizeof(clicon->rtp->datagram->data);
+
         rtp_prepare_send(clicon->rtp);
 
         memcpy(clicon->rtp->datagram->data, buff, len);
@@ -785,8 +1232,10 @@ write_chunk(source_t *source, connection_t *clicon)
       }
     }
 
+    err = errno;
+
 #ifndef NTRIP_NUMBER
-    xa_debug (4, "DEBUG: client %d in write_chunk() on mountpoint [%s]. %d of %d bytes written, client on chunk %d (+%d), source on chunk %d", clicon->id, source->audiocast.mount, write_bytes, source->chunk[clicon->food.client->cid].len - clicon->food.client->offset, clicon->food.client->cid, clicon->food.client->offset, source->cid);
+    xa_debug (4, "DEBUG: client %d in write_chunk() on mountpoint [%s]. %d of %d bytes written, client at %llu, source at %llu", clicon->id, source->audiocast.mount, write_bytes, len, client->pos, ring->head);
 #endif
 
     if (clicon->udpbuffers && time(0)-clicon->udpbuffers->lastactive > 60)
@@ -794,84 +1243,110 @@ write_chunk(source_t *source, connection_t *clicon)
       kick_connection(clicon, "UDP connection timeout");
       break;
     }
+    else if (write_bytes < 0 && clicon->sock > 0 && is_recoverable(err))
+    {
+      /* continue when the socket is writable again */
+      client->blocked = 1;
+      event_rearm(source->events, clicon->sock, EVENT_WRITE);
+      break;
+    }
     else if (write_bytes < 0)
     {
 #ifndef NTRIP_NUMBER
-      xa_debug (5, "DEBUG: client: [%2d] errors: [%3d]", clicon->id, client_errors (clicon->food.client));
+      xa_debug (5, "DEBUG: client: [%2d] lag: [%3d]", clicon->id, client_errors (client));
 #endif
       kick_connection(clicon, "Broken connection");
       break;
     }
-    else if (write_bytes > 0)
+    else
     {
-      clicon->food.client->write_bytes += write_bytes;
-      stat_add_write (&source->stats, write_bytes);
-      stat_add_write (source->globalstats, write_bytes);
-
-      internal_lock_mutex (&info.misc_mutex);
-      info.hourly_stats.write_bytes += write_bytes;
-      internal_unlock_mutex (&info.misc_mutex);
-
-      if (write_bytes + clicon->food.client->offset >= source->chunk[clicon->food.client->cid].len)
+      if (write_bytes > 0)
       {
-        source->chunk[clicon->food.client->cid].clients_left--;
-        clicon->food.client->cid = (clicon->food.client->cid + 1) % CHUNKLEN;
-        clicon->food.client->offset = 0;
-
-        if (clicon->trans_encoding == chunked_e)
+        client->write_bytes += write_bytes;
+        if (client->prime != NULL)
         {
-          sock_write_bytes_con(clicon, "\r\n", 2);
-          clicon->http_chunk->left = 0;
+          client->prime_off += write_bytes;
+          if (client->prime_off >= client->prime_len)
+          {
+            nfree (client->prime);
+          }
         }
+        else
+        {
+          /* filtered streams and replays don't use source offsets */
+          if (client->filter == NULL && client->replay.segment == NULL)
+            latency_record (&source->latency, client->pos, get_time_us ());
+          client->pos += write_bytes;
+        }
+        stat_add_write (&source->stats, write_bytes);
+        /* replays count for the mountpoint they play back, in counters
+         * of their own since its source thread writes the others */
+        if (client->replay.stats)
+          traffic_add (client->replay.stats->replay_write_bytes, write_bytes);
+        else
+          stat_add_write (source->globalstats, write_bytes);
+        traffic_add (source->traffic.write_bytes, write_bytes);
       }
-      else
+
+      if (write_bytes < len || partial)
       {
-        clicon->food.client->offset += write_bytes;
 #ifndef NTRIP_NUMBER
-        xa_debug (5, "DEBUG: client %d only read %d of %d bytes", clicon->id, write_bytes, source->chunk[clicon->food.client->cid].len - clicon->food.client->offset);
+        xa_debug (5, "DEBUG: client %d only read %d of %d bytes", clicon->id, write_bytes, len);
 #endif
+        if (clicon->sock > 0)
+        {
+          client->blocked = 1;
+          event_rearm(source->events, clicon->sock, EVENT_WRITE);
+        }
+        break;
       }
     }
   }
 
-  clicon->food.client->errors = client_errors(clicon->food.client);
-
-  xa_debug (4, "DEBUG: client %d tried %d times, now has %d errors %d chunks behind source", clicon->id, i, clicon->food.client->errors, source->cid < clicon->food.client->cid ? source->cid+CHUNKLEN - clicon->food.client->cid : source->cid - clicon->food.client->cid);
+  xa_debug (4, "DEBUG: client %d tried %d times, now %d bytes behind source", clicon->id, i, client_errors (client));
 }
 
-void kick_trailing_clients(source_t *source) {
-#ifndef NTRIP_NUMBER
-  xa_debug (2, "DEBUG: Kicking trailing clients [%d] on id %d", source->chunk[source->cid].clients_left, source->cid);
-#endif
-  kick_clients_on_cid (source);
-}
-
-void kick_clients_on_cid(source_t *source) {
+/* Make sure len more bytes fit into the client backlog. Clients which
+ * still need the bytes that get overwritten are skipped ahead or kicked,
+ * depending on the lag policy of the mount. The watermark
+ * tells whether anybody is that far behind without looking at each client.
+ */
+void
+source_make_room (source_t *source, unsigned long len)
+{
   avl_traverser trav = {0};
   connection_t *clicon;
+  unsigned long long lost, low;
 
-  unsigned int max = avl_count (source->clients) * avl_count (source->clients) + 2;
+  if (source->ring.head + len <= source->ring.size)
+    return;
 
-  xa_debug (3, "Clearing cid %d", source->cid);
+  lost = source->ring.head + len - source->ring.size;
 
-  zero_trav (&trav);
+  if (lost <= source->ring.low)
+    return;
 
-#if !defined(NTRIP_FIGURE) || !defined(NTRIP_NUMBER)
-  xa_debug (5, "DEBUG: In function kick_clients_on_cid. Source has %d clients", max);
-#endif
-  while (max >= 0) {
-    clicon = avl_traverse (source->clients, &trav);
-    if (!clicon) break;
+  low = source->ring.head + len;
+
+  while ((clicon = avl_traverse (source->clients, &trav)) != NULL) {
+    client_t *client = clicon->food.client;
+
+    /* clients of a filtered stream are checked in write_chunk() */
+    if (client->alive == CLIENT_DEAD || client->virgin != 0 || client->filter != NULL)
+      continue;
 
-    if (clicon->food.client->errors >= (CHUNKLEN - 1) && clicon->food.client->alive != CLIENT_DEAD) {
+    if (client->pos < lost && !source_skip_client (source, clicon, lost))
+    {
       kick_connection (clicon, "Too many errors (client not receiving data fast enough)");
+      continue;
     }
-    max--;
+
+    /* skipped clients count with their new position */
+    if (client->pos < low)
+      low = client->pos;
   }
-  source->chunk[source->cid].clients_left = 0;
-#if !defined(NTRIP_FIGURE) || !defined(NTRIP_NUMBER)
-  xa_debug (5, "DEBUG: leaving function kick_clients_on_cid");
-#endif
+
+  source->ring.low = low;
 }
 
 /*
@@ -909,26 +1384,20 @@ kick_dead_clients(source_t *source)
 connection_t *
 get_source_with_mount (const char *mount)
 {
-  avl_traverser trav = {0};
   connection_t *travcon;
-  char* alias;
+  char buf[BUFSIZE];
 
   thread_mutex_lock (&info.source_mutex);
 
-  while ((travcon = avl_traverse (info.sources, &trav)))
+  travcon = mount_index_find (mount);
+  if (!travcon && mount[0] != '/')
   {
-    if (! (alias = strchr (travcon->food.source->audiocast.mount, '/')))
-      alias = travcon->food.source->audiocast.mount;
-    if ((ntripcaster_strcmp (alias, mount) == 0) ||
-        ((mount[0] != '/') && (ntripcaster_strcmp (&mount[0], &alias[1]) == 0)))
-    {
-      thread_mutex_unlock (&info.source_mutex);
-      return travcon;
-    }
+    snprintf (buf, BUFSIZE, "/%s", mount);
+    travcon = mount_index_find (buf);
   }
 
   thread_mutex_unlock (&info.source_mutex);
-  return NULL;
+  return travcon;
 }
 
 connection_t *
@@ -987,6 +1456,22 @@ describe_source (const com_request_t *req, const connection_t *sourcecon)
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "Client connect time: %s", nntripcaster_time_minutes (source->stats.client_connect_time, buf));
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "Average client connect time: %s", connect_average (source->stats.client_connect_time, source->stats.client_connections, buf));
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "Average client transfer: %lu", transfer_average (source->stats.write_kilos, source->stats.client_connections));
+  if (source->rtcm3)
+  {
+    admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "RTCM3 frames: %lu", source->rtcm3->num_frames);
+    admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "RTCM3 CRC errors: %lu", source->rtcm3->crc_errors);
+    admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "RTCM3 resyncs: %lu", source->rtcm3->resyncs);
+    admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "RTCM3 bytes discarded: %llu", source->rtcm3->discarded);
+  }
+  if (source->recorder)
+  {
+    unsigned long long written, lost;
+
+    recorder_stats (source->recorder, &written, &lost);
+    admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "Recorded: %llu bytes, %llu bytes lost", written, lost);
+  }
+  admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_MISC, "Epoch cadence: %ld ms, %lu stalls%s", source->cadence, source->stalls,
+                    source->stalled ? " (stalled)" : "");
 
   admin_write_line (req, ADMIN_SHOW_DESCRIBE_SOURCE_END, "End of source info");
 }
@@ -997,17 +1482,414 @@ const char *source_type(const connection_t *con) {
   return source_types[con->food.source->type+1];
 }
 
+/* The backlog the client reads from, the filtered one for virtual mounts */
+ring_t *
+client_ring (source_t *source, const client_t *client)
+{
+  if (client->filter != NULL && client->filter->shared)
+    return &client->filter->ring;
+
+  /* the view of the recording is part of the client */
+  if (client->replay.segment != NULL)
+    return (ring_t *)&client->replay.ring;
+
+  return &source->ring;
+}
+
 /* What we want to do here is give the client the best possible
- * chunk in the source to start from. Where he suffers the least
+ * position in the source to start from. Where he suffers the least
  * from both his own slow network connection, and discrepanices
- * in the source feed. I used to set this to the chunk where the
- * source was, minus one, but I think it's better to find a place
- * in the middle somewhere. I leave this for later testing though.
+ * in the source feed. For now this is the start of the last block
+ * read from the source, or of the last complete RTCM3 frame when the
+ * mountpoint is parsed.
  */
-int
-start_chunk (source_t *source)
+unsigned long long
+start_position (source_t *source)
+{
+  unsigned long long pos;
+
+  if (source->rtcm3 && rtcm3_last_frame (source->rtcm3, &source->ring, &pos))
+    return pos;
+
+  return source->ring.last > source->ring.tail ? source->ring.last : source->ring.tail;
+}
+
+/* Stall detection. Sources send epochs of data at a steady rate, 1 Hz or
+ * 10 Hz usually, so a source stalls when it misses stall_epochs of them.
+ * The cadence is learned from the gaps between bursts of reads: the
+ * longest of the first few, then it moves halfway up to a longer gap and
+ * slowly down to shorter ones, so epochs which come in several bursts
+ * don't make it look faster than it is. No timer is needed, the source
+ * thread sleeps until data comes or the stall is due. Without any gap
+ * seen yet (data coming steadily or not yet) the source stalls after
+ * stall_timeout milliseconds, a slower stream stalls once and is then
+ * given the time of its longest gap so far.
+ */
+
+/* Data came from source at now */
+static void
+source_arrival (source_t *source, long long now)
+{
+  long long gap = now - source->last_data;
+
+  /* a gap which ended a stall still counts while learning, the stream
+     may be slower than stall_timeout, or later if it was short, the
+     stream may have slowed down */
+  if (gap >= STALL_BURST_GAP && gap < STALL_MAX_CADENCE
+      && (!source->stalled || source->gaps < STALL_LEARN_GAPS
+          || gap < info.stall_timeout))
+  {
+    if (source->gaps < STALL_LEARN_GAPS)
+    {
+      if (gap > source->cadence)
+        source->cadence = gap;
+      source->gaps++;
+    }
+    else if (gap > source->cadence)
+      source->cadence += (gap - source->cadence) / 2;
+    else
+      source->cadence -= (source->cadence - gap) / 16;
+  }
+
+  source->last_data = now;
+
+  if (source->stalled)
+    source_unstall (source);
+}
+
+/* Milliseconds without data after which source stalls, 0 for never */
+static int
+source_stall_timeout (const source_t *source)
+{
+  long timeout;
+
+  if (source->gaps == 0 || info.stall_epochs <= 0)
+    return info.stall_timeout;
+
+  timeout = source->cadence * info.stall_epochs + source->cadence / 2;
+
+  /* while learning, never less than the fixed timeout */
+  if (source->gaps < STALL_LEARN_GAPS
+      && (info.stall_timeout <= 0 || timeout < info.stall_timeout))
+    return info.stall_timeout;
+
+  return timeout < STALL_MIN_TIMEOUT ? STALL_MIN_TIMEOUT : (int)timeout;
+}
+
+/* source sent nothing for quiet milliseconds. Count the stall, and move
+ * the clients to the twin if there is one. */
+static void
+source_stall (source_t *source, long long quiet)
+{
+  thread_mutex_lock (&info.source_mutex);
+
+  if (!source->stalled)
+  {
+    source->stalled = 1;
+    source->stall_pos = source->ring.head;
+    source->stalls++;
+    write_log (LOG_DEFAULT, "Mountpoint %s stalled, no data for %lld milliseconds (cadence %ld ms)",
+               source->audiocast.mount, quiet, source->cadence);
+  }
+
+  source_failover (source);
+
+  thread_mutex_unlock (&info.source_mutex);
+}
+
+/* Twin mounts. Clients of a mount with a "twin=" setting are handed over
+ * to the twin when the source goes away or stalls. The client keeps its
+ * socket, the twin starts it like a new client and sends it back once the
+ * home mount has data again. Moving clients needs the source mutex, so
+ * the twin can't go away meanwhile.
+ */
+
+/* The twin of source if it can take clients, or NULL.
+ * Must have source mutex to call this. */
+connection_t *
+get_twin_mount_wl (source_t *source)
+{
+  connection_t *twincon;
+
+  if (source->twin == NULL || (twincon = mount_index_find (source->twin)) == NULL)
+    return NULL;
+
+  if (twincon->food.source == source || twincon->food.source->connected != SOURCE_CONNECTED
+      || twincon->food.source->stalled)
+    return NULL;
+
+  return twincon;
+}
+
+connection_t *
+get_twin_mount (source_t *source)
+{
+  connection_t *twincon;
+
+  thread_mutex_lock (&info.source_mutex);
+  twincon = get_twin_mount_wl (source);
+  thread_mutex_unlock (&info.source_mutex);
+
+  return twincon;
+}
+
+/* Hand clicon from source over to the source of tocon, which starts it
+ * like a new client. Called by the thread of source, which must have the
+ * source mutex. */
+static void
+source_move_client (source_t *source, connection_t *clicon, connection_t *tocon)
+{
+  client_t *client = clicon->food.client;
+  source_t *to = tocon->food.source;
+
+  xa_debug (2, "DEBUG: Moving client %d from [%s] to [%s]", clicon->id, source->audiocast.mount, to->audiocast.mount);
+
+  avl_delete (source->clients, clicon);
+  event_del (source->events, clicon->sock);
+  del_client (clicon, source);
+
+  /* shared filters belong to the old source */
+  if (client->filter != NULL && client->filter->shared) {
+    rtcm3_filter_t *filter = client->filter;
+
+    client->filter = rtcm3_filter_copy (filter);
+    rtcm3_filter_release (source->rtcm3, filter);
+  }
+
+  /* unless already on the way, the new source sends its own station messages */
+  if (client->prime != NULL && client->prime_off == 0) {
+    nfree (client->prime);
+  }
+  if (client->prime == NULL)
+    client->prime_off = 0;
+
+  client->virgin = 1;
+  client->blocked = 0;
+  client->source = to;
+  pool_add (clicon);
+  util_increase_total_clients ();
+}
+
+/* Is there room for one more client on the source of tocon within
+ * max_clients_per_source. Moved clients count for their new source only
+ * once it started them, so the ones in to[0..num) are added. */
+static int
+source_has_room (connection_t *tocon, connection_t **to, int num)
+{
+  unsigned long clients = tocon->food.source->num_clients;
+  int i;
+
+  for (i = 0; i < num; i++)
+    if (to[i] == tocon)
+      clients++;
+
+  return clients < info.max_clients_per_source;
+}
+
+/* Hand clicon from source over to its twin, or back home from the twin.
+ * Called by the thread of source, which must have the source mutex. */
+void
+move_to_twin (source_t *source, connection_t *clicon, connection_t *twincon)
+{
+  client_t *client = clicon->food.client;
+
+  /* remember where the client belongs, forget it when it is back there */
+  if (client->home == NULL)
+    client->home = nstrdup (source->audiocast.mount);
+  else if (ntripcaster_strcmp (client->home, twincon->food.source->audiocast.mount) == 0) {
+    nfree (client->home);
+  }
+
+  source_move_client (source, clicon, twincon);
+}
+
+/* The clients of source go to its twin, if that is there, clients of a
+ * "nearest" mount to the next closest base. The ones no source has room
+ * for stay. Must have source mutex to call this. */
+static void
+source_failover (source_t *source)
+{
+  avl_traverser trav = {0};
+  connection_t *clicon, *twincon, *tocon, **move, **to;
+  nearest_t *near;
+  int i, num = 0, twins = 0, nears = 0, full = 0;
+
+  if (avl_count (source->clients) == 0)
+    return;
+
+  twincon = get_twin_mount_wl (source);
+
+  /* can't move them out of the tree while walking it */
+  move = (connection_t **)nmalloc (avl_count (source->clients) * sizeof (connection_t *));
+  to = (connection_t **)nmalloc (avl_count (source->clients) * sizeof (connection_t *));
+
+  while ((clicon = avl_traverse (source->clients, &trav)) != NULL)
+    if (clicon->food.client->alive != CLIENT_DEAD && clicon->food.client->virgin != -1
+        && (twincon != NULL || clicon->food.client->near != NULL))
+      move[num++] = clicon;
+
+  for (i = 0; i < num; i++) {
+    near = move[i]->food.client->near;
+    to[i] = NULL;
+    if (near != NULL && (tocon = nearest_base_wl (move[i], near->lat, near->lon, NULL, source)) != NULL
+        && source_has_room (tocon, to, i)) {
+      to[i] = tocon;
+      source_move_client (source, move[i], tocon);
+      nears++;
+    } else if (twincon != NULL && source_has_room (twincon, to, i)) {
+      to[i] = twincon;
+      move_to_twin (source, move[i], twincon);
+      twins++;
+    } else if (twincon != NULL)
+      full++;
+  }
+
+  nfree (move);
+  nfree (to);
+
+  if (twins > 0)
+    write_log (LOG_DEFAULT, "Moved %d clients from mountpoint %s to its twin %s", twins, source->audiocast.mount, twincon->food.source->audiocast.mount);
+  if (full > 0)
+    write_log (LOG_DEFAULT, "WARNING: %d clients stay on mountpoint %s, its twin %s is full", full, source->audiocast.mount, twincon->food.source->audiocast.mount);
+  if (nears > 0)
+    write_log (LOG_DEFAULT, "Moved %d clients from mountpoint %s to the next nearest bases", nears, source->audiocast.mount);
+}
+
+/* Can the client change the source without losing a frame: it is not
+ * started yet, or it has everything and the stream ends on a frame */
+static int
+source_client_on_boundary (source_t *source, const client_t *client)
+{
+  if (client->virgin == 1)
+    return 1;
+
+  if (client->virgin != 0 || client->blocked || client->prime != NULL
+      || client->pos != client_ring (source, client)->head)
+    return 0;
+
+  return client->filter != NULL || source->rtcm3 == NULL || source->rtcm3->frame_end == source->ring.head;
+}
+
+/* A twin of source has data again, send the clients which belong there
+ * home. The ones in the middle of a frame follow on a later call, the
+ * ones their home has no room for stay. */
+static void
+source_send_home (source_t *source)
 {
-  return source->cid > 0 ? source->cid - 1 : CHUNKLEN - 1;
+  avl_traverser trav = {0};
+  connection_t *clicon, *homecon, **move, **to;
+  int i, num = 0, later = 0;
+
+  thread_mutex_lock (&info.source_mutex);
+
+  source->twin_return = 0;
+
+  move = (connection_t **)nmalloc ((avl_count (source->clients) + 1) * sizeof (connection_t *));
+  to = (connection_t **)nmalloc ((avl_count (source->clients) + 1) * sizeof (connection_t *));
+
+  while ((clicon = avl_traverse (source->clients, &trav)) != NULL) {
+    client_t *client = clicon->food.client;
+
+    if (client->home == NULL || client->alive == CLIENT_DEAD)
+      continue;
+
+    homecon = mount_index_find (client->home);
+    if (homecon == NULL || homecon->food.source == source
+        || homecon->food.source->connected != SOURCE_CONNECTED || homecon->food.source->stalled
+        || !source_has_room (homecon, to, num))
+      continue;
+
+    if (source_client_on_boundary (source, client)) {
+      move[num] = clicon;
+      to[num++] = homecon;
+    } else
+      later = 1;
+  }
+
+  for (i = 0; i < num; i++)
+    move_to_twin (source, move[i], to[i]);
+
+  source->twin_return = later;
+
+  thread_mutex_unlock (&info.source_mutex);
+
+  nfree (move);
+  nfree (to);
+
+  if (num > 0)
+    write_log (LOG_DEFAULT, "Sent %d clients on mountpoint %s back home", num, source->audiocast.mount);
+}
+
+/* Clients of a "nearest" mount sent new positions, move the ones another
+ * base is closer to now. The ones in the middle of a frame follow on a
+ * later call. */
+static void
+source_route_nearest (source_t *source)
+{
+  avl_traverser trav = {0};
+  connection_t *clicon, **move, **to;
+  nearest_t *near;
+  int i, num = 0, later = 0;
+
+  thread_mutex_lock (&info.source_mutex);
+
+  move = (connection_t **)nmalloc ((avl_count (source->clients) + 1) * sizeof (connection_t *));
+  to = (connection_t **)nmalloc ((avl_count (source->clients) + 1) * sizeof (connection_t *));
+
+  while ((clicon = avl_traverse (source->clients, &trav)) != NULL) {
+    near = clicon->food.client->near;
+    if (near == NULL || !near->moved || clicon->food.client->alive == CLIENT_DEAD)
+      continue;
+
+    near->generation = info.sourcetable.generation;
+    if ((to[num] = nearest_base_wl (clicon, near->lat, near->lon, source, NULL)) == NULL
+        || !source_has_room (to[num], to, num))
+      near->moved = 0;
+    else if (source_client_on_boundary (source, clicon->food.client)) {
+      near->moved = 0;
+      move[num++] = clicon;
+    } else
+      later = 1;
+  }
+
+  for (i = 0; i < num; i++) {
+    write_log (LOG_DEFAULT, "Moving client %d from mountpoint %s to the nearer base %s", move[i]->id, source->audiocast.mount, to[i]->food.source->audiocast.mount);
+    source_move_client (source, move[i], to[i]);
+  }
+
+  source->near_check = later;
+
+  thread_mutex_unlock (&info.source_mutex);
+
+  nfree (move);
+  nfree (to);
+}
+
+/* source has new data after a stall, or its first data. Once the newest
+ * frame came after the stall (or right away without RTCM3 framing), the
+ * twin sends the clients back. */
+static void
+source_unstall (source_t *source)
+{
+  connection_t *twincon;
+  unsigned long long pos;
+
+  if (source->rtcm3 != NULL
+      && (!rtcm3_last_frame (source->rtcm3, &source->ring, &pos) || pos < source->stall_pos))
+    return;
+
+  thread_mutex_lock (&info.source_mutex);
+
+  source->stalled = 0;
+  xa_debug (1, "DEBUG: Mountpoint [%s] has data again", source->audiocast.mount);
+
+  if (source->twin != NULL && (twincon = mount_index_find (source->twin)) != NULL
+      && twincon->food.source != source) {
+    twincon->food.source->twin_return = 1;
+    source_wake (twincon->food.source);
+  }
+
+  thread_mutex_unlock (&info.source_mutex);
 }
 
 void
@@ -1027,49 +1909,99 @@ source_write_to_client (source_t *source, connection_t *clicon)
   if (client->virgin == -1) return; // rtsp
 
   if (client->alive == CLIENT_PAUSED) { // rtsp
-    source->chunk[clicon->food.client->cid].clients_left--;
-    clicon->food.client->cid = (clicon->food.client->cid + 1) % CHUNKLEN;
-    clicon->food.client->offset = 0;
+    client->pos = source->ring.head;
     return;
   }
 
+  /* replays start where replay_client_start () put them */
+  if (client->virgin == 1 && client->replay.segment != NULL) {
+    client->virgin = 0;
+    thread_mutex_lock(&info.source_mutex);
+    source->num_clients++;
+    thread_mutex_unlock(&info.source_mutex);
+  }
+
+  if (client->virgin == 1 && client->filter != NULL) {
+    unsigned long long srcpos;
+
+    if (source->rtcm3 == NULL) {
+      rtcm3_filter_free (client->filter);
+      client->filter = NULL;
+      kick_connection (clicon, "Message filter needs an RTCM3 mountpoint");
+      return;
+    }
+
+    /* from now on client->filter is shared with the other clients */
+    client->filter = rtcm3_filter_share (source->rtcm3, client->filter, source->ring.size);
+    if (client->filter == NULL) {
+      kick_connection (clicon, "No memory for filtered client backlog");
+      return;
+    }
+
+    srcpos = rtcm3_filter_start (source->rtcm3, client->filter, &client->pos);
+    if (client->prime == NULL)
+      client->prime = rtcm3_station_messages (source->rtcm3, srcpos, client->filter, &client->prime_len);
+    client->virgin = 0;
+    thread_mutex_lock(&info.source_mutex);
+    source->num_clients++;
+    thread_mutex_unlock(&info.source_mutex);
+  }
+
   if (client->virgin == 1) {
-    client->cid = start_chunk (source);
-    client->offset = 0; // rtsp. ajd
+    client->pos = start_position (source);
+    if (client->pos < source->ring.low)
+      source->ring.low = client->pos;
     client->virgin = 0;
+    if (source->rtcm3 && client->prime == NULL)
+      client->prime = rtcm3_station_messages (source->rtcm3, client->pos, NULL, &client->prime_len);
     thread_mutex_lock(&info.source_mutex);
     source->num_clients++;
     thread_mutex_unlock(&info.source_mutex);
   }
 
   if (client->alive == CLIENT_UNPAUSED) {
-    client->cid = start_chunk (source);
-    client->offset = 0;
+    client->pos = start_position (source);
+    if (client->pos < source->ring.low)
+      source->ring.low = client->pos;
     client->virgin = 0;
 
     if (clicon->trans_encoding == chunked_e) { // rtsp
       clicon->http_chunk->left = 0;
       clicon->http_chunk->off = 0;
+      clicon->http_chunk->finish = 0;
     }
 
     client->alive = CLIENT_ALIVE;
   }
 
   write_chunk (source, clicon);
+
+  /* a "nearest" client may have sent a new position meanwhile */
+  if (client->near != NULL && client->alive != CLIENT_DEAD && nearest_read (clicon))
+    source->near_check = 1;
 }
 
 void
 source_get_new_clients (source_t *source)
 {
-  connection_t *clicon;
+  connection_t *clicon, *next;
 
-  while ((clicon = pool_get_my_clients (source)))
+  for (clicon = pool_get_my_clients (source); clicon; clicon = next)
   {
+    next = clicon->food.client->next_new;
+    clicon->food.client->next_new = NULL;
     xa_debug (1, "DEBUG: source_get_new_clients(): Accepted client %d", clicon->id);
     avl_insert (source->clients, clicon);
 
+    clicon->food.client->blocked = 0;
+    if (clicon->sock > 0)
+      event_add (source->events, clicon->sock, EVENT_WRITE, clicon);
+
     source->stats.client_connections++;
-    source->globalstats->client_connections++;
+    if (clicon->food.client->replay.stats)
+      traffic_add (clicon->food.client->replay.stats->replay_clients, 1);
+    else
+      source->globalstats->client_connections++;
   }
 }
 
@@ -1123,20 +2055,260 @@ void add_nontrip_source(char *line) {
   }
 }
 
-int source_fill_chunks(source_t *source, const char *buf, int len) {
-  int p = 0;
+static void free_mount_settings(mountsettings_t *ms, void *param) {
+  nfree(ms->mount);
+  if (ms->source) {
+    nfree(ms->source);
+  }
+  if (ms->types) {
+    nfree(ms->types);
+  }
+  if (ms->twin) {
+    nfree(ms->twin);
+  }
+  nfree(ms);
+}
+
+/* Parse a "mountpoint /MOUNT setting=value ..." line of the config file
+ * into settings, the tree of the config file being read. Settings given
+ * on several lines for the same mount are merged. */
+void add_mount_settings(avl_tree *settings, char *line) {
+  char mount[BUFSIZE];
+  char opt[BUFSIZE];
+  mountsettings_t *ms, search;
+
+  if (splitc(mount, line, ' ') == NULL) return;
 
-  while (len > SOURCE_READSIZE) {
-    if (source->chunk[source->cid].clients_left > 0) kick_trailing_clients(source);
-    memcpy(source->chunk[source->cid].data, buf + p, SOURCE_READSIZE);
-    source->chunk[source->cid].len = SOURCE_READSIZE;
-    source->chunk[source->cid].clients_left = source->num_clients;
-    source->cid = (source->cid + 1) % CHUNKLEN;
-    len -= SOURCE_READSIZE;
-    p += SOURCE_READSIZE;
+  search.mount = mount;
+
+  ms = avl_find(settings, &search);
+  if (ms == NULL) {
+    ms = (mountsettings_t *) nmalloc (sizeof (mountsettings_t));
+    memset(ms, 0, sizeof (mountsettings_t));
+    ms->mount = my_strdup(mount);
+    avl_insert(settings, ms);
   }
 
-  memcpy(source->chunk[source->cid].data, buf + p, len);
+  while (line[0]) {
+    if (splitc(opt, line, ' ') == NULL) {
+      strncpy(opt, line, BUFSIZE);
+      opt[BUFSIZE-1] = 0;
+      line[0] = 0;
+    }
 
-  return len;
+    if (!opt[0])
+      continue;
+
+    if (ntripcaster_strncmp(opt, "buffer_size=", 12) == 0)
+      ms->buffer_size = atol(opt + 12);
+    else if (ntripcaster_strcmp(opt, "format=rtcm3") == 0)
+      ms->rtcm3 = 1;
+    else if (ntripcaster_strcmp(opt, "format=raw") == 0)
+      ms->rtcm3 = 0;
+    else if (ntripcaster_strcmp(opt, "record=hourly") == 0)
+      ms->record = RECORD_HOURLY;
+    else if (ntripcaster_strcmp(opt, "record=daily") == 0)
+      ms->record = RECORD_DAILY;
+    else if (ntripcaster_strcmp(opt, "record=off") == 0)
+      ms->record = 0;
+    else if (ntripcaster_strncmp(opt, "lag=", 4) == 0) {
+      ms->lag_policy = source_parse_lag_policy(opt + 4);
+      if (ms->lag_policy == lag_default_e)
+        write_log(LOG_DEFAULT, "WARNING: Invalid lag policy %s for mountpoint %s", opt + 4, mount);
+    }
+    else if (ntripcaster_strncmp(opt, "source=", 7) == 0) {
+      if (ms->source) {
+        nfree(ms->source);
+      }
+      ms->source = opt[7] == '/' ? my_strdup(opt + 7) : NULL;
+      if (!ms->source)
+        write_log(LOG_DEFAULT, "WARNING: Invalid source %s for mountpoint %s", opt + 7, mount);
+    }
+    else if (ntripcaster_strncmp(opt, "twin=", 5) == 0) {
+      if (ms->twin) {
+        nfree(ms->twin);
+      }
+      ms->twin = (opt[5] == '/' && ntripcaster_strcmp(opt + 5, mount) != 0) ? my_strdup(opt + 5) : NULL;
+      if (!ms->twin && ntripcaster_strcmp(opt + 5, "none") != 0)
+        write_log(LOG_DEFAULT, "WARNING: Invalid twin %s for mountpoint %s", opt + 5, mount);
+    }
+    else if (ntripcaster_strcmp(opt, "nearest") == 0)
+      ms->nearest = 1;
+    else if (ntripcaster_strncmp(opt, "types=", 6) == 0 || ntripcaster_strncmp(opt, "exclude=", 8) == 0) {
+      rtcm3_filter_t *check;
+      char *types = strchr(opt, '=') + 1;
+
+      if (ms->types) {
+        nfree(ms->types);
+      }
+      ms->exclude = (opt[0] == 'e');
+
+      if ((check = rtcm3_filter_create(types, ms->exclude)) == NULL)
+        write_log(LOG_DEFAULT, "WARNING: Invalid message types %s for mountpoint %s", types, mount);
+      else
+        ms->types = my_strdup(types);
+      rtcm3_filter_free(check);
+    }
+    else
+      write_log(LOG_DEFAULT, "WARNING: Unknown setting %s for mountpoint %s", opt, mount);
+  }
+}
+
+/* Make the mountpoint settings of a freshly read config file the current
+ * ones. Mounts or settings no longer in the file go back to the defaults. */
+void source_set_mount_settings(avl_tree *settings) {
+  avl_tree *old;
+
+  thread_mutex_lock (&info.misc_mutex);
+  old = info.mountsettings;
+  info.mountsettings = settings;
+  thread_mutex_unlock (&info.misc_mutex);
+
+  if (old != NULL)
+    avl_destroy(old, (avl_node_func)free_mount_settings);
+}
+
+/* Bytes of client backlog for the given mount */
+unsigned long source_buffer_size(const char *mount) {
+  mountsettings_t *ms, search;
+  unsigned long size = 0;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL)
+    size = ms->buffer_size;
+  thread_mutex_unlock (&info.misc_mutex);
+
+  if (size == 0)
+    size = info.mount_buffer_size;
+
+  /* at least a few reads from the source */
+  if (size < 4 * SOURCE_READSIZE)
+    size = 4 * SOURCE_READSIZE;
+
+  return size;
+}
+
+/* Does the given mount carry RTCM3 frames clients should start on */
+int source_rtcm3_frames(const char *mount) {
+  mountsettings_t *ms, search;
+  int rtcm3 = 0;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL)
+    rtcm3 = ms->rtcm3;
+  thread_mutex_unlock (&info.misc_mutex);
+
+  return rtcm3;
+}
+
+/* Seconds per recorded segment of the given mount, 0 if it is not recorded */
+int source_record_period(const char *mount) {
+  mountsettings_t *ms, search;
+  int period = 0;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL)
+    period = ms->record;
+  thread_mutex_unlock (&info.misc_mutex);
+
+  return period;
+}
+
+/* The mount clients of the given mount move to when it fails, as a new
+ * string, or NULL if it has no twin */
+char *source_twin(const char *mount) {
+  mountsettings_t *ms, search;
+  char *twin = NULL;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL && ms->twin != NULL)
+    twin = nstrdup(ms->twin);
+  thread_mutex_unlock (&info.misc_mutex);
+
+  return twin;
+}
+
+/* Is the given mount served by the base nearest to each client */
+int source_nearest(const char *mount) {
+  mountsettings_t *ms, search;
+  int nearest = 0;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL)
+    nearest = ms->nearest;
+  thread_mutex_unlock (&info.misc_mutex);
+
+  return nearest;
+}
+
+/* "kick", "frame" or "epoch", lag_default_e for anything else */
+lag_policy_t source_parse_lag_policy(const char *name) {
+  if (name == NULL)
+    return lag_default_e;
+  if (ntripcaster_strcasecmp(name, "kick") == 0)
+    return lag_kick_e;
+  if (ntripcaster_strcasecmp(name, "frame") == 0)
+    return lag_frame_e;
+  if (ntripcaster_strcasecmp(name, "epoch") == 0)
+    return lag_epoch_e;
+  return lag_default_e;
+}
+
+/* What to do with clients of the given mount which fall out of the
+ * backlog: the mount's "lag=" setting, else the lag_policy setting */
+lag_policy_t source_lag_policy(const char *mount) {
+  mountsettings_t *ms, search;
+  lag_policy_t policy = lag_default_e;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL)
+    policy = ms->lag_policy;
+  if (policy == lag_default_e)
+    policy = source_parse_lag_policy(info.lag_policy);
+  thread_mutex_unlock (&info.misc_mutex);
+
+  if (policy == lag_default_e)
+    policy = lag_kick_e;
+
+  return policy;
+}
+
+/* For a virtual mount with "source=" and "types=" or "exclude=" settings,
+ * copy the mount its data comes from to real (BUFSIZE bytes) and return
+ * a new, unshared message filter. Returns NULL for any other mount.
+ */
+rtcm3_filter_t *source_mount_filter(const char *mount, char *real) {
+  mountsettings_t *ms, search;
+  rtcm3_filter_t *filter = NULL;
+
+  search.mount = (char *)mount;
+
+  thread_mutex_lock (&info.misc_mutex);
+  ms = avl_find(info.mountsettings, &search);
+  if (ms != NULL && ms->source != NULL && ms->types != NULL) {
+    filter = rtcm3_filter_create(ms->types, ms->exclude);
+    strncpy(real, ms->source, BUFSIZE);
+    real[BUFSIZE-1] = 0;
+  }
+  thread_mutex_unlock (&info.misc_mutex);
+
+  return filter;
 }
@@ -44,18 +44,24 @@ void http_source_login(connection_t *con, ntrip_request_t *req);
 int authenticate_source_request(connection_t *con, ntrip_request_t *req);
 void *source_rtsp_function(void *conarg);
 void kick_source(source_t *sor, char *why);
+statisticsentry_t *get_mount_stats(const char *mount);
 void add_global_stats(source_t *sor);
 void *source_func(void *con);
+void source_start_workers ();
+void source_wake (source_t *source);
 void put_source(connection_t *con);
 void add_source ();
 void del_source ();
+void mount_index_add (connection_t *con);
+void mount_index_remove (connection_t *con);
+connection_t *mount_index_find (const char *mount);
+connection_t *mount_index_find_host (const char *host, int port, const char *path);
 connection_t *find_mount(char *mount);
 connection_t *find_mount_with_req (ntrip_request_t *req, alias_t **wasalias);
 connection_t *get_default_mount();
-void add_chunk (connection_t *sourcecon);
+int add_chunk (connection_t *sourcecon);
 void write_chunk (source_t *source, connection_t *clicon);
-void kick_trailing_clients(source_t *source);
-void kick_clients_on_cid(source_t *source);
+void source_make_room (source_t *source, unsigned long len);
 void kick_dead_clients (source_t *source);
 //void move_clients_to_default_mount (connection_t *con);
 //int originating_id (connection_t *sourcecon, char *dshost);
@@ -68,14 +74,24 @@ connection_t *get_source_from_host (connection_t *con);
 void describe_source (const com_request_t *req, const connection_t *sourcecon);
 //const char *sourceproto_to_string (protocol_t proto);
 const char *source_type(const connection_t *con);
-int start_chunk (source_t *source);
+unsigned long long start_position (source_t *source);
 connection_t *get_twin_mount (source_t *scon);
 connection_t *get_twin_mount_wl (source_t *scon);
-void move_to_smaller_twin (source_t *source, connection_t *clicon);
+void move_to_twin (source_t *source, connection_t *clicon, connection_t *twincon);
 void source_write_to_client (source_t *source, connection_t *clicon);
 void source_get_new_clients (source_t *source);
 int source_get_id (char *arg);
 void add_nontrip_source(char *line); // nontrip. ajd
-int source_fill_chunks(source_t *source, const char *buf, int len);
+void add_mount_settings(avl_tree *settings, char *line);
+void source_set_mount_settings(avl_tree *settings);
+unsigned long source_buffer_size(const char *mount);
+int source_rtcm3_frames(const char *mount);
+rtcm3_filter_t *source_mount_filter(const char *mount, char *real);
+int source_record_period(const char *mount);
+lag_policy_t source_parse_lag_policy(const char *name);
+lag_policy_t source_lag_policy(const char *mount);
+char *source_twin(const char *mount);
+int source_nearest(const char *mount);
+ring_t *client_ring (source_t *source, const client_t *client);
 #endif
 
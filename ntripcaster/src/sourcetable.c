@@ -96,6 +96,7 @@
 #include "logtime.h"
 #include "alias.h"
 #include "match.h"
+#include "geoindex.h"
 
 extern server_info_t info;
 
@@ -151,61 +152,107 @@ sourcetable_field_t network_entry_fields[] = {
   { unknown_type_e, NULL, NULL }
 };
 
-void send_sourcetable (connection_t *con) {
+static int compare_entry_serials(const void *a, const void *b)
+{
+  const sourcetable_entry_t *sa = *(sourcetable_entry_t * const *)a;
+  const sourcetable_entry_t *sb = *(sourcetable_entry_t * const *)b;
+
+  return (sa->serial > sb->serial) - (sa->serial < sb->serial);
+}
+
+/* must have sourcetable_mutex. Ends the lines in sb and takes them over. */
+static sourcetable_body_t *new_sourcetable_body(string_buffer_t *sb) {
+  sourcetable_body_t *body;
+
+  write_line_to_buffer(sb, "ENDSOURCETABLE");
+
+  body = (sourcetable_body_t *)nmalloc(sizeof(sourcetable_body_t));
+  body->refs = 1;
+  body->generation = info.sourcetable.generation;
+  body->len = sb->pos;
+  body->buf = sb->buf;
+  nfree(sb);
+
+  return body;
+}
+
+/* must have sourcetable_mutex. */
+static sourcetable_body_t *build_sourcetable_body(void) {
   avl_traverser trav = {0};
-  sourcetable_entry_t *se;
+  sourcetable_entry_t *se, **shown;
+  sourcetable_body_t *body;
   string_buffer_t *sb;
-  char time[50];
-  const char *datatype = "text/plain";
+  int i, n = 0;
 
-  thread_mutex_lock(&info.sourcetable_mutex);
+  shown = (sourcetable_entry_t **)nmalloc((info.sourcetable.lines+1)*sizeof(sourcetable_entry_t *));
+  while ((se = avl_traverse (info.sourcetable.tree, &trav)))
+    if (se->show == 1) shown[n++] = se;
 
-  sb = string_buffer_create(info.sourcetable.length+(info.sourcetable.lines*2)+1);
+  /* Lines are sent in the order of the sourcetable file */
+  qsort(shown, n, sizeof(sourcetable_entry_t *), compare_entry_serials);
 
-  {
-    int found=0;
-    int minfound=-1;
-    int oldmin;
-
-    while ((se = avl_traverse (info.sourcetable.tree, &trav))) if (se->show == 1) {
-      if (!found) minfound = se->serial;
-      found=1;
-      minfound = ( minfound <= se->serial) ? minfound : se->serial;
-    }
+  sb = string_buffer_create(info.sourcetable.length+(info.sourcetable.lines*2)+17);
+  for (i = 0; i < n; i++)
+    write_line_to_buffer(sb, shown[i]->line);
+  nfree(shown);
 
-    while(found) {
-      while ((se = avl_traverse (info.sourcetable.tree, &trav)))
-      if (se->show == 1 &&  se->serial==minfound) {
+  body = new_sourcetable_body(sb);
 
-        write_line_to_buffer(sb, se->line);
-        found=0;
-      }
+  xa_debug (2, "DEBUG: build_sourcetable_body: %d lines, %d bytes, generation %lu", n, body->len, body->generation);
 
-      oldmin=minfound;
-      minfound = 0x7fffff;
+  return body;
+}
 
-      while ((se = avl_traverse (info.sourcetable.tree, &trav)))
-      if (se->show == 1 && se->serial > oldmin && se->serial < minfound) {
-        found=1;
-        minfound = se->serial;
-      }
-    }
+/* must have sourcetable_mutex. */
+static void release_sourcetable_body(sourcetable_body_t *body) {
+  if (--body->refs == 0) {
+    nfree(body->buf);
+    nfree(body);
   }
+}
+
+/* must have sourcetable_mutex. The cached body is rebuilt on next use. */
+static void sourcetable_changed(void) {
+  info.sourcetable.generation++;
+}
+
+/* Returns the current response body with a reference held for the caller. */
+static sourcetable_body_t *get_sourcetable_body(void) {
+  sourcetable_body_t *body;
+
+  thread_mutex_lock(&info.sourcetable_mutex);
+
+  body = info.sourcetable.body;
+  if (body == NULL || body->generation != info.sourcetable.generation) {
+    if (body != NULL)
+      release_sourcetable_body(body);
+    body = info.sourcetable.body = build_sourcetable_body();
+  }
+  body->refs++;
 
   thread_mutex_unlock(&info.sourcetable_mutex);
 
-  if (con->com_protocol == ntrip2_0_e && !strncasecmp(get_user_agent(con), "ntrip", 5))
-    datatype = "gnss/sourcetable";
-  ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time), datatype, sb->pos+16);
+  return body;
+}
+
+static void put_sourcetable_body(sourcetable_body_t *body) {
+  thread_mutex_lock(&info.sourcetable_mutex);
+  release_sourcetable_body(body);
+  thread_mutex_unlock(&info.sourcetable_mutex);
+}
 
+/* Sends a body after its header and releases it. The client socket is
+ * still nonblocking during login, so the body is written until it is
+ * complete or the client is gone. */
+static void send_sourcetable_body(connection_t *con, sourcetable_body_t *body) {
   if(con->udpbuffers)
     con->rtp->datagram->pt = 96;
 
-  sock_write_string_con(con, sb->buf);
+  if (!sock_write_buffer_con(con, body->buf, body->len))
+    write_log(LOG_DEFAULT, "WARNING: Sending the sourcetable to client %d [%s] failed, %s", con->id, con_host (con), strerror(errno));
 
-  dispose_string_buffer(sb);
+  put_sourcetable_body(body);
 
-  sock_write_line_con (con, "ENDSOURCETABLE");
   if(con->udpbuffers)
   {
     con->rtp->datagram->pt = 98;
@@ -213,46 +260,233 @@ void send_sourcetable (connection_t *con) {
   }
 }
 
-void send_sourcetable_filtered(connection_t *con, char *filter, int matchonly) {
-  avl_traverser trav = {0};
-  sourcetable_entry_t *se;
-  string_buffer_t *sb;
-  list_t *l;
+void send_sourcetable (connection_t *con) {
+  sourcetable_body_t *body;
   char time[50];
+  const char *datatype = "text/plain";
 
-  l = get_filter_expression_list(filter,matchonly);
+  body = get_sourcetable_body();
 
-  thread_mutex_lock(&info.sourcetable_mutex);
+  if (con->com_protocol == ntrip2_0_e && !strncasecmp(get_user_agent(con), "ntrip", 5))
+    datatype = "gnss/sourcetable";
+  ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time), datatype, body->len);
+
+  send_sourcetable_body(con, body);
+}
+
+/* must have sourcetable_mutex. */
+static sourcetable_body_t *build_filtered_body(list_t *l) {
+  avl_traverser trav = {0};
+  sourcetable_entry_t *se;
+  string_buffer_t *sb;
 
-  sb = string_buffer_create(info.sourcetable.length+(info.sourcetable.lines*2)+1);
+  sb = string_buffer_create(info.sourcetable.length+(info.sourcetable.lines*2)+17);
 
   while ((se = avl_traverse (info.sourcetable.tree, &trav))) {
     if (match_sourcetable_entry(l, se) == 1)
       write_line_to_buffer(sb, se->line);
   }
 
+  return new_sourcetable_body(sb);
+}
+
+/* Filter queries are kept in info.sourcetable.filters and in a list from
+ * the most to the least recently used one, which is dropped when there are
+ * more than SOURCETABLE_FILTER_CACHE. Must have sourcetable_mutex. */
+
+static void filter_lru_unlink(sourcetable_filter_t *f) {
+  if (f->prev) f->prev->next = f->next;
+  else info.sourcetable.lru_first = f->next;
+  if (f->next) f->next->prev = f->prev;
+  else info.sourcetable.lru_last = f->prev;
+  f->prev = f->next = NULL;
+}
+
+static void filter_lru_push(sourcetable_filter_t *f) {
+  f->prev = NULL;
+  f->next = info.sourcetable.lru_first;
+  if (f->next) f->next->prev = f;
+  else info.sourcetable.lru_last = f;
+  info.sourcetable.lru_first = f;
+}
+
+static void free_sourcetable_filter(sourcetable_filter_t *f, void *param) {
+  list_dispose_with_data(f->expressions, dispose_parse_tree);
+  if (f->body)
+    release_sourcetable_body(f->body);
+  nfree(f->filter);
+  nfree(f);
+}
+
+/* Returns the response body for a filter query with a reference held for
+ * the caller. Empty trailing fields do not change the result and are cut
+ * off, so "STR;;RTCM 3" and "STR;;RTCM 3;;" share one entry. */
+static sourcetable_body_t *get_filtered_body(const char *filter, int matchonly) {
+  sourcetable_filter_t search, *f;
+  sourcetable_body_t *body;
+  char *key = nstrdup(filter);
+  int len = strlen(key);
+
+  while (len > 0 && key[len-1] == ';')
+    key[--len] = '\0';
+
+  search.filter = key;
+  search.matchonly = matchonly;
+
+  thread_mutex_lock(&info.sourcetable_mutex);
+
+  f = avl_find(info.sourcetable.filters, &search);
+  if (f == NULL) {
+    f = (sourcetable_filter_t *)nmalloc(sizeof(sourcetable_filter_t));
+    f->filter = key;
+    f->matchonly = matchonly;
+    f->expressions = get_filter_expression_list(key, matchonly);
+    f->body = NULL;
+    key = NULL;
+    avl_insert(info.sourcetable.filters, f);
+    filter_lru_push(f);
+
+    if (avl_count(info.sourcetable.filters) > SOURCETABLE_FILTER_CACHE) {
+      sourcetable_filter_t *old = info.sourcetable.lru_last;
+
+      filter_lru_unlink(old);
+      avl_delete(info.sourcetable.filters, old);
+      free_sourcetable_filter(old, NULL);
+    }
+  } else if (f != info.sourcetable.lru_first) {
+    filter_lru_unlink(f);
+    filter_lru_push(f);
+  }
+
+  if (f->body == NULL || f->body->generation != info.sourcetable.generation) {
+    if (f->body != NULL)
+      release_sourcetable_body(f->body);
+    f->body = build_filtered_body(f->expressions);
+  }
+  body = f->body;
+  body->refs++;
+
+  thread_mutex_unlock(&info.sourcetable_mutex);
+
+  if (key != NULL)
+  {
+    nfree(key);
+  }
+
+  return body;
+}
+
+void send_sourcetable_filtered(connection_t *con, char *filter, int matchonly) {
+  sourcetable_body_t *body;
+  char time[50];
+
+  body = get_filtered_body(filter, matchonly);
+
   if (con->com_protocol == ntrip2_0_e)
-    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"gnss/sourcetable",sb->pos+16);
+    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"gnss/sourcetable",body->len);
   else
-    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"text/plain",sb->pos+16);
+    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"text/plain",body->len);
 
-  if(con->udpbuffers)
-    con->rtp->datagram->pt = 96;
+  send_sourcetable_body(con, body);
+}
 
-  sock_write_string_con(con, sb->buf);
+/* must have sourcetable_mutex. Indexes the positions of the STR entries
+ * of connected mountpoints, rebuilt after the shown lines changed. Entries
+ * without a position (latitude and longitude 0) are left out. */
+static void update_live_index(void) {
+  avl_traverser trav = {0};
+  sourcetable_entry_t *se;
+  geoindex_node_t *nodes;
+  double lat, lon;
+  int n = 0;
 
-  dispose_string_buffer(sb);
+  if (info.sourcetable.live_generation == info.sourcetable.generation)
+    return;
+
+  nodes = (geoindex_node_t *)nmalloc((info.sourcetable.lines+1)*sizeof(geoindex_node_t));
+  while ((se = avl_traverse (info.sourcetable.tree, &trav))) {
+    if (se->type != str_e || se->show != 1)
+      continue;
+    lat = get_real_value_by_index(se->fields, 9);
+    lon = get_real_value_by_index(se->fields, 10);
+    if (lat < -90.0 || lat > 90.0 || (lat == 0.0 && lon == 0.0))
+      continue;
+    geoindex_point(lat, lon, nodes[n].p);
+    nodes[n].data = se;
+    n++;
+  }
+
+  geoindex_build(&info.sourcetable.live, nodes, n);
+  info.sourcetable.live_generation = info.sourcetable.generation;
+
+  xa_debug (2, "DEBUG: update_live_index: %d positions, generation %lu", n, info.sourcetable.generation);
+}
+
+/* Copies the mounts of the (at most) k connected mountpoints nearest to a
+ * position, nearest first, as new strings to mounts and their distances
+ * in km to km. Returns the number found. */
+int sourcetable_nearest(double lat, double lon, int k, char **mounts, double *km) {
+  sourcetable_entry_t **found;
+  int i, n;
+
+  found = (sourcetable_entry_t **)nmalloc((k > 0 ? k : 1)*sizeof(sourcetable_entry_t *));
+
+  thread_mutex_lock(&info.sourcetable_mutex);
+
+  update_live_index();
+  n = geoindex_nearest(&info.sourcetable.live, lat, lon, k, (void **)found, km);
+  for (i = 0; i < n; i++)
+    mounts[i] = nstrdup(found[i]->id);
 
   thread_mutex_unlock(&info.sourcetable_mutex);
 
-  sock_write_line_con (con, "ENDSOURCETABLE");
-  if(con->udpbuffers)
-  {
-    con->rtp->datagram->pt = 98;
-    sock_write_string_con(con, "");
+  nfree(found);
+  return n;
+}
+
+/* Sends the STR lines of the connected mountpoints nearest to a position,
+ * nearest first, for a query ";LAT;LON" or ";LAT;LON;COUNT". */
+void send_sourcetable_near(connection_t *con, char *query) {
+  sourcetable_entry_t **found;
+  sourcetable_body_t *body;
+  string_buffer_t *sb;
+  double lat, lon;
+  int i, n, len, count = SOURCETABLE_NEAR_DEFAULT;
+  char time[50];
+
+  if (sscanf(query, ";%lf;%lf;%d", &lat, &lon, &count) < 2 || lat < -90.0 || lat > 90.0) {
+    ntrip_write_message(con, HTTP_BAD_REQUEST, get_formatted_time(HEADER_TIME, time));
+    return;
   }
+  if (count < 1)
+    count = 1;
+  else if (count > SOURCETABLE_NEAR_MAX)
+    count = SOURCETABLE_NEAR_MAX;
+
+  found = (sourcetable_entry_t **)nmalloc(count*sizeof(sourcetable_entry_t *));
+
+  thread_mutex_lock(&info.sourcetable_mutex);
+
+  update_live_index();
+  n = geoindex_nearest(&info.sourcetable.live, lat, lon, count, (void **)found, NULL);
+
+  for (i = 0, len = 17; i < n; i++)
+    len += found[i]->linelen+2;
+  sb = string_buffer_create(len);
+  for (i = 0; i < n; i++)
+    write_line_to_buffer(sb, found[i]->line);
+  body = new_sourcetable_body(sb);
+
+  thread_mutex_unlock(&info.sourcetable_mutex);
+
+  nfree(found);
+
+  if (con->com_protocol == ntrip2_0_e)
+    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"gnss/sourcetable",body->len);
+  else
+    ntrip_write_message(con, HTTP_GET_SOURCETABLE_OK, get_formatted_time(HEADER_TIME, time),"text/plain",body->len);
 
-  list_dispose_with_data(l, dispose_parse_tree );
+  send_sourcetable_body(con, body);
 }
 
 static void freesourcetableentry(sourcetable_entry_t *st, void *param)
@@ -261,58 +495,105 @@ static void freesourcetableentry(sourcetable_entry_t *st, void *param)
   nfree(st);
 }
 
+static void freedroppedentry(sourcetable_entry_t *st)
+{
+  freesourcetableentry(st, NULL);
+}
+
+/* Reads the sourcetable file into a new tree without holding
+ * sourcetable_mutex, then swaps it in. Entries whose line did not change
+ * keep their allocation and shown state, changed lines keep the shown
+ * state of the entry they replace, lines no longer in the file are
+ * dropped. The serial of an entry is its position in the file. */
 void read_sourcetable(void) {
-        static int serial = 0;
-  int st;
+  int st, serial = 0, length = 0, lines = 0, changed = 0;
   char pathandfile[BUFSIZE], line[BUFSIZE];
   sourcetable_entry_t *newste = NULL, *oldste = NULL;
+  avl_traverser trav = {0};
+  avl_tree *fresh, *stale;
+  list_t *dropped;
 
   get_ntripcaster_file (info.sourcetablefile, conf_file_e, R_OK, pathandfile);
   st = open_for_reading(pathandfile);
 
-  if (st > -1) {
-    thread_mutex_lock(&info.sourcetable_mutex);
+  if (st < 0) {
+    write_log(LOG_DEFAULT, "WARNING: Could not open %s !", info.sourcetablefile);
+    return;
+  }
 
-    while (fd_read_line (st, line, BUFSIZE)) {
-      newste = create_sourcetable_entry();
-      newste->line = nstrdup(line);
-      newste->linelen = strlen(line);
+  fresh = avl_create(compare_sourcetable_entrys, &info);
+  dropped = list_create();
 
-      newste->type = get_sourcetable_entry_type(line);
-      newste->serial = serial++;
-      if (newste->type == str_e)
-        newste->show = 0;
-      else
-        newste->show = 1;
+  while (fd_read_line (st, line, BUFSIZE)) {
+    newste = create_sourcetable_entry();
+    newste->line = nstrdup(line);
+    newste->linelen = strlen(line);
 
-      xa_debug (2, "DEBUG: read_sourcetable: creating fields for [%s]...", line);
+    newste->type = get_sourcetable_entry_type(line);
+    newste->serial = serial++;
+    if (newste->type == str_e)
+      newste->show = 0;
+    else
+      newste->show = 1;
 
-      newste->fields = create_entry_fields(newste->type, line);
+    xa_debug (2, "DEBUG: read_sourcetable: creating fields for [%s]...", line);
 
-      xa_debug (2, "DEBUG: read_sourcetable: creating id... ");
+    newste->fields = create_entry_fields(newste->type, line);
 
-      newste->id = create_entry_id(newste);
+    xa_debug (2, "DEBUG: read_sourcetable: creating id... ");
 
-      xa_debug (2, "DEBUG: read_sourcetable: id: [%s]", newste->id);
+    newste->id = create_entry_id(newste);
 
-      oldste = avl_replace(info.sourcetable.tree, newste);
+    xa_debug (2, "DEBUG: read_sourcetable: id: [%s]", newste->id);
 
-      if (oldste != NULL) {
-        newste->show = oldste->show;
-        info.sourcetable.length -= oldste->linelen;
-        info.sourcetable.lines--;
+    oldste = avl_replace(fresh, newste);
+    if (oldste != NULL)
+      list_add(dropped, oldste);
+  }
 
-        freesourcetableentry(oldste, 0);
-      }
+  fd_close(st);
 
-      info.sourcetable.length += newste->linelen;
-      info.sourcetable.lines++;
+  thread_mutex_lock(&info.sourcetable_mutex);
+
+  while ((newste = avl_traverse (fresh, &trav))) {
+    oldste = avl_find(info.sourcetable.tree, newste);
+    if (oldste == NULL) {
+      changed = 1;
+    } else if (oldste->linelen != newste->linelen || strcmp(oldste->line, newste->line) != 0) {
+      newste->show = oldste->show;
+      changed = 1;
+    } else {
+      if (oldste->serial != newste->serial) {
+        oldste->serial = newste->serial;
+        changed = 1;
+      }
+      avl_delete(info.sourcetable.tree, oldste);
+      avl_replace(fresh, oldste);
+      list_add(dropped, newste);
+      newste = oldste;
     }
+    length += newste->linelen;
+    lines++;
+  }
+
+  /* whatever is left of the old tree was changed or removed */
+  if (avl_count(info.sourcetable.tree) > 0)
+    changed = 1;
 
-    thread_mutex_unlock(&info.sourcetable_mutex);
+  stale = info.sourcetable.tree;
+  info.sourcetable.tree = fresh;
+  info.sourcetable.length = length;
+  info.sourcetable.lines = lines;
 
-    fd_close(st);
-  } else write_log(LOG_DEFAULT, "WARNING: Could not open %s !", info.sourcetablefile);
+  if (changed)
+    sourcetable_changed();
+
+  thread_mutex_unlock(&info.sourcetable_mutex);
+
+  xa_debug (2, "DEBUG: read_sourcetable: %d lines, %s", lines, changed ? "changed" : "unchanged");
+
+  avl_destroy(stale, (avl_node_func)freesourcetableentry);
+  list_dispose_with_data(dropped, freedroppedentry);
 }
 
 void sourcetable_add_source(source_t *source) {
@@ -325,7 +606,10 @@ void sourcetable_add_source(source_t *source) {
   thread_mutex_lock(&info.sourcetable_mutex);
 
   found = avl_find(info.sourcetable.tree, &search);
-  if (found != NULL) found->show = 1;
+  if (found != NULL && found->show != 1) {
+    found->show = 1;
+    sourcetable_changed();
+  }
 
   thread_mutex_unlock(&info.sourcetable_mutex);
 }
@@ -340,7 +624,10 @@ void sourcetable_remove_source(source_t *source) {
   thread_mutex_lock(&info.sourcetable_mutex);
 
   found = avl_find(info.sourcetable.tree, &search);
-  if (found != NULL) found->show = 0;
+  if (found != NULL && found->show != 0) {
+    found->show = 0;
+    sourcetable_changed();
+  }
 
   thread_mutex_unlock(&info.sourcetable_mutex);
 }
@@ -350,6 +637,14 @@ void cleanup_sourcetable(void)
   thread_mutex_lock(&info.sourcetable_mutex);
   if (info.sourcetable.tree)
     avl_destroy(info.sourcetable.tree, (avl_node_func)freesourcetableentry);
+  if (info.sourcetable.body) {
+    release_sourcetable_body(info.sourcetable.body);
+    info.sourcetable.body = NULL;
+  }
+  if (info.sourcetable.filters)
+    avl_destroy(info.sourcetable.filters, (avl_node_func)free_sourcetable_filter);
+  info.sourcetable.lru_first = info.sourcetable.lru_last = NULL;
+  geoindex_free(&info.sourcetable.live);
   thread_mutex_unlock(&info.sourcetable_mutex);
 }
 
@@ -367,6 +662,8 @@ void sourcetable_set_show_status(void) {
     found = avl_find(info.sourcetable.tree, &search);
     if (found != NULL) found->show = 1;
   }
+
+  sourcetable_changed();
 }
 
 /* must have sourcetable_mutex. */
@@ -39,6 +39,12 @@
 #ifndef __SOURCETABLE_H
 #define __SOURCETABLE_H
 
+/* Number of distinct ?filter and ?match queries kept compiled. */
+#define SOURCETABLE_FILTER_CACHE 64
+/* Lines returned by a ?near query by default and at most. */
+#define SOURCETABLE_NEAR_DEFAULT 10
+#define SOURCETABLE_NEAR_MAX 100
+
 typedef enum { cas_e = 1, net_e = 2, str_e = 3, all_e = 4, unknown_e = -1 } sourcetable_entry_type_t;
 
 typedef struct sourcetable_entry_St {
@@ -59,6 +65,8 @@ typedef struct sourcetable_field_St {
 
 void send_sourcetable (connection_t *con);
 void send_sourcetable_filtered(connection_t *con, char *filter, int matchonly);
+void send_sourcetable_near(connection_t *con, char *query);
+int sourcetable_nearest(double lat, double lon, int k, char **mounts, double *km);
 void read_sourcetable(void);
 void cleanup_sourcetable(void);
 void sourcetable_add_source(source_t *source);
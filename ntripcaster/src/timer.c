@@ -98,6 +98,7 @@
 #include "commands.h"
 #include "relay.h"
 #include "source.h"
+#include "replay.h"
 
 #ifndef MSG_DONTWAIT
 #define MSG_DONTWAIT 0
@@ -213,8 +214,7 @@ timer_handle_transfer_statistics (time_t stime, time_t *trottime, time_t *juston
 
       zero_stats(&stat);
 
-      get_hourly_stats(&hourlystats);
-      zero_stats(&info.hourly_stats);
+      take_hourly_stats(&hourlystats);
       update_daily_statistics(&hourlystats);
       write_hourly_stats(&stat);
 
@@ -227,8 +227,7 @@ timer_handle_transfer_statistics (time_t stime, time_t *trottime, time_t *juston
 
       zero_stats(&stat);
 
-      get_hourly_stats(&stat);
-      zero_stats(&info.hourly_stats);
+      take_hourly_stats(&stat);
       update_daily_statistics(&stat);
       write_hourly_stats(&stat);
     }
@@ -302,12 +301,38 @@ timer_kick_abandoned_relays (time_t stime)
   }
 }
 
-void get_hourly_stats(statistics_t *stat)
+/* Sum of all source traffic since startup. Caller holds source_mutex
+   and misc_mutex. */
+static void
+sum_traffic (unsigned long long *read, unsigned long long *write)
 {
+  avl_traverser trav = {0};
+  connection_t *con;
+
+  *read = info.traffic_closed.read_bytes;
+  *write = info.traffic_closed.write_bytes;
+
+  while ((con = avl_traverse (info.sources, &trav))) {
+    *read += traffic_get (con->food.source->traffic.read_bytes);
+    *write += traffic_get (con->food.source->traffic.write_bytes);
+  }
+
+  /* the replay thread's source is not in info.sources */
+  if ((con = replay_get_source ()) != NULL)
+    *write += traffic_get (con->food.source->traffic.write_bytes);
+}
+
+static void
+get_hourly_stats_locked (statistics_t *stat, int reset)
+{
+  unsigned long long read, write;
+
+  thread_mutex_lock (&info.source_mutex);
   internal_lock_mutex (&info.misc_mutex);
-  stat->read_bytes = info.hourly_stats.read_bytes;
-  stat->write_bytes = info.hourly_stats.write_bytes;
-  internal_unlock_mutex (&info.misc_mutex);
+
+  sum_traffic (&read, &write);
+  stat->read_bytes = (unsigned long)(read - info.hourly_read_mark);
+  stat->write_bytes = (unsigned long)(write - info.hourly_write_mark);
 
   stat->read_kilos = info.hourly_stats.read_kilos;
   stat->write_kilos = info.hourly_stats.write_kilos;
@@ -316,6 +341,39 @@ void get_hourly_stats(statistics_t *stat)
   stat->source_connections = info.hourly_stats.source_connections;
   stat->client_connect_time = info.hourly_stats.client_connect_time;
   stat->source_connect_time = info.hourly_stats.source_connect_time;
+
+  if (reset) {
+    zero_stats (&info.hourly_stats);
+    info.hourly_read_mark = read;
+    info.hourly_write_mark = write;
+  }
+
+  internal_unlock_mutex (&info.misc_mutex);
+  thread_mutex_unlock (&info.source_mutex);
+}
+
+void get_hourly_stats(statistics_t *stat)
+{
+  get_hourly_stats_locked (stat, 0);
+}
+
+/* Get the hourly statistics and start over */
+void take_hourly_stats(statistics_t *stat)
+{
+  get_hourly_stats_locked (stat, 1);
+}
+
+/* Called with source_mutex held when a source goes away, keeps its
+   traffic in the sums. */
+void retire_traffic(source_t *source)
+{
+  internal_lock_mutex (&info.misc_mutex);
+  info.traffic_closed.read_bytes += source->traffic.read_bytes;
+  info.traffic_closed.write_bytes += source->traffic.write_bytes;
+  internal_unlock_mutex (&info.misc_mutex);
+
+  source->traffic.read_bytes = 0;
+  source->traffic.write_bytes = 0;
 }
 
 void write_hourly_stats(statistics_t *stat)
@@ -39,12 +39,24 @@
 #ifndef NTRIPCASTER_TIMER_H
 #define NTRIPCASTER_TIMER_H
 
+/* Per source traffic counters. Single writer, so a relaxed load and store
+ * is enough, the atomics only keep 64 bit values from tearing. */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define traffic_get(c) __atomic_load_n (&(c), __ATOMIC_RELAXED)
+#define traffic_add(c, n) __atomic_store_n (&(c), (c) + (n), __ATOMIC_RELAXED)
+#else
+#define traffic_get(c) (c)
+#define traffic_add(c, n) ((c) += (n))
+#endif
+
 void *startup_timer_thread(void *arg);
 void *startup_heartbeat_thread(void *arg);
 void *startup_udp_info_thread (void *arg);
 void *startup_relay_connector_thread(void *arg);
 void status_write(server_info_t *info);
 void get_hourly_stats(statistics_t *stat);
+void take_hourly_stats(statistics_t *stat);
+void retire_traffic(source_t *source);
 void write_hourly_stats(statistics_t *stat);
 void update_daily_statistics(statistics_t *stat);
 void get_daily_stats(statistics_t *stat);
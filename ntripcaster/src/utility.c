@@ -108,6 +108,11 @@
 #include "memory.h"
 #include "string.h"
 #include "vars.h"
+#include "event.h"
+#include "ring.h"
+#include "rtcm3.h"
+#include "recorder.h"
+#include "replay.h"
 #include "connection.h"
 #include "relay.h"
 #include "restrict.h"
@@ -331,9 +336,13 @@ kick_connection(void *conarg, void *reasonarg)
       } else {
         /* Let the source kill itself */
         if(con->sock >= 0)
+        {
+          event_del (con->food.source->events, con->sock);
           sock_close(con->sock); // in free_con() the socket is closed, too. ajd
+        }
         con->sock = -1; // added. ajd
         con->food.source->connected = SOURCE_KILLED;
+        source_wake (con->food.source);
       }
 
       return;
@@ -405,6 +414,10 @@ free_con (connection_t *con)
     nfree (con->http_chunk);
     con->http_chunk = NULL;
   }
+  if (con->readbuf != NULL) {
+    nfree (con->readbuf);
+    con->readbuf = NULL;
+  }
   if (con->udpbuffers != NULL) {
     thread_mutex_destroy(&con->udpbuffers->buffer_mutex);
     nfree (con->udpbuffers);
@@ -452,6 +465,8 @@ close_connection(void *data)
 
       if (!avl_delete(con->food.client->source->clients, con)) xa_debug (2, "DEBUG: Didn't find client in sourcetree!");
 
+      event_del (con->food.client->source->events, con->sock);
+
       if (con->food.client->virgin == 0)
         del_client (con, con->food.client->source);
       else
@@ -469,6 +484,23 @@ close_connection(void *data)
     rtsp_remove_connection_from_session(con, con->session_id); // rtsp. ajd
 
     free_con (con); /* Free:s stuff that all connections have */
+    if (con->food.client->prime)
+    {
+      nfree (con->food.client->prime);
+    }
+    /* shared filters are freed with their last client */
+    if (con->food.client->filter)
+      rtcm3_filter_release (con->food.client->source ? con->food.client->source->rtcm3 : NULL,
+                            con->food.client->filter);
+    replay_stop (&con->food.client->replay);
+    if (con->food.client->home)
+    {
+      nfree (con->food.client->home);
+    }
+    if (con->food.client->near)
+    {
+      nfree (con->food.client->near);
+    }
     nfree (con->food.client);
     nfree (con);
     return;
@@ -521,10 +553,21 @@ close_connection(void *data)
       avl_destroy (source->clients, NULL);
     }
 
+    ring_free (&source->ring);
+    rtcm3_free (source->rtcm3);
+    recorder_stop (source->recorder);
+    if (source->twin)
+    {
+      nfree (source->twin);
+    }
+
+    mount_index_remove (con);
     dispose_audiocast (&source->audiocast);
 
     info.hourly_stats.source_connect_time += ((get_time () - con->connect_time) / 60);
 
+    retire_traffic (source);
+
     if (con->food.source->connected != SOURCE_UNUSED)
     {
       del_source();
@@ -556,8 +599,13 @@ kick_not_connected (connection_t *con, char *reason)
 
   if (con->type == source_e) {
       avl_destroy (con->food.source->clients, NULL);
+      ring_free (&con->food.source->ring);
       nfree (con->food.source);
   } else if (con->type == client_e) {
+    if (con->food.client->near)
+    {
+      nfree (con->food.client->near);
+    }
     nfree (con->food.client);
   }
   else if (con->type == admin_e) {
@@ -720,15 +768,11 @@ find_source_with_id (int id)
 connection_t *
 find_source_with_mount (char *mount)
 {
-  avl_traverser trav = {0};
   connection_t *scon = NULL;
 
   thread_mutex_lock (&info.source_mutex);
 
-  while ((scon = avl_traverse (info.sources, &trav))) {
-    if (ntripcaster_strcmp (mount, scon->food.source->audiocast.mount) == 0)
-      break;
-  }
+  scon = mount_index_find (mount);
 
   thread_mutex_unlock (&info.source_mutex);
 
@@ -1223,18 +1267,7 @@ void build_request (connection_t *con, char *line, ntrip_request_t *req) {
 connection_t *
 mount_exists (char *mount)
 {
-  avl_traverser trav = {0};
-  connection_t *scon;
-
-  while ((scon = avl_traverse (info.sources, &trav)))
-  {
-    if ((ntripcaster_strcmp (mount, scon->food.source->audiocast.mount) == 0))
-    {
-      return scon;
-    }
-  }
-
-  return NULL;
+  return mount_index_find (mount);
 }
 
 void
@@ -1724,7 +1757,7 @@ show_runtime_configuration ()
   xa_debug (1, "Using posix signal interface to block all signals in threads that don't want them");
 #endif
 
-  xa_debug (1, "Using %d chunks of %d bytes for client backlog", CHUNKLEN, SOURCE_READSIZE);
+  xa_debug (1, "Using %d bytes of client backlog per mountpoint", info.mount_buffer_size);
 
   switch (info.resolv_type)
   {